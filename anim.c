@@ -1,15 +1,39 @@
 #include <assert.h>
+#include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 #include "anim.h"
 #include "cairo_util.h"
+#include "glyph.h"
 #include "log.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_SSE2 1
+#else
+#define HAVE_SSE2 0
+#endif
+
+const struct anim_config anim_default_config = {
+	.total_traces = 16,
+	.max_velocity = 100,
+	.min_velocity = 5,
+	.max_accel = 20,
+	.min_accel = -20,
+	.line_width = 2,
+	.trace_len = 40,
+	.decay_limit = 4,
+};
 
 static bool seeded = false;
 
-static inline int randrange(int min, int max) {
+void anim_seed(unsigned int seed) {
+	srand(seed);
+	seeded = true;
+}
+
+int anim_randrange(int min, int max) {
 	if (!seeded)
 	{
 		unsigned int data = 0x13832184;
@@ -21,8 +45,7 @@ static inline int randrange(int min, int max) {
 
 			data = (data << 10) ^ (data >> 10) ^ (data >> 22) ^ (data << 22);
 		}
-		srand(data);
-		seeded = true;
+		anim_seed(data);
 	}
 
 	const int range = max - min;
@@ -39,28 +62,7 @@ static inline int veclen(int x, int y) {
 	return x*x + y*y;
 }
 
-struct anim_context {
-	int cur_x, cur_y;	// Where the BIRD is now
-	int nxt_x, nxt_y;	// Where the BIRD is heading
-	enum { BIRD_LEFT, BIRD_RIGHT } nxt_foot;
-	int nxt_pos;		// Next trace position in the list
-	struct anim_config {
-		int total_traces;
-		int min_velocity;
-		int max_velocity;
-		int min_accel;
-		int max_accel;
-		int line_width;
-		int trace_len;
-		int decay_limit;
-	} cf;
-	struct trace {
-		int x, y;		// Trace root position
-		float angle;		// Trace rotation
-	} traces[0];
-};
-
-static bool check_velocity(const struct anim_context *actx,
+bool anim_check_velocity(const struct anim_context *actx,
 	const int dx, const int dy,
 	const int width, const int height)
 {
@@ -94,50 +96,88 @@ static bool check_velocity(const struct anim_context *actx,
 	return true;
 }
 
-struct anim_context *render_anim(cairo_t *cr, struct anim_context *actx, int width, int height)
+float anim_trace_angle(int dx, int dy, float foot)
 {
-//	printf("Render ... ");
-	const struct anim_config acfgl = {
-		.total_traces = 16,
-		.max_velocity = 100,
-		.min_velocity = 5,
-		.max_accel = 20,
-		.min_accel = -20,
-		.line_width = 2,
-		.trace_len = 40,
-		.decay_limit = 4,
-	}, *acfg = &acfgl;
+	return atan2f(dy, dx) + foot;
+}
+
+static void init_geometry(struct anim_geometry *g, float *storage, int capacity)
+{
+	float **arrays[ANIM_GEOMETRY_ARRAYS] = {
+		&g->alpha, &g->angle, &g->sin, &g->cos, &g->x, &g->y,
+		&g->tip_x, &g->tip_y, &g->fork_x, &g->fork_y,
+		&g->toe_lx, &g->toe_ly, &g->toe_rx, &g->toe_ry,
+	};
+	g->count = 0;
+	for (int i = 0; i < ANIM_GEOMETRY_ARRAYS; i++)
+		*arrays[i] = storage + (size_t)i * capacity;
+}
 
+struct anim_context *anim_alloc(const struct anim_config *cf)
+{
+	/* Allocate context, followed by the traces and the geometry arrays */
+	size_t sz = sizeof(struct anim_context) +
+		cf->total_traces * (sizeof(struct trace) +
+			ANIM_GEOMETRY_ARRAYS * sizeof(float));
+	struct anim_context *actx = malloc(sz);
 	if (!actx)
-	{
-		/* Allocate context */
-		int sz = sizeof *actx + acfg->total_traces * sizeof actx->traces[0];
-		actx = malloc(sz);
+		return NULL;
+
+	*actx = (struct anim_context) {
+		.nxt_foot = BIRD_LEFT,
+		.cf = *cf,
+		.decay_levels = cf->decay_limit,
+	};
+	init_geometry(&actx->geometry,
+		(float *)&actx->traces[cf->total_traces], cf->total_traces);
+	return actx;
+}
 
+struct anim_context *anim_create(const struct anim_config *cf, int width, int height)
+{
+	struct anim_context *actx = anim_alloc(cf);
+	if (!actx)
+		return NULL;
+
+	int dx = 0, dy = 0;
+	bool ok;
+	do {
 		/* Generate initial position */
 		*actx = (struct anim_context) {
-			.cur_x = randrange(width/4, 3*width/4),
-			.cur_y = randrange(height/4, 3*height/4),
+			.cur_x = anim_randrange(width/4, 3*width/4),
+			.cur_y = anim_randrange(height/4, 3*height/4),
 			.nxt_foot = BIRD_LEFT,
-			.cf = *acfg,
+			.cf = *cf,
+			.decay_levels = cf->decay_limit,
+			.geometry = actx->geometry,
 		};
 
-		/* Generate initial velocity */
-		int dx, dy, check = 0;
-		do {
-			if (check++ > 128)
-			{
-				free(actx);
-				return render_anim(cr, NULL, width, height);
-			}
-			dx = randrange(-acfg->max_velocity, acfg->max_velocity + 1);
-			dy = randrange(-acfg->max_velocity, acfg->max_velocity + 1);
-		} while (!check_velocity(actx, dx, dy, width, height));
+		/* Generate initial velocity, start over if there is none */
+		ok = false;
+		for (int check = 0; !ok && check <= 128; check++)
+		{
+			dx = anim_randrange(-cf->max_velocity, cf->max_velocity + 1);
+			dy = anim_randrange(-cf->max_velocity, cf->max_velocity + 1);
+			ok = anim_check_velocity(actx, dx, dy, width, height);
+		}
+	} while (!ok);
 
-		/* Write the next position */
-		actx->nxt_x = actx->cur_x + dx;
-		actx->nxt_y = actx->cur_y + dy;
-	}
+	/* Write the next position */
+	actx->nxt_x = actx->cur_x + dx;
+	actx->nxt_y = actx->cur_y + dy;
+
+	return actx;
+}
+
+struct anim_context *anim_step(struct anim_context *actx, int width, int height)
+{
+	return anim_step_steered(actx, width, height, 0, 0);
+}
+
+struct anim_context *anim_step_steered(struct anim_context *actx,
+	int width, int height, int ax, int ay)
+{
+	const struct anim_config *acfg = &actx->cf;
 
 	/* Switch legs */
 	float foot = 0;
@@ -156,7 +196,8 @@ struct anim_context *render_anim(cairo_t *cr, struct anim_context *actx, int wid
 	actx->traces[actx->nxt_pos % actx->cf.total_traces] = (struct trace) {
 		.x = actx->cur_x,
 		.y = actx->cur_y,
-		.angle = atan2f(actx->nxt_y - actx->cur_y, actx->nxt_x - actx->cur_x) + foot,
+		.angle = anim_trace_angle(actx->nxt_x - actx->cur_x,
+				actx->nxt_y - actx->cur_y, foot),
 	};
 
 	/* Next next trace array position */
@@ -175,63 +216,396 @@ struct anim_context *render_anim(cairo_t *cr, struct anim_context *actx, int wid
 	do {
 		if (check++ > 128)
 		{
+			struct anim_context *fresh = anim_create(acfg, width, height);
 			free(actx);
-			return render_anim(cr, NULL, width, height);
+			return fresh;
 		}
-		dx = cx + randrange(
+		/* Give up steering if it keeps leading nowhere */
+		if (check == 64)
+			ax = ay = 0;
+		dx = cx + ax + anim_randrange(
 			acfg->min_accel / (3*(actx->cur_x < width / 4) + 1),
 			(acfg->max_accel+1) / (3*(actx->cur_x > 3*width / 4) + 1)
 			);
-		dy = cy + randrange(
+		dy = cy + ay + anim_randrange(
 			acfg->min_accel / (3*(actx->cur_y < height / 4) + 1),
 			(acfg->max_accel+1) / (3*(actx->cur_y > 3*height / 4) + 1));
-	} while (!check_velocity(actx, dx, dy, width, height));
+	} while (!anim_check_velocity(actx, dx, dy, width, height));
 
 	/* Write the next position */
 	actx->nxt_x = actx->cur_x + dx;
 	actx->nxt_y = actx->cur_y + dy;
 
-	/* Draw the background */
+	return actx;
+}
+
+struct anim_context *anim_fast_forward(struct anim_context *actx, int steps,
+	int width, int height)
+{
+	if (steps > actx->cf.total_traces)
+		steps = actx->cf.total_traces;
+	for (int i = 0; i < steps && actx; i++)
+		actx = anim_step(actx, width, height);
+	return actx;
+}
+
+void anim_translate(struct anim_context *actx, int dx, int dy)
+{
+	actx->cur_x += dx;
+	actx->cur_y += dy;
+	actx->nxt_x += dx;
+	actx->nxt_y += dy;
+	for (int i = 0; i < actx->cf.total_traces; i++)
+	{
+		actx->traces[i].x += dx;
+		actx->traces[i].y += dy;
+	}
+}
+
+static int rescale(int v, int to, int from)
+{
+	return (long long)v * to / from;
+}
+
+void anim_rescale(struct anim_context *actx, int from_width, int from_height,
+		int to_width, int to_height)
+{
+	actx->cur_x = rescale(actx->cur_x, to_width, from_width);
+	actx->cur_y = rescale(actx->cur_y, to_height, from_height);
+	actx->nxt_x = rescale(actx->nxt_x, to_width, from_width);
+	actx->nxt_y = rescale(actx->nxt_y, to_height, from_height);
+	for (int i = 0; i < actx->cf.total_traces; i++)
+	{
+		actx->traces[i].x = rescale(actx->traces[i].x, to_width, from_width);
+		actx->traces[i].y = rescale(actx->traces[i].y, to_height, from_height);
+	}
+}
+
+void anim_set_trace_source(cairo_t *cr, double alpha)
+{
+	cairo_set_source_rgba(cr, 0.8477, 0.7031, 0.1289, alpha);
+}
+
+/*
+ * sinf/cosf as in cephes: reduce to [-pi/4, pi/4] around the nearest
+ * multiple of pi/2, evaluate both polynomials and pick by quadrant
+ */
+#define TWO_OVER_PI 0.636619772367581343f
+#define PIO2_1 1.5703125f
+#define PIO2_2 4.837512969970703125e-4f
+#define PIO2_3 7.54978995489188216e-8f
+#define SIN_P0 -1.9515295891e-4f
+#define SIN_P1 8.3321608736e-3f
+#define SIN_P2 -1.6666654611e-1f
+#define COS_P0 2.443315711809948e-5f
+#define COS_P1 -1.388731625493765e-3f
+#define COS_P2 4.166664568298827e-2f
+
+static void sincos_array(const float *angle, float *sin, float *cos, int n)
+{
+	int i = 0;
+#if HAVE_SSE2
+	const __m128i one = _mm_set1_epi32(1), two = _mm_set1_epi32(2);
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(angle + i);
+		__m128i j = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(TWO_OVER_PI)));
+		__m128 jf = _mm_cvtepi32_ps(j);
+		__m128 r = _mm_sub_ps(x, _mm_mul_ps(jf, _mm_set1_ps(PIO2_1)));
+		r = _mm_sub_ps(r, _mm_mul_ps(jf, _mm_set1_ps(PIO2_2)));
+		r = _mm_sub_ps(r, _mm_mul_ps(jf, _mm_set1_ps(PIO2_3)));
+		__m128 z = _mm_mul_ps(r, r);
+
+		__m128 sp = _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(SIN_P0)),
+			_mm_set1_ps(SIN_P1));
+		sp = _mm_add_ps(_mm_mul_ps(sp, z), _mm_set1_ps(SIN_P2));
+		sp = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(sp, z), r), r);
+		__m128 cp = _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(COS_P0)),
+			_mm_set1_ps(COS_P1));
+		cp = _mm_add_ps(_mm_mul_ps(cp, z), _mm_set1_ps(COS_P2));
+		cp = _mm_mul_ps(_mm_mul_ps(cp, z), z);
+		cp = _mm_add_ps(_mm_sub_ps(cp, _mm_mul_ps(z, _mm_set1_ps(0.5f))),
+			_mm_set1_ps(1));
+
+		/* Odd quadrants swap sine and cosine, then fix up the signs */
+		__m128 swap = _mm_castsi128_ps(
+			_mm_cmpeq_epi32(_mm_and_si128(j, one), one));
+		__m128 sv = _mm_or_ps(_mm_and_ps(swap, cp), _mm_andnot_ps(swap, sp));
+		__m128 cv = _mm_or_ps(_mm_and_ps(swap, sp), _mm_andnot_ps(swap, cp));
+		__m128i sin_sign = _mm_slli_epi32(_mm_and_si128(j, two), 30);
+		__m128i cos_sign = _mm_slli_epi32(
+			_mm_and_si128(_mm_add_epi32(j, one), two), 30);
+		_mm_storeu_ps(sin + i, _mm_xor_ps(sv, _mm_castsi128_ps(sin_sign)));
+		_mm_storeu_ps(cos + i, _mm_xor_ps(cv, _mm_castsi128_ps(cos_sign)));
+	}
+#endif
+	for (; i < n; i++)
+	{
+		int j = (int)lrintf(angle[i] * TWO_OVER_PI);
+		float r = angle[i] - j * PIO2_1 - j * PIO2_2 - j * PIO2_3;
+		float z = r * r;
+		float sp = ((SIN_P0 * z + SIN_P1) * z + SIN_P2) * z * r + r;
+		float cp = ((COS_P0 * z + COS_P1) * z + COS_P2) * z * z - 0.5f * z + 1;
+		float sv = (j & 1) ? cp : sp;
+		float cv = (j & 1) ? sp : cp;
+		sin[i] = (j & 2) ? -sv : sv;
+		cos[i] = ((j + 1) & 2) ? -cv : cv;
+	}
+}
+
+/* Rotate the footprint of every trace in g by its angle. Custom ones are
+ * only transformed while adding their paths. */
+static void compute_geometry(struct anim_geometry *g, int trace_len,
+	const struct glyph *glyph)
+{
+	sincos_array(g->angle, g->sin, g->cos, g->count);
+	if (glyph)
+		return;
+
+	const float tl = trace_len;
+	const float fork = (trace_len * 3) / 5;
+	const float toe_a = (trace_len * 23) / 25;
+	const float toe_b = (trace_len * 6) / 25;
+	for (int i = 0; i < g->count; i++)
+	{
+		float x = g->x[i], y = g->y[i], s = g->sin[i], c = g->cos[i];
+		g->tip_x[i] = x + tl * c;
+		g->tip_y[i] = y + tl * s;
+		g->fork_x[i] = x + fork * c;
+		g->fork_y[i] = y + fork * s;
+		g->toe_lx[i] = x + toe_a * c - toe_b * s;
+		g->toe_ly[i] = y + toe_a * s + toe_b * c;
+		g->toe_rx[i] = x + toe_a * c + toe_b * s;
+		g->toe_ry[i] = y + toe_a * s - toe_b * c;
+	}
+}
+
+/* Rotate and scale the vertices of a custom footprint */
+static void add_glyph_path(cairo_t *cr, const struct glyph *glyph,
+	int trace_len, const struct anim_geometry *g, int i)
+{
+	float x = g->x[i], y = g->y[i];
+	float c = g->cos[i] * trace_len, s = g->sin[i] * trace_len;
+	int v = 0;
+	for (int p = 0; p < glyph->n_paths; p++)
+	{
+		cairo_move_to(cr, x + glyph->x[v] * c - glyph->y[v] * s,
+			y + glyph->x[v] * s + glyph->y[v] * c);
+		for (v++; v < glyph->path_end[p]; v++)
+			cairo_line_to(cr, x + glyph->x[v] * c - glyph->y[v] * s,
+				y + glyph->x[v] * s + glyph->y[v] * c);
+	}
+}
+
+static void add_trace_path(cairo_t *cr, const struct anim_context *actx,
+	const struct anim_geometry *g, int i)
+{
+	if (actx->glyph)
+	{
+		add_glyph_path(cr, actx->glyph, actx->cf.trace_len, g, i);
+		return;
+	}
+	cairo_move_to(cr, g->x[i], g->y[i]);
+	cairo_line_to(cr, g->tip_x[i], g->tip_y[i]);
+	cairo_move_to(cr, g->fork_x[i], g->fork_y[i]);
+	cairo_line_to(cr, g->toe_lx[i], g->toe_ly[i]);
+	cairo_move_to(cr, g->fork_x[i], g->fork_y[i]);
+	cairo_line_to(cr, g->toe_rx[i], g->toe_ry[i]);
+}
+
+void anim_draw_trace(cairo_t *cr, const struct anim_context *actx,
+	const struct trace *trace, double alpha)
+{
+	float storage[ANIM_GEOMETRY_ARRAYS];
+	struct anim_geometry g;
+	init_geometry(&g, storage, 1);
+	g.count = 1;
+	g.angle[0] = trace->angle;
+	g.x[0] = trace->x;
+	g.y[0] = trace->y;
+	compute_geometry(&g, actx->cf.trace_len, actx->glyph);
+
+	anim_set_trace_source(cr, alpha);
+	add_trace_path(cr, actx, &g, 0);
+	cairo_stroke(cr);
+}
+
+void anim_draw_background(cairo_t *cr, int width, int height)
+{
 	cairo_set_source_rgb(cr, 0.2000, 0.1500, 0);
 	cairo_rectangle(cr, 0, 0, width, height);
 	cairo_fill(cr);
+}
 
-	/* Draw the traces */
-//	cairo_set_source_rgb(cr, 0, 0, 0);
-	cairo_set_source_rgb(cr, 0.8477, 0.7031, 0.1289);
-	cairo_set_line_width(cr, acfg->line_width);
+/* Whether a trace may reach into the view, from its root alone */
+static bool trace_in_view(const struct anim_context *actx,
+	const struct trace *trace, const struct anim_view *view)
+{
+	int reach = actx->cf.trace_len + actx->cf.line_width + 1;
+	return trace->x + reach > view->x &&
+		trace->x - reach < view->x + view->width &&
+		trace->y + reach > view->y &&
+		trace->y - reach < view->y + view->height;
+}
 
+static void draw_culled(cairo_t *cr, struct anim_context *actx,
+	const struct anim_view *view)
+{
+	/* Collect the visible traces, oldest first */
+	struct anim_geometry *g = &actx->geometry;
 	int mp = actx->nxt_pos - actx->cf.total_traces;
 	if (mp < 0) mp = 0;
+	int decay = actx->decay_levels < actx->cf.decay_limit ?
+		actx->decay_levels : actx->cf.decay_limit;
+	g->count = 0;
 	for (int ii = mp; ii < actx->nxt_pos; ii++)
 	{
-		double alpha = 1;
-		if (ii - mp < actx->cf.decay_limit)
-			alpha = 1.0 / (1 << (actx->cf.decay_limit - (ii - mp)));
-
-		cairo_set_source_rgba(cr, 0.8477, 0.7031, 0.1289, alpha);
-//		cairo_set_source_rgba(cr, 0, 0, 0, alpha);
-		int i = ii % actx->cf.total_traces;
-
-		/*
-		printf("%d at %d,%d (%.1lf) ... ",
-		    i, actx->traces[i].x, actx->traces[i].y,
-		    actx->traces[i].angle * 180 / 3.14);
-		    */
-
-		cairo_save(cr);
-		cairo_translate(cr, actx->traces[i].x, actx->traces[i].y);
-		cairo_rotate(cr, actx->traces[i].angle);
-		cairo_move_to(cr, 0, 0);
-		int tl = acfg->trace_len;
-		cairo_line_to(cr, tl, 0);
-		cairo_move_to(cr, (tl * 3) / 5, 0);
-		cairo_line_to(cr, (tl * 23) / 25, (tl * 6) / 25);
-		cairo_move_to(cr, (tl * 3) / 5, 0);
-		cairo_line_to(cr, (tl * 23) / 25, -(tl * 6) / 25);
+		const struct trace *trace =
+			&actx->traces[ii % actx->cf.total_traces];
+		if (view && !trace_in_view(actx, trace, view))
+			continue;
+
+		int i = g->count++;
+		g->alpha[i] = 1;
+		if (ii - mp < decay)
+			g->alpha[i] = 1.0 / (1 << (decay - (ii - mp)));
+		g->angle[i] = trace->angle;
+		g->x[i] = trace->x;
+		g->y[i] = trace->y;
+	}
+	compute_geometry(g, actx->cf.trace_len, actx->glyph);
+
+	/* Draw the traces: the oldest ones fade out, each with its own
+	 * opacity, all others are opaque and go into a single path */
+	cairo_set_line_width(cr, actx->cf.line_width);
+	int i = 0;
+	for (; i < g->count && g->alpha[i] < 1; i++)
+	{
+		anim_set_trace_source(cr, g->alpha[i]);
+		add_trace_path(cr, actx, g, i);
 		cairo_stroke(cr);
-		cairo_restore(cr);
 	}
+	if (i < g->count)
+	{
+		anim_set_trace_source(cr, 1);
+		for (; i < g->count; i++)
+			add_trace_path(cr, actx, g, i);
+		cairo_stroke(cr);
+	}
+}
+
+void anim_draw(cairo_t *cr, struct anim_context *actx, int width, int height)
+{
+	draw_culled(cr, actx, NULL);
+}
+
+void anim_draw_view(cairo_t *cr, struct anim_context *actx,
+	const struct anim_view *view)
+{
+	cairo_save(cr);
+	cairo_scale(cr, (double)view->buffer_width / view->width,
+		(double)view->buffer_height / view->height);
+	cairo_translate(cr, -view->x, -view->y);
+	draw_culled(cr, actx, view);
+	cairo_restore(cr);
+}
+
+struct damage_rect anim_trace_bounds(const struct anim_context *actx,
+	const struct trace *trace)
+{
+	/* Root, tip and toe ends of the footprint, see anim_draw_trace() */
+	int tl = actx->cf.trace_len;
+	float pts[4][2] = {
+		{ 0, 0 },
+		{ tl, 0 },
+		{ (tl * 23) / 25, (tl * 6) / 25 },
+		{ (tl * 23) / 25, -(tl * 6) / 25 },
+	};
+	if (actx->glyph)
+	{
+		/* Corners of the bounding box of a custom one instead */
+		const struct glyph *glyph = actx->glyph;
+		for (int i = 0; i < 4; i++)
+		{
+			pts[i][0] = (i & 1 ? glyph->x1 : glyph->x0) * tl;
+			pts[i][1] = (i & 2 ? glyph->y1 : glyph->y0) * tl;
+		}
+	}
+	float c = cosf(trace->angle), s = sinf(trace->angle);
+	float x0 = 0, x1 = 0, y0 = 0, y1 = 0;
+	for (size_t i = 0; i < sizeof(pts) / sizeof(pts[0]); i++)
+	{
+		float x = pts[i][0] * c - pts[i][1] * s;
+		float y = pts[i][0] * s + pts[i][1] * c;
+		x0 = fminf(x0, x);
+		x1 = fmaxf(x1, x);
+		y0 = fminf(y0, y);
+		y1 = fmaxf(y1, y);
+	}
+
+	/* Half the line width plus a pixel of antialiasing */
+	int pad = (actx->cf.line_width + 1) / 2 + 1;
+	int left = trace->x + (int)floorf(x0) - pad;
+	int top = trace->y + (int)floorf(y0) - pad;
+	return (struct damage_rect) {
+		.x = left,
+		.y = top,
+		.width = trace->x + (int)ceilf(x1) + pad - left,
+		.height = trace->y + (int)ceilf(y1) + pad - top,
+	};
+}
+
+void anim_damage(const struct anim_context *actx, struct damage *damage,
+	int width, int height)
+{
+	int mp = actx->nxt_pos - actx->cf.total_traces;
+	if (mp < 0) mp = 0;
+	for (int ii = mp; ii < actx->nxt_pos; ii++)
+	{
+		const struct trace *trace = &actx->traces[ii % actx->cf.total_traces];
+		damage_add_rect(damage, anim_trace_bounds(actx, trace), width, height);
+	}
+}
+
+void anim_damage_view(const struct anim_context *actx,
+	const struct anim_view *view, struct damage *damage)
+{
+	double sx = (double)view->buffer_width / view->width;
+	double sy = (double)view->buffer_height / view->height;
+	int mp = actx->nxt_pos - actx->cf.total_traces;
+	if (mp < 0) mp = 0;
+	for (int ii = mp; ii < actx->nxt_pos; ii++)
+	{
+		const struct trace *trace = &actx->traces[ii % actx->cf.total_traces];
+		if (!trace_in_view(actx, trace, view))
+			continue;
+
+		struct damage_rect b = anim_trace_bounds(actx, trace);
+		int x0 = floor((b.x - view->x) * sx);
+		int y0 = floor((b.y - view->y) * sy);
+		int x1 = ceil((b.x + b.width - view->x) * sx);
+		int y1 = ceil((b.y + b.height - view->y) * sy);
+		damage_add_rect(damage,
+			(struct damage_rect) { x0, y0, x1 - x0, y1 - y0 },
+			view->buffer_width, view->buffer_height);
+	}
+}
+
+struct anim_context *render_anim(cairo_t *cr, struct anim_context *actx, int width, int height)
+{
+//	printf("Render ... ");
+	if (!actx)
+	{
+		actx = anim_create(&anim_default_config, width, height);
+		if (!actx)
+			return NULL;
+	}
+
+	actx = anim_step(actx, width, height);
+	if (!actx)
+		return NULL;
+
+	anim_draw(cr, actx, width, height);
 
 //	printf("\n");
 	return actx;
@@ -0,0 +1,146 @@
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+#include "background-image.h"
+#include "cairo_util.h"
+#include "log.h"
+#include "pixbuf.h"
+
+enum background_mode parse_background_mode(const char *mode) {
+	if (strcmp(mode, "stretch") == 0) {
+		return BACKGROUND_MODE_STRETCH;
+	} else if (strcmp(mode, "fill") == 0) {
+		return BACKGROUND_MODE_FILL;
+	} else if (strcmp(mode, "fit") == 0) {
+		return BACKGROUND_MODE_FIT;
+	} else if (strcmp(mode, "center") == 0) {
+		return BACKGROUND_MODE_CENTER;
+	} else if (strcmp(mode, "tile") == 0) {
+		return BACKGROUND_MODE_TILE;
+	} else if (strcmp(mode, "solid_color") == 0) {
+		return BACKGROUND_MODE_SOLID_COLOR;
+	}
+	swaybg_log(LOG_ERROR, "Unsupported background mode: %s", mode);
+	return BACKGROUND_MODE_INVALID;
+}
+
+cairo_surface_t *load_background_image(const char *path) {
+	cairo_surface_t *image;
+#if HAVE_GDK_PIXBUF
+	const struct pixbuf_funcs *pixbuf = pixbuf_get();
+	bool png_only = !pixbuf;
+#else
+	bool png_only = true;
+#endif // HAVE_GDK_PIXBUF
+	if (png_only) {
+		image = cairo_image_surface_create_from_png(path);
+	}
+#if HAVE_GDK_PIXBUF
+	else {
+		GError *err = NULL;
+		GdkPixbuf *loaded = pixbuf->new_from_file(path, &err);
+		if (!loaded) {
+			swaybg_log(LOG_ERROR, "Failed to load background image (%s).",
+					err->message);
+			pixbuf->error_free(err);
+			return NULL;
+		}
+		// Correct for embedded image orientation; typical images are not
+		// rotated and will be handled efficiently
+		GdkPixbuf *oriented = pixbuf->apply_embedded_orientation(loaded);
+		pixbuf->object_unref(loaded);
+		image = gdk_cairo_image_surface_create_from_pixbuf(oriented);
+		pixbuf->object_unref(oriented);
+	}
+#endif // HAVE_GDK_PIXBUF
+	if (!image) {
+		swaybg_log(LOG_ERROR, "Failed to read background image.");
+		return NULL;
+	}
+	if (cairo_surface_status(image) != CAIRO_STATUS_SUCCESS) {
+		swaybg_log(LOG_ERROR, "Failed to read background image: %s.%s",
+				cairo_status_to_string(cairo_surface_status(image)),
+				png_only ? "\nSway was compiled without gdk_pixbuf support, "
+				"or could not load it, so only\nPNG images can be loaded. "
+				"This is the likely cause." : "");
+		cairo_surface_destroy(image);
+		return NULL;
+	}
+	return image;
+}
+
+// Paint the image scaled by scale_x, scale_y with its top left corner at
+// x, y. The resampler is much faster and better looking than letting cairo
+// filter a scaled pattern, which remains as a fallback.
+static void paint_scaled(cairo_t *cairo, cairo_surface_t *image,
+		double scale_x, double scale_y, double x, double y) {
+	int width = lround(cairo_image_surface_get_width(image) * scale_x);
+	int height = lround(cairo_image_surface_get_height(image) * scale_y);
+	cairo_surface_t *scaled = cairo_image_surface_scale(image, width, height);
+	if (scaled) {
+		cairo_set_source_surface(cairo, scaled, lround(x), lround(y));
+		cairo_paint(cairo);
+		cairo_surface_destroy(scaled);
+		return;
+	}
+	cairo_save(cairo);
+	cairo_translate(cairo, x, y);
+	cairo_scale(cairo, scale_x, scale_y);
+	cairo_set_source_surface(cairo, image, 0, 0);
+	cairo_paint(cairo);
+	cairo_restore(cairo);
+}
+
+void render_background_image(cairo_t *cairo, cairo_surface_t *image,
+		enum background_mode mode, int buffer_width, int buffer_height) {
+	double width = cairo_image_surface_get_width(image);
+	double height = cairo_image_surface_get_height(image);
+	double window_ratio = (double)buffer_width / buffer_height;
+	double bg_ratio = width / height;
+	double scale;
+
+	cairo_save(cairo);
+	switch (mode) {
+	case BACKGROUND_MODE_STRETCH:
+		paint_scaled(cairo, image,
+				(double)buffer_width / width,
+				(double)buffer_height / height, 0, 0);
+		break;
+	case BACKGROUND_MODE_FILL:
+		scale = window_ratio > bg_ratio
+			? (double)buffer_width / width
+			: (double)buffer_height / height;
+		paint_scaled(cairo, image, scale, scale,
+				(double)buffer_width / 2 - width * scale / 2,
+				(double)buffer_height / 2 - height * scale / 2);
+		break;
+	case BACKGROUND_MODE_FIT:
+		scale = window_ratio > bg_ratio
+			? (double)buffer_height / height
+			: (double)buffer_width / width;
+		paint_scaled(cairo, image, scale, scale,
+				(double)buffer_width / 2 - width * scale / 2,
+				(double)buffer_height / 2 - height * scale / 2);
+		break;
+	case BACKGROUND_MODE_CENTER:
+		cairo_set_source_surface(cairo, image,
+				(double)buffer_width / 2 - width / 2,
+				(double)buffer_height / 2 - height / 2);
+		cairo_paint(cairo);
+		break;
+	case BACKGROUND_MODE_TILE: {
+		cairo_pattern_t *pattern = cairo_pattern_create_for_surface(image);
+		cairo_pattern_set_extend(pattern, CAIRO_EXTEND_REPEAT);
+		cairo_set_source(cairo, pattern);
+		cairo_paint(cairo);
+		cairo_pattern_destroy(pattern);
+		break;
+	}
+	case BACKGROUND_MODE_SOLID_COLOR:
+	case BACKGROUND_MODE_INVALID:
+		assert(0);
+		break;
+	}
+	cairo_restore(cairo);
+}
@@ -0,0 +1,701 @@
+/*
+ * Microbenchmarks for the animation kernels.
+ *
+ * Every kernel runs under a fixed seed and the results are printed as
+ * tab-separated values, one kernel per line. Save the output to a file and
+ * pass it back with --baseline to compare a later run against it.
+ */
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "anim.h"
+#include "cairo_util.h"
+#include "flock.h"
+#include "glyph.h"
+#include "pixconv.h"
+#include "trail.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define SAMPLES 15
+#define WIDTH 1920
+#define HEIGHT 1080
+#define TABLE_SIZE 1024
+
+static volatile int sink;
+static volatile float fsink;
+
+static inline uint64_t read_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	_mm_lfence();
+	uint64_t c = __rdtsc();
+	_mm_lfence();
+	return c;
+#elif defined(__aarch64__)
+	uint64_t c;
+	__asm__ volatile("isb; mrs %0, cntvct_el0" : "=r"(c));
+	return c;
+#else
+	return 0;
+#endif
+}
+
+static inline uint64_t read_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+struct bench_kernel {
+	const char *name;
+	uint64_t iterations; // per sample
+	void *(*setup)(void);
+	void (*run)(void *data, uint64_t iterations);
+	void (*teardown)(void *data);
+};
+
+struct bench_result {
+	const char *name;
+	uint64_t iterations;
+	double cycles_per_op;
+	double ns_per_op;
+	double ns_per_op_median;
+};
+
+/* randrange */
+
+static void run_randrange(void *data, uint64_t iterations) {
+	int acc = 0;
+	for (uint64_t i = 0; i < iterations; i++) {
+		acc += anim_randrange(-20, 21);
+	}
+	sink = acc;
+}
+
+/* check_velocity and trace angle over a table of candidate velocities */
+
+struct velocity_table {
+	struct anim_context *actx;
+	int dx[TABLE_SIZE], dy[TABLE_SIZE];
+};
+
+static void *setup_velocity_table(void) {
+	struct velocity_table *vt = calloc(1, sizeof(*vt));
+	vt->actx = anim_create(&anim_default_config, WIDTH, HEIGHT);
+	int max = anim_default_config.max_velocity + 10;
+	for (int i = 0; i < TABLE_SIZE; i++) {
+		vt->dx[i] = anim_randrange(-max, max + 1);
+		vt->dy[i] = anim_randrange(-max, max + 1);
+	}
+	return vt;
+}
+
+static void teardown_velocity_table(void *data) {
+	struct velocity_table *vt = data;
+	anim_done(vt->actx);
+	free(vt);
+}
+
+static void run_check_velocity(void *data, uint64_t iterations) {
+	struct velocity_table *vt = data;
+	int acc = 0;
+	for (uint64_t i = 0; i < iterations; i++) {
+		int j = i % TABLE_SIZE;
+		acc += anim_check_velocity(vt->actx, vt->dx[j], vt->dy[j],
+			WIDTH, HEIGHT);
+	}
+	sink = acc;
+}
+
+static void run_trace_angle(void *data, uint64_t iterations) {
+	struct velocity_table *vt = data;
+	float acc = 0;
+	for (uint64_t i = 0; i < iterations; i++) {
+		int j = i % TABLE_SIZE;
+		acc += anim_trace_angle(vt->dx[j], vt->dy[j], 0.35f);
+	}
+	fsink = acc;
+}
+
+/* One simulation step, including rejected velocity candidates */
+
+static void *setup_step(void) {
+	struct anim_context **actx = malloc(sizeof(*actx));
+	*actx = anim_create(&anim_default_config, WIDTH, HEIGHT);
+	return actx;
+}
+
+static void teardown_step(void *data) {
+	struct anim_context **actx = data;
+	anim_done(*actx);
+	free(actx);
+}
+
+static void run_step(void *data, uint64_t iterations) {
+	struct anim_context **actx = data;
+	for (uint64_t i = 0; i < iterations; i++) {
+		*actx = anim_step(*actx, WIDTH, HEIGHT);
+	}
+	sink = (*actx)->cur_x;
+}
+
+/* Stepping a flock of interacting birds, which should scale linearly */
+
+static void *setup_flock(int count) {
+	return flock_create(&anim_default_config, count, WIDTH, HEIGHT);
+}
+
+static void *setup_flock_100(void) {
+	return setup_flock(100);
+}
+
+static void *setup_flock_1k(void) {
+	return setup_flock(1000);
+}
+
+static void *setup_flock_10k(void) {
+	return setup_flock(10000);
+}
+
+static void teardown_flock(void *data) {
+	flock_destroy(data);
+}
+
+static void run_flock_step(void *data, uint64_t iterations) {
+	struct flock *flock = data;
+	for (uint64_t i = 0; i < iterations; i++) {
+		flock_step(flock, NULL, WIDTH, HEIGHT);
+	}
+	sink = flock->birds[0] ? flock->birds[0]->cur_x : 0;
+}
+
+/* Drawing a single trace */
+
+struct draw_ctx {
+	cairo_surface_t *surface;
+	cairo_t *cairo;
+	struct anim_context *actx;
+	struct trace traces[TABLE_SIZE];
+};
+
+static void *setup_draw_trace(void) {
+	struct draw_ctx *dc = calloc(1, sizeof(*dc));
+	dc->surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, WIDTH, HEIGHT);
+	dc->cairo = cairo_create(dc->surface);
+	dc->actx = anim_create(&anim_default_config, WIDTH, HEIGHT);
+	cairo_set_line_width(dc->cairo, dc->actx->cf.line_width);
+	for (int i = 0; i < TABLE_SIZE; i++) {
+		dc->traces[i] = (struct trace) {
+			.x = anim_randrange(0, WIDTH),
+			.y = anim_randrange(0, HEIGHT),
+			.angle = anim_randrange(0, 628) / 100.0f,
+		};
+	}
+	return dc;
+}
+
+static void teardown_draw_trace(void *data) {
+	struct draw_ctx *dc = data;
+	anim_done(dc->actx);
+	cairo_destroy(dc->cairo);
+	cairo_surface_destroy(dc->surface);
+	free(dc);
+}
+
+static void run_draw_trace(void *data, uint64_t iterations) {
+	struct draw_ctx *dc = data;
+	for (uint64_t i = 0; i < iterations; i++) {
+		anim_draw_trace(dc->cairo, dc->actx,
+			&dc->traces[i % TABLE_SIZE], 0.5);
+	}
+	cairo_surface_flush(dc->surface);
+}
+
+/* Drawing a full history of traces, geometry and batched strokes */
+
+static void *setup_draw_all(void) {
+	struct draw_ctx *dc = setup_draw_trace();
+	for (int i = 0; i < dc->actx->cf.total_traces; i++) {
+		dc->actx = anim_step(dc->actx, WIDTH, HEIGHT);
+	}
+	return dc;
+}
+
+static void run_draw_all(void *data, uint64_t iterations) {
+	struct draw_ctx *dc = data;
+	for (uint64_t i = 0; i < iterations; i++) {
+		anim_draw(dc->cairo, dc->actx, WIDTH, HEIGHT);
+	}
+	cairo_surface_flush(dc->surface);
+}
+
+/* Same with a custom footprint, only its cached vertices are transformed */
+
+static void *setup_draw_glyph(void) {
+	struct draw_ctx *dc = setup_draw_all();
+	dc->actx->glyph = glyph_parse(
+		"M0 0 L10 0 M6 0 Q8 3 9 6 M6 0 Q8 -3 9 -6 M-2 0 C-3 1 -3 2 -2 3",
+		"bench");
+	return dc;
+}
+
+static void teardown_draw_glyph(void *data) {
+	struct draw_ctx *dc = data;
+	glyph_destroy((struct glyph *)dc->actx->glyph);
+	teardown_draw_trace(dc);
+}
+
+/* Pixel row conversion, reference and dispatched implementations */
+
+struct convert_ctx {
+	const struct pixconv_funcs *funcs;
+	uint8_t src[WIDTH * 4];
+	uint32_t dst[WIDTH];
+};
+
+static void *setup_convert(const struct pixconv_funcs *funcs) {
+	struct convert_ctx *cc = calloc(1, sizeof(*cc));
+	cc->funcs = funcs;
+	for (size_t i = 0; i < sizeof(cc->src); i++) {
+		cc->src[i] = anim_randrange(0, 256);
+	}
+	return cc;
+}
+
+static void *setup_convert_scalar(void) {
+	return setup_convert(pixconv_get_scalar());
+}
+
+static void *setup_convert_simd(void) {
+	return setup_convert(pixconv_get());
+}
+
+static void run_convert_rgb(void *data, uint64_t iterations) {
+	struct convert_ctx *cc = data;
+	for (uint64_t i = 0; i < iterations; i++) {
+		cc->funcs->rgb_to_xrgb(cc->dst, cc->src, WIDTH);
+	}
+	sink = cc->dst[WIDTH - 1];
+}
+
+static void run_convert_rgba(void *data, uint64_t iterations) {
+	struct convert_ctx *cc = data;
+	for (uint64_t i = 0; i < iterations; i++) {
+		cc->funcs->rgba_premul(cc->dst, cc->src, WIDTH);
+	}
+	sink = cc->dst[WIDTH - 1];
+}
+
+// The SIMD kernels must match the reference bit for bit, tails included
+static bool verify_pixconv(void) {
+	const struct pixconv_funcs *ref = pixconv_get_scalar(), *simd = pixconv_get();
+	uint8_t src[256 * 4];
+	uint32_t a[256], b[256];
+	for (size_t i = 0; i < sizeof(src); i++) {
+		src[i] = anim_randrange(0, 256);
+	}
+	for (int width = 0; width <= 256; width++) {
+		ref->rgb_to_xrgb(a, src, width);
+		simd->rgb_to_xrgb(b, src, width);
+		if (memcmp(a, b, width * sizeof(uint32_t)) != 0) {
+			return false;
+		}
+		ref->rgba_premul(a, src, width);
+		simd->rgba_premul(b, src, width);
+		if (memcmp(a, b, width * sizeof(uint32_t)) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Fading a whole trail mask, and a full trail step */
+
+struct fade_ctx {
+	const struct trail_fade_funcs *funcs;
+	uint8_t mask[WIDTH * HEIGHT];
+};
+
+static void *setup_fade(const struct trail_fade_funcs *funcs) {
+	struct fade_ctx *fc = calloc(1, sizeof(*fc));
+	fc->funcs = funcs;
+	for (size_t i = 0; i < sizeof(fc->mask); i++) {
+		fc->mask[i] = anim_randrange(0, 256);
+	}
+	return fc;
+}
+
+static void *setup_fade_scalar(void) {
+	return setup_fade(trail_fade_get_scalar());
+}
+
+static void *setup_fade_simd(void) {
+	return setup_fade(trail_fade_get());
+}
+
+static void run_fade(void *data, uint64_t iterations) {
+	struct fade_ctx *fc = data;
+	for (uint64_t i = 0; i < iterations; i++) {
+		// A factor of 255 keeps most of the mask nonzero between runs
+		fc->funcs->fade(fc->mask, sizeof(fc->mask), 255);
+	}
+	sink = fc->mask[0];
+}
+
+static bool verify_trail_fade(void) {
+	const struct trail_fade_funcs *ref = trail_fade_get_scalar();
+	const struct trail_fade_funcs *simd = trail_fade_get();
+	uint8_t a[256], b[256];
+	for (int factor = 0; factor < 256; factor++) {
+		for (int n = 0; n <= 256; n++) {
+			for (int i = 0; i < 256; i++) {
+				a[i] = b[i] = anim_randrange(0, 256);
+			}
+			ref->fade(a, n, factor);
+			simd->fade(b, n, factor);
+			if (memcmp(a, b, sizeof(a)) != 0) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+struct trail_ctx {
+	struct anim_context *actx;
+	struct trail *trail;
+	struct damage damage;
+};
+
+static void *setup_trail(void) {
+	struct trail_ctx *tc = calloc(1, sizeof(*tc));
+	tc->actx = anim_create(&anim_default_config, WIDTH, HEIGHT);
+	tc->trail = trail_create(WIDTH, HEIGHT, 1, 4096);
+	return tc;
+}
+
+static void teardown_trail(void *data) {
+	struct trail_ctx *tc = data;
+	trail_destroy(tc->trail);
+	anim_done(tc->actx);
+	free(tc);
+}
+
+static void run_trail_step(void *data, uint64_t iterations) {
+	struct trail_ctx *tc = data;
+	for (uint64_t i = 0; i < iterations; i++) {
+		tc->actx = anim_step(tc->actx, WIDTH, HEIGHT);
+		damage_clear(&tc->damage);
+		trail_step(tc->trail, tc->actx, &tc->damage);
+	}
+	sink = tc->damage.n_rects;
+}
+
+/* Downscaling a background, resampler against cairo's GOOD filter */
+
+struct scale_ctx {
+	cairo_surface_t *image;
+	int width, height;
+};
+
+static void *setup_scale(int src_width, int src_height,
+		int width, int height) {
+	struct scale_ctx *sc = calloc(1, sizeof(*sc));
+	sc->image = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+		src_width, src_height);
+	uint32_t *pixels = (uint32_t *)cairo_image_surface_get_data(sc->image);
+	uint32_t x = anim_randrange(1, RAND_MAX);
+	for (size_t i = 0; i < (size_t)src_width * src_height; i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		pixels[i] = x;
+	}
+	cairo_surface_mark_dirty(sc->image);
+	sc->width = width;
+	sc->height = height;
+	return sc;
+}
+
+static void *setup_scale_8k(void) {
+	return setup_scale(7680, 4320, WIDTH, HEIGHT);
+}
+
+static void *setup_scale_4k(void) {
+	return setup_scale(3840, 2160, 2560, 1440);
+}
+
+static void teardown_scale(void *data) {
+	struct scale_ctx *sc = data;
+	cairo_surface_destroy(sc->image);
+	free(sc);
+}
+
+static void run_scale_resampler(void *data, uint64_t iterations) {
+	struct scale_ctx *sc = data;
+	for (uint64_t i = 0; i < iterations; i++) {
+		cairo_surface_destroy(cairo_image_surface_scale(sc->image,
+			sc->width, sc->height));
+	}
+}
+
+static void run_scale_cairo_good(void *data, uint64_t iterations) {
+	struct scale_ctx *sc = data;
+	for (uint64_t i = 0; i < iterations; i++) {
+		cairo_surface_t *scaled = cairo_image_surface_create(
+			CAIRO_FORMAT_RGB24, sc->width, sc->height);
+		cairo_t *cairo = cairo_create(scaled);
+		cairo_scale(cairo,
+			(double)sc->width / cairo_image_surface_get_width(sc->image),
+			(double)sc->height / cairo_image_surface_get_height(sc->image));
+		cairo_set_source_surface(cairo, sc->image, 0, 0);
+		cairo_pattern_set_filter(cairo_get_source(cairo), CAIRO_FILTER_GOOD);
+		cairo_paint(cairo);
+		cairo_destroy(cairo);
+		cairo_surface_flush(scaled);
+		cairo_surface_destroy(scaled);
+	}
+}
+
+#if HAVE_GDK_PIXBUF
+/* gdk-pixbuf to cairo conversion of a full output-sized image */
+
+static GdkPixbuf *create_random_pixbuf(bool alpha) {
+	GdkPixbuf *pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, alpha, 8,
+		WIDTH, HEIGHT);
+	guint8 *pixels = gdk_pixbuf_get_pixels(pixbuf);
+	size_t size = (size_t)gdk_pixbuf_get_rowstride(pixbuf) * HEIGHT;
+	uint32_t x = anim_randrange(1, RAND_MAX);
+	for (size_t i = 0; i < size; i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		pixels[i] = x;
+	}
+	return pixbuf;
+}
+
+static void *setup_pixbuf_rgb(void) {
+	return create_random_pixbuf(false);
+}
+
+static void *setup_pixbuf_rgba(void) {
+	return create_random_pixbuf(true);
+}
+
+static void teardown_pixbuf(void *data) {
+	g_object_unref(data);
+}
+
+static void run_pixbuf_convert(void *data, uint64_t iterations) {
+	for (uint64_t i = 0; i < iterations; i++) {
+		cairo_surface_t *cs = gdk_cairo_image_surface_create_from_pixbuf(data);
+		cairo_surface_destroy(cs);
+	}
+}
+#endif // HAVE_GDK_PIXBUF
+
+static const struct bench_kernel kernels[] = {
+	{ "randrange", 1000000, NULL, run_randrange, NULL },
+	{ "check_velocity", 1000000, setup_velocity_table, run_check_velocity,
+		teardown_velocity_table },
+	{ "trace_angle", 1000000, setup_velocity_table, run_trace_angle,
+		teardown_velocity_table },
+	{ "step", 100000, setup_step, run_step, teardown_step },
+	{ "flock_step_100", 100, setup_flock_100, run_flock_step, teardown_flock },
+	{ "flock_step_1k", 10, setup_flock_1k, run_flock_step, teardown_flock },
+	{ "flock_step_10k", 1, setup_flock_10k, run_flock_step, teardown_flock },
+	{ "draw_trace", 10000, setup_draw_trace, run_draw_trace,
+		teardown_draw_trace },
+	{ "draw_all", 100, setup_draw_all, run_draw_all, teardown_draw_trace },
+	{ "draw_all_glyph", 100, setup_draw_glyph, run_draw_all,
+		teardown_draw_glyph },
+	{ "convert_rgb_scalar", 1000, setup_convert_scalar, run_convert_rgb, free },
+	{ "convert_rgb_simd", 1000, setup_convert_simd, run_convert_rgb, free },
+	{ "convert_rgba_scalar", 1000, setup_convert_scalar, run_convert_rgba, free },
+	{ "convert_rgba_simd", 1000, setup_convert_simd, run_convert_rgba, free },
+	{ "trail_fade_scalar", 10, setup_fade_scalar, run_fade, free },
+	{ "trail_fade_simd", 10, setup_fade_simd, run_fade, free },
+	{ "trail_step", 1000, setup_trail, run_trail_step, teardown_trail },
+	{ "scale_8k_1080p_resampler", 1, setup_scale_8k, run_scale_resampler,
+		teardown_scale },
+	{ "scale_8k_1080p_cairo_good", 1, setup_scale_8k, run_scale_cairo_good,
+		teardown_scale },
+	{ "scale_4k_1440p_resampler", 1, setup_scale_4k, run_scale_resampler,
+		teardown_scale },
+	{ "scale_4k_1440p_cairo_good", 1, setup_scale_4k, run_scale_cairo_good,
+		teardown_scale },
+#if HAVE_GDK_PIXBUF
+	{ "pixbuf_rgb", 5, setup_pixbuf_rgb, run_pixbuf_convert, teardown_pixbuf },
+	{ "pixbuf_rgba", 5, setup_pixbuf_rgba, run_pixbuf_convert, teardown_pixbuf },
+#endif
+};
+
+static int compare_double(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+static void run_kernel(const struct bench_kernel *kernel, unsigned int seed,
+		struct bench_result *result) {
+	anim_seed(seed);
+	void *data = kernel->setup ? kernel->setup() : NULL;
+
+	// Warm up caches and the branch predictor
+	kernel->run(data, kernel->iterations);
+
+	double cycles[SAMPLES], ns[SAMPLES];
+	for (int i = 0; i < SAMPLES; i++) {
+		uint64_t c0 = read_cycles();
+		uint64_t t0 = read_ns();
+		kernel->run(data, kernel->iterations);
+		uint64_t t1 = read_ns();
+		uint64_t c1 = read_cycles();
+		cycles[i] = (double)(c1 - c0) / kernel->iterations;
+		ns[i] = (double)(t1 - t0) / kernel->iterations;
+	}
+
+	if (kernel->teardown) {
+		kernel->teardown(data);
+	}
+
+	qsort(cycles, SAMPLES, sizeof(double), compare_double);
+	qsort(ns, SAMPLES, sizeof(double), compare_double);
+	*result = (struct bench_result) {
+		.name = kernel->name,
+		.iterations = kernel->iterations,
+		.cycles_per_op = cycles[0],
+		.ns_per_op = ns[0],
+		.ns_per_op_median = ns[SAMPLES / 2],
+	};
+}
+
+// Look up a kernel in a file written by a previous run
+static bool find_baseline(FILE *f, const char *name, double *ns_per_op) {
+	char line[256];
+	rewind(f);
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#') {
+			continue;
+		}
+		char kernel[64];
+		unsigned long long iterations;
+		double cycles, ns;
+		if (sscanf(line, "%63s %llu %lf %lf", kernel, &iterations,
+				&cycles, &ns) == 4 && strcmp(kernel, name) == 0) {
+			*ns_per_op = ns;
+			return true;
+		}
+	}
+	return false;
+}
+
+int main(int argc, char **argv) {
+	static struct option long_options[] = {
+		{"baseline", required_argument, NULL, 'b'},
+		{"filter", required_argument, NULL, 'f'},
+		{"help", no_argument, NULL, 'h'},
+		{"seed", required_argument, NULL, 's'},
+		{"threshold", required_argument, NULL, 't'},
+		{0, 0, 0, 0}
+	};
+
+	const char *usage =
+		"Usage: swaybg-bench-kernels <options...>\n"
+		"\n"
+		"  -b, --baseline <file>  Compare against the output of a previous run.\n"
+		"  -f, --filter <name>    Only run kernels whose name contains <name>.\n"
+		"  -h, --help             Show help message and quit.\n"
+		"  -s, --seed <n>         Seed the random generator with <n>.\n"
+		"  -t, --threshold <pct>  Regression threshold for --baseline (10).\n"
+		"\n";
+
+	const char *baseline_path = NULL, *filter = NULL;
+	unsigned int seed = 0x5eed;
+	double threshold = 10;
+
+	int c;
+	while ((c = getopt_long(argc, argv, "b:f:hs:t:", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'b':
+			baseline_path = optarg;
+			break;
+		case 'f':
+			filter = optarg;
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			threshold = strtod(optarg, NULL);
+			break;
+		default:
+			fprintf(c == 'h' ? stdout : stderr, "%s", usage);
+			return c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	anim_seed(seed);
+	if (!verify_pixconv()) {
+		fprintf(stderr, "%s pixel conversion does not match the reference\n",
+			pixconv_get()->name);
+		return EXIT_FAILURE;
+	}
+	if (!verify_trail_fade()) {
+		fprintf(stderr, "%s trail fade does not match the reference\n",
+			trail_fade_get()->name);
+		return EXIT_FAILURE;
+	}
+
+	FILE *baseline = NULL;
+	if (baseline_path) {
+		baseline = fopen(baseline_path, "r");
+		if (!baseline) {
+			perror(baseline_path);
+			return EXIT_FAILURE;
+		}
+		printf("# kernel\tbaseline_ns_per_op\tns_per_op\tdelta_pct\tstatus\n");
+	} else {
+		printf("# seed %u, %d samples, minimum per op, %s pixel conversion\n",
+			seed, SAMPLES, pixconv_get()->name);
+		printf("# kernel\titerations\tcycles_per_op\tns_per_op\tns_per_op_median\n");
+	}
+
+	int regressions = 0;
+	for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+		if (filter && !strstr(kernels[i].name, filter)) {
+			continue;
+		}
+		struct bench_result r;
+		run_kernel(&kernels[i], seed, &r);
+
+		if (!baseline) {
+			printf("%s\t%llu\t%.2f\t%.2f\t%.2f\n", r.name,
+				(unsigned long long)r.iterations, r.cycles_per_op,
+				r.ns_per_op, r.ns_per_op_median);
+			continue;
+		}
+
+		double base;
+		if (!find_baseline(baseline, r.name, &base) || base <= 0) {
+			printf("%s\t-\t%.2f\t-\tnew\n", r.name, r.ns_per_op);
+			continue;
+		}
+		double delta = (r.ns_per_op - base) * 100 / base;
+		bool regressed = delta > threshold;
+		regressions += regressed;
+		printf("%s\t%.2f\t%.2f\t%+.1f\t%s\n", r.name, base, r.ns_per_op,
+			delta, regressed ? "regressed" : "ok");
+	}
+
+	if (baseline) {
+		fclose(baseline);
+	}
+	return regressions ? EXIT_FAILURE : EXIT_SUCCESS;
+}
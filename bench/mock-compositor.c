@@ -0,0 +1,1539 @@
+/*
+ * Minimal stand-in for a Wayland compositor, to measure the protocol side of
+ * swaybg without a real one.
+ *
+ * swaybg is started with one end of a socketpair as WAYLAND_SOCKET, and the
+ * other end is served by libwayland-server as a client. Only the globals
+ * swaybg needs are advertised: layer surfaces get configured on their first
+ * commit, frame callbacks complete right away and the buffer shown so far is
+ * released when a new one is committed. The animation rate is raised through
+ * the control socket, and once every output got the requested number of
+ * frames the connection is closed and the statistics are printed as
+ * tab-separated values, totals and per frame. Protocol errors make the run
+ * fail.
+ *
+ * With --check, the run also verifies a behaviour of swaybg through the
+ * control socket, and fails if it does not hold:
+ *
+ *   cover  a fullscreen toplevel on the first output stops its frames, which
+ *          resume with the missed steps caught up on once it leaves
+ *   frame  buffers are released as soon as they are committed, as by
+ *          compositors which copy them, and the buffer exported by ctl frame
+ *          is still unchanged when the next frame is committed. Frames are
+ *          not paced by the compositor, so this needs a rate slow enough for
+ *          the one after to not be drawn already.
+ *   hangup commands sent by clients which close the connection without
+ *          reading the reply leave swaybg running
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <wayland-server-core.h>
+#include <wayland-server-protocol.h>
+#include "fractional-scale-v1-server-protocol.h"
+#include "viewporter-server-protocol.h"
+#include "wlr-foreign-toplevel-management-unstable-v1-server-protocol.h"
+#include "wlr-layer-shell-unstable-v1-server-protocol.h"
+
+#define MAX_OUTPUTS 8
+#define MAX_FRAME_CALLBACKS 4
+#define MAX_INTERFACES 32
+#define MAX_REPLY 4096
+// Frames to wait for before checking anything, and for how long to cover
+#define CHECK_WARMUP_FRAMES 10
+#define CHECK_COVER_MS 1000
+#define CHECK_FRAME_ROUNDS 6
+#define CHECK_HANGUP_ROUNDS 10
+
+struct mock;
+
+struct mock_output {
+	struct mock *mock;
+	int32_t width, height;	// mode, in pixels
+	uint32_t scale120;	// preferred fractional scale
+	struct wl_global *global;
+	struct wl_list resources;	// wl_output resources
+};
+
+struct mock_pool {
+	struct mock *mock;
+	int32_t size;
+};
+
+struct mock_buffer {
+	struct mock *mock;
+	struct wl_resource *resource;
+	int32_t width, height;
+	bool busy;	// committed and not released since
+};
+
+struct mock_surface {
+	struct mock *mock;
+	struct wl_resource *resource;
+	// zwlr_layer_surface_v1 and the output it was created for
+	struct wl_resource *layer_surface;
+	struct mock_output *output;
+	bool attached;
+	struct mock_buffer *pending_buffer, *buffer;
+	bool configured;
+	int frames;
+	struct wl_list frame_callbacks;	// wl_callback resources
+	struct wl_list link;	// mock::surfaces
+};
+
+struct mock_stats {
+	uint64_t requests, request_bytes, events, event_bytes;
+	uint64_t pools, shm_bytes;
+	uint64_t buffers_created, buffers_destroyed, releases;
+	uint64_t commits, frames, configures, acks;
+	uint64_t damage_rects, damage_area;
+};
+
+struct mock_interface_stats {
+	const char *name;
+	uint64_t requests;
+};
+
+enum mock_check {
+	CHECK_NONE,
+	CHECK_COVER,
+	CHECK_FRAME,
+	CHECK_HANGUP,
+};
+
+enum mock_check_state {
+	CHECK_WAIT,
+	CHECK_COVERED,	// cover
+	CHECK_UNCOVERED,	// cover
+	CHECK_EXPORTED,	// frame
+	CHECK_HUNG_UP,	// hangup
+	CHECK_DONE,
+};
+
+struct mock {
+	struct wl_display *display;
+	struct wl_client *client;
+	struct wl_listener client_destroy;
+	struct wl_list surfaces;	// mock_surface::link
+	// zwlr_foreign_toplevel_manager_v1 and _handle_v1 resources
+	struct wl_list toplevel_managers, toplevels;
+
+	struct mock_output outputs[MAX_OUTPUTS];
+	int n_outputs;
+	uint32_t serial;	// of the last configure event
+	int reconfigure;	// frames between two configure events
+	int target_frames;
+	bool verbose;
+	bool failed;
+
+	enum mock_check check;
+	enum mock_check_state check_state;
+	const char *sock_path;
+	int rate;
+	uint64_t check_since;	// of the current check state
+	int check_frames;	// of the first output then
+	uint64_t check_steps;
+	int check_rounds;
+	// buffer exported by ctl frame, and its checksum then
+	const void *check_data;
+	size_t check_size;
+	uint64_t check_sum;
+
+	struct mock_stats stats, last_frame_stats;
+	struct mock_interface_stats interfaces[MAX_INTERFACES];
+	int n_interfaces;
+};
+
+static void fail(struct mock *mock, const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	fprintf(stderr, "mock-compositor: ");
+	vfprintf(stderr, fmt, args);
+	fprintf(stderr, "\n");
+	va_end(args);
+	mock->failed = true;
+}
+
+static uint64_t read_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Size of the message on the wire, file descriptors go alongside
+static size_t get_message_size(const struct wl_protocol_logger_message *msg) {
+	size_t size = 8;
+	int i = 0;
+	for (const char *c = msg->message->signature; *c; c++) {
+		if (*c == '?' || (*c >= '0' && *c <= '9')) {
+			continue;
+		}
+		const union wl_argument *arg = &msg->arguments[i++];
+		if (*c == 's') {
+			size += 4 + (arg->s ? (strlen(arg->s) + 1 + 3) & ~(size_t)3 : 0);
+		} else if (*c == 'a') {
+			size += 4 + (arg->a ? (arg->a->size + 3) & ~(size_t)3 : 0);
+		} else if (*c != 'h') {
+			size += 4;
+		}
+	}
+	return size;
+}
+
+static void count_interface_request(struct mock *mock, const char *name) {
+	for (int i = 0; i < mock->n_interfaces; i++) {
+		if (strcmp(mock->interfaces[i].name, name) == 0) {
+			mock->interfaces[i].requests++;
+			return;
+		}
+	}
+	if (mock->n_interfaces < MAX_INTERFACES) {
+		mock->interfaces[mock->n_interfaces++] =
+			(struct mock_interface_stats){ .name = name, .requests = 1 };
+	}
+}
+
+static void log_message(void *data, enum wl_protocol_logger_type type,
+		const struct wl_protocol_logger_message *msg) {
+	struct mock *mock = data;
+	size_t size = get_message_size(msg);
+	if (type == WL_PROTOCOL_LOGGER_EVENT) {
+		mock->stats.events++;
+		mock->stats.event_bytes += size;
+		return;
+	}
+	mock->stats.requests++;
+	mock->stats.request_bytes += size;
+	count_interface_request(mock, wl_resource_get_class(msg->resource));
+}
+
+static void destroy_resource(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static void unlink_resource(struct wl_resource *resource) {
+	wl_list_remove(wl_resource_get_link(resource));
+}
+
+static void noop_region_rect(struct wl_client *client,
+		struct wl_resource *resource,
+		int32_t x, int32_t y, int32_t width, int32_t height) {
+}
+
+static const struct wl_region_interface region_impl = {
+	.destroy = destroy_resource,
+	.add = noop_region_rect,
+	.subtract = noop_region_rect,
+};
+
+static void buffer_handle_destroy(struct wl_client *client,
+		struct wl_resource *resource) {
+	struct mock_buffer *buffer = wl_resource_get_user_data(resource);
+	buffer->mock->stats.buffers_destroyed++;
+	wl_resource_destroy(resource);
+}
+
+static const struct wl_buffer_interface buffer_impl = {
+	.destroy = buffer_handle_destroy,
+};
+
+static void buffer_handle_resource_destroy(struct wl_resource *resource) {
+	struct mock_buffer *buffer = wl_resource_get_user_data(resource);
+	struct mock_surface *surface;
+	wl_list_for_each(surface, &buffer->mock->surfaces, link) {
+		if (surface->buffer == buffer) {
+			surface->buffer = NULL;
+		}
+		if (surface->pending_buffer == buffer) {
+			surface->pending_buffer = NULL;
+		}
+	}
+	free(buffer);
+}
+
+static void pool_handle_create_buffer(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id, int32_t offset,
+		int32_t width, int32_t height, int32_t stride, uint32_t format) {
+	struct mock_pool *pool = wl_resource_get_user_data(resource);
+	if (width <= 0 || height <= 0 || offset < 0 || stride < width * 4 ||
+			(int64_t)offset + (int64_t)stride * height > pool->size) {
+		wl_resource_post_error(resource, WL_SHM_ERROR_INVALID_STRIDE,
+			"invalid buffer geometry");
+		fail(pool->mock, "invalid %dx%d buffer at %d with stride %d in a "
+			"pool of %d bytes", width, height, offset, stride, pool->size);
+		return;
+	}
+	struct mock_buffer *buffer = calloc(1, sizeof(*buffer));
+	if (!buffer) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	buffer->resource = wl_resource_create(client, &wl_buffer_interface, 1, id);
+	if (!buffer->resource) {
+		free(buffer);
+		wl_client_post_no_memory(client);
+		return;
+	}
+	buffer->mock = pool->mock;
+	buffer->width = width;
+	buffer->height = height;
+	wl_resource_set_implementation(buffer->resource, &buffer_impl, buffer,
+		buffer_handle_resource_destroy);
+	pool->mock->stats.buffers_created++;
+}
+
+static void pool_handle_resize(struct wl_client *client,
+		struct wl_resource *resource, int32_t size) {
+	struct mock_pool *pool = wl_resource_get_user_data(resource);
+	if (size < pool->size) {
+		wl_resource_post_error(resource, WL_SHM_ERROR_INVALID_FD,
+			"pools cannot shrink");
+		fail(pool->mock, "shm pool shrunk from %d to %d bytes",
+			pool->size, size);
+		return;
+	}
+	// Only the growth is new memory
+	pool->mock->stats.shm_bytes += size - pool->size;
+	pool->size = size;
+}
+
+static const struct wl_shm_pool_interface pool_impl = {
+	.create_buffer = pool_handle_create_buffer,
+	.destroy = destroy_resource,
+	.resize = pool_handle_resize,
+};
+
+static void pool_handle_resource_destroy(struct wl_resource *resource) {
+	free(wl_resource_get_user_data(resource));
+}
+
+static void shm_handle_create_pool(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id, int32_t fd, int32_t size) {
+	struct mock *mock = wl_resource_get_user_data(resource);
+	// The contents are never looked at
+	close(fd);
+	if (size <= 0) {
+		wl_resource_post_error(resource, WL_SHM_ERROR_INVALID_FD,
+			"invalid pool size");
+		fail(mock, "shm pool of %d bytes", size);
+		return;
+	}
+	struct mock_pool *pool = calloc(1, sizeof(*pool));
+	struct wl_resource *pool_resource = pool ? wl_resource_create(client,
+		&wl_shm_pool_interface, wl_resource_get_version(resource), id) : NULL;
+	if (!pool_resource) {
+		free(pool);
+		wl_client_post_no_memory(client);
+		return;
+	}
+	pool->mock = mock;
+	pool->size = size;
+	wl_resource_set_implementation(pool_resource, &pool_impl, pool,
+		pool_handle_resource_destroy);
+	mock->stats.pools++;
+	mock->stats.shm_bytes += size;
+}
+
+static const struct wl_shm_interface shm_impl = {
+	.create_pool = shm_handle_create_pool,
+};
+
+static void bind_shm(struct wl_client *client, void *data, uint32_t version,
+		uint32_t id) {
+	struct wl_resource *resource =
+		wl_resource_create(client, &wl_shm_interface, version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &shm_impl, data, NULL);
+	wl_shm_send_format(resource, WL_SHM_FORMAT_ARGB8888);
+	wl_shm_send_format(resource, WL_SHM_FORMAT_XRGB8888);
+}
+
+static void print_frame(struct mock *mock) {
+	struct mock_stats *a = &mock->last_frame_stats, *b = &mock->stats;
+	printf("# frame %llu\trequests %llu\trequest_bytes %llu\tevents %llu\t"
+		"shm_bytes %llu\tbuffers %llu\tdamage_rects %llu\t"
+		"damage_area %llu\n",
+		(unsigned long long)b->frames,
+		(unsigned long long)(b->requests - a->requests),
+		(unsigned long long)(b->request_bytes - a->request_bytes),
+		(unsigned long long)(b->events - a->events),
+		(unsigned long long)(b->shm_bytes - a->shm_bytes),
+		(unsigned long long)(b->buffers_created - a->buffers_created),
+		(unsigned long long)(b->damage_rects - a->damage_rects),
+		(unsigned long long)(b->damage_area - a->damage_area));
+	*a = *b;
+}
+
+static void send_configure(struct mock *mock, struct mock_surface *surface) {
+	const struct mock_output *output = surface->output;
+	// Logical size, as the fractional scale shrinks it
+	uint32_t width = ((uint64_t)output->width * 120 + output->scale120 / 2) /
+		output->scale120;
+	uint32_t height = ((uint64_t)output->height * 120 + output->scale120 / 2) /
+		output->scale120;
+	mock->serial = wl_display_next_serial(mock->display);
+	zwlr_layer_surface_v1_send_configure(surface->layer_surface,
+		mock->serial, width, height);
+	mock->stats.configures++;
+}
+
+static void release_buffer(struct mock_buffer *buffer) {
+	if (buffer->busy) {
+		wl_buffer_send_release(buffer->resource);
+		buffer->mock->stats.releases++;
+		buffer->busy = false;
+	}
+}
+
+static void surface_handle_attach(struct wl_client *client,
+		struct wl_resource *resource, struct wl_resource *buffer,
+		int32_t x, int32_t y) {
+	struct mock_surface *surface = wl_resource_get_user_data(resource);
+	surface->attached = true;
+	surface->pending_buffer = buffer ? wl_resource_get_user_data(buffer) : NULL;
+}
+
+static void surface_handle_damage(struct wl_client *client,
+		struct wl_resource *resource,
+		int32_t x, int32_t y, int32_t width, int32_t height) {
+	struct mock_surface *surface = wl_resource_get_user_data(resource);
+	surface->mock->stats.damage_rects++;
+	if (width > 0 && height > 0) {
+		surface->mock->stats.damage_area += (uint64_t)width * height;
+	}
+}
+
+static void surface_handle_frame(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id) {
+	struct mock_surface *surface = wl_resource_get_user_data(resource);
+	if (wl_list_length(&surface->frame_callbacks) == MAX_FRAME_CALLBACKS) {
+		fail(surface->mock, "too many frame callbacks");
+		return;
+	}
+	struct wl_resource *callback =
+		wl_resource_create(client, &wl_callback_interface, 1, id);
+	if (!callback) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(callback, NULL, NULL, unlink_resource);
+	wl_list_insert(surface->frame_callbacks.prev,
+		wl_resource_get_link(callback));
+}
+
+static void surface_handle_set_region(struct wl_client *client,
+		struct wl_resource *resource, struct wl_resource *region) {
+}
+
+static void surface_handle_commit(struct wl_client *client,
+		struct wl_resource *resource) {
+	struct mock_surface *surface = wl_resource_get_user_data(resource);
+	struct mock *mock = surface->mock;
+	mock->stats.commits++;
+	struct wl_resource *callback, *tmp;
+	wl_resource_for_each_safe(callback, tmp, &surface->frame_callbacks) {
+		wl_callback_send_done(callback, (uint32_t)(read_ns() / 1000000));
+		wl_resource_destroy(callback);
+	}
+
+	if (!surface->layer_surface) {
+		return;
+	}
+	if (!surface->configured) {
+		// Initial commit
+		surface->configured = true;
+		send_configure(mock, surface);
+		return;
+	}
+	if (!surface->attached) {
+		return;
+	}
+	surface->attached = false;
+	if (surface->buffer && surface->buffer != surface->pending_buffer) {
+		release_buffer(surface->buffer);
+	}
+	surface->buffer = surface->pending_buffer;
+	if (!surface->buffer) {
+		return;
+	}
+	surface->buffer->busy = true;
+	if (mock->check == CHECK_FRAME) {
+		release_buffer(surface->buffer);
+	}
+	surface->frames++;
+	mock->stats.frames++;
+	if (mock->verbose) {
+		print_frame(mock);
+	}
+	if (mock->reconfigure && surface->frames % mock->reconfigure == 0) {
+		send_configure(mock, surface);
+	}
+}
+
+static void surface_handle_set_int(struct wl_client *client,
+		struct wl_resource *resource, int32_t value) {
+}
+
+static const struct wl_surface_interface surface_impl = {
+	.destroy = destroy_resource,
+	.attach = surface_handle_attach,
+	.damage = surface_handle_damage,
+	.frame = surface_handle_frame,
+	.set_opaque_region = surface_handle_set_region,
+	.set_input_region = surface_handle_set_region,
+	.commit = surface_handle_commit,
+	.set_buffer_transform = surface_handle_set_int,
+	.set_buffer_scale = surface_handle_set_int,
+	.damage_buffer = surface_handle_damage,
+};
+
+static void surface_handle_resource_destroy(struct wl_resource *resource) {
+	struct mock_surface *surface = wl_resource_get_user_data(resource);
+	struct wl_resource *callback, *tmp;
+	wl_resource_for_each_safe(callback, tmp, &surface->frame_callbacks) {
+		wl_resource_destroy(callback);
+	}
+	if (surface->layer_surface) {
+		wl_resource_set_user_data(surface->layer_surface, NULL);
+	}
+	wl_list_remove(&surface->link);
+	free(surface);
+}
+
+static void compositor_handle_create_surface(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id) {
+	struct mock *mock = wl_resource_get_user_data(resource);
+	struct mock_surface *surface = calloc(1, sizeof(*surface));
+	if (!surface) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	surface->resource = wl_resource_create(client, &wl_surface_interface,
+		wl_resource_get_version(resource), id);
+	if (!surface->resource) {
+		free(surface);
+		wl_client_post_no_memory(client);
+		return;
+	}
+	surface->mock = mock;
+	wl_list_init(&surface->frame_callbacks);
+	wl_list_insert(mock->surfaces.prev, &surface->link);
+	wl_resource_set_implementation(surface->resource, &surface_impl, surface,
+		surface_handle_resource_destroy);
+}
+
+static void compositor_handle_create_region(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id) {
+	struct wl_resource *region = wl_resource_create(client,
+		&wl_region_interface, wl_resource_get_version(resource), id);
+	if (!region) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(region, &region_impl, NULL, NULL);
+}
+
+static const struct wl_compositor_interface compositor_impl = {
+	.create_surface = compositor_handle_create_surface,
+	.create_region = compositor_handle_create_region,
+};
+
+static void bind_compositor(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct wl_resource *resource =
+		wl_resource_create(client, &wl_compositor_interface, version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &compositor_impl, data, NULL);
+}
+
+static const struct wl_output_interface output_impl = {
+	.release = destroy_resource,
+};
+
+static void bind_output(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct mock_output *output = data;
+	struct wl_resource *resource =
+		wl_resource_create(client, &wl_output_interface, version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &output_impl, output,
+		unlink_resource);
+	wl_list_insert(&output->resources, wl_resource_get_link(resource));
+
+	wl_output_send_geometry(resource, 0, 0, 0, 0, WL_OUTPUT_SUBPIXEL_UNKNOWN,
+		"swaybg", "mock", WL_OUTPUT_TRANSFORM_NORMAL);
+	wl_output_send_mode(resource,
+		WL_OUTPUT_MODE_CURRENT | WL_OUTPUT_MODE_PREFERRED,
+		output->width, output->height, 60000);
+	if (version >= WL_OUTPUT_SCALE_SINCE_VERSION) {
+		wl_output_send_scale(resource, (output->scale120 + 119) / 120);
+	}
+	if (version >= WL_OUTPUT_NAME_SINCE_VERSION) {
+		char name[16];
+		snprintf(name, sizeof(name), "MOCK-%d",
+			(int)(output - output->mock->outputs));
+		wl_output_send_name(resource, name);
+		wl_output_send_description(resource, "swaybg mock output");
+	}
+	if (version >= WL_OUTPUT_DONE_SINCE_VERSION) {
+		wl_output_send_done(resource);
+	}
+}
+
+static void layer_surface_handle_set_uint(struct wl_client *client,
+		struct wl_resource *resource, uint32_t value) {
+}
+
+static void layer_surface_handle_set_size(struct wl_client *client,
+		struct wl_resource *resource, uint32_t width, uint32_t height) {
+}
+
+static void layer_surface_handle_set_exclusive_zone(struct wl_client *client,
+		struct wl_resource *resource, int32_t zone) {
+}
+
+static void layer_surface_handle_set_margin(struct wl_client *client,
+		struct wl_resource *resource,
+		int32_t top, int32_t right, int32_t bottom, int32_t left) {
+}
+
+static void layer_surface_handle_get_popup(struct wl_client *client,
+		struct wl_resource *resource, struct wl_resource *popup) {
+}
+
+static void layer_surface_handle_ack_configure(struct wl_client *client,
+		struct wl_resource *resource, uint32_t serial) {
+	struct mock_surface *surface = wl_resource_get_user_data(resource);
+	if (!surface) {
+		return;
+	}
+	if (serial > surface->mock->serial) {
+		fail(surface->mock, "ack of unknown serial %u", serial);
+	}
+	surface->mock->stats.acks++;
+}
+
+static const struct zwlr_layer_surface_v1_interface layer_surface_impl = {
+	.set_size = layer_surface_handle_set_size,
+	.set_anchor = layer_surface_handle_set_uint,
+	.set_exclusive_zone = layer_surface_handle_set_exclusive_zone,
+	.set_margin = layer_surface_handle_set_margin,
+	.set_keyboard_interactivity = layer_surface_handle_set_uint,
+	.get_popup = layer_surface_handle_get_popup,
+	.ack_configure = layer_surface_handle_ack_configure,
+	.destroy = destroy_resource,
+};
+
+static void layer_surface_handle_resource_destroy(
+		struct wl_resource *resource) {
+	struct mock_surface *surface = wl_resource_get_user_data(resource);
+	if (surface) {
+		surface->layer_surface = NULL;
+	}
+}
+
+static void layer_shell_handle_get_layer_surface(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id,
+		struct wl_resource *surface_resource, struct wl_resource *output,
+		uint32_t layer, const char *namespace) {
+	struct mock *mock = wl_resource_get_user_data(resource);
+	struct mock_surface *surface = wl_resource_get_user_data(surface_resource);
+	if (surface->layer_surface || surface->configured) {
+		wl_resource_post_error(resource, ZWLR_LAYER_SHELL_V1_ERROR_ROLE,
+			"surface already has a role");
+		fail(mock, "get_layer_surface for a surface with a role");
+		return;
+	}
+	struct wl_resource *layer_surface = wl_resource_create(client,
+		&zwlr_layer_surface_v1_interface, wl_resource_get_version(resource),
+		id);
+	if (!layer_surface) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(layer_surface, &layer_surface_impl,
+		surface, layer_surface_handle_resource_destroy);
+	surface->layer_surface = layer_surface;
+	surface->output = output ? wl_resource_get_user_data(output) :
+		&mock->outputs[0];
+}
+
+static const struct zwlr_layer_shell_v1_interface layer_shell_impl = {
+	.get_layer_surface = layer_shell_handle_get_layer_surface,
+};
+
+static void bind_layer_shell(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct wl_resource *resource = wl_resource_create(client,
+		&zwlr_layer_shell_v1_interface, version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &layer_shell_impl, data, NULL);
+}
+
+static void viewport_handle_set_source(struct wl_client *client,
+		struct wl_resource *resource, wl_fixed_t x, wl_fixed_t y,
+		wl_fixed_t width, wl_fixed_t height) {
+}
+
+static void viewport_handle_set_destination(struct wl_client *client,
+		struct wl_resource *resource, int32_t width, int32_t height) {
+}
+
+static const struct wp_viewport_interface viewport_impl = {
+	.destroy = destroy_resource,
+	.set_source = viewport_handle_set_source,
+	.set_destination = viewport_handle_set_destination,
+};
+
+static void viewporter_handle_get_viewport(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id,
+		struct wl_resource *surface) {
+	struct wl_resource *viewport = wl_resource_create(client,
+		&wp_viewport_interface, wl_resource_get_version(resource), id);
+	if (!viewport) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(viewport, &viewport_impl, NULL, NULL);
+}
+
+static const struct wp_viewporter_interface viewporter_impl = {
+	.destroy = destroy_resource,
+	.get_viewport = viewporter_handle_get_viewport,
+};
+
+static void bind_viewporter(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct wl_resource *resource =
+		wl_resource_create(client, &wp_viewporter_interface, version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &viewporter_impl, data, NULL);
+}
+
+static const struct wp_fractional_scale_v1_interface fract_scale_impl = {
+	.destroy = destroy_resource,
+};
+
+static void fract_manager_handle_get_fractional_scale(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id,
+		struct wl_resource *surface_resource) {
+	struct mock *mock = wl_resource_get_user_data(resource);
+	struct wl_resource *fract_scale = wl_resource_create(client,
+		&wp_fractional_scale_v1_interface, wl_resource_get_version(resource),
+		id);
+	if (!fract_scale) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(fract_scale, &fract_scale_impl, NULL, NULL);
+	// Use the scale of the output the surface is shown on
+	struct mock_surface *surface = wl_resource_get_user_data(surface_resource);
+	const struct mock_output *output =
+		surface->output ? surface->output : &mock->outputs[0];
+	wp_fractional_scale_v1_send_preferred_scale(fract_scale, output->scale120);
+}
+
+static const struct wp_fractional_scale_manager_v1_interface fract_manager_impl = {
+	.destroy = destroy_resource,
+	.get_fractional_scale = fract_manager_handle_get_fractional_scale,
+};
+
+static void bind_fract_manager(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct wl_resource *resource = wl_resource_create(client,
+		&wp_fractional_scale_manager_v1_interface, version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &fract_manager_impl, data, NULL);
+}
+
+static void toplevel_handle_request(struct wl_client *client,
+		struct wl_resource *resource) {
+}
+
+static void toplevel_handle_activate(struct wl_client *client,
+		struct wl_resource *resource, struct wl_resource *seat) {
+}
+
+static void toplevel_handle_set_rectangle(struct wl_client *client,
+		struct wl_resource *resource, struct wl_resource *surface,
+		int32_t x, int32_t y, int32_t width, int32_t height) {
+}
+
+static void toplevel_handle_set_fullscreen(struct wl_client *client,
+		struct wl_resource *resource, struct wl_resource *output) {
+}
+
+static const struct zwlr_foreign_toplevel_handle_v1_interface toplevel_impl = {
+	.set_maximized = toplevel_handle_request,
+	.unset_maximized = toplevel_handle_request,
+	.set_minimized = toplevel_handle_request,
+	.unset_minimized = toplevel_handle_request,
+	.activate = toplevel_handle_activate,
+	.close = toplevel_handle_request,
+	.set_rectangle = toplevel_handle_set_rectangle,
+	.destroy = destroy_resource,
+	.set_fullscreen = toplevel_handle_set_fullscreen,
+	.unset_fullscreen = toplevel_handle_request,
+};
+
+static void send_toplevel_state(struct wl_resource *toplevel, bool fullscreen) {
+	struct wl_array states;
+	wl_array_init(&states);
+	uint32_t *state = fullscreen ? wl_array_add(&states, sizeof(*state)) : NULL;
+	if (state) {
+		*state = ZWLR_FOREIGN_TOPLEVEL_HANDLE_V1_STATE_FULLSCREEN;
+	}
+	zwlr_foreign_toplevel_handle_v1_send_state(toplevel, &states);
+	zwlr_foreign_toplevel_handle_v1_send_done(toplevel);
+	wl_array_release(&states);
+}
+
+// Announce a toplevel on the given output to every manager
+static void create_toplevel(struct mock *mock, struct mock_output *output) {
+	struct wl_resource *manager;
+	wl_resource_for_each(manager, &mock->toplevel_managers) {
+		struct wl_resource *toplevel = wl_resource_create(mock->client,
+			&zwlr_foreign_toplevel_handle_v1_interface,
+			wl_resource_get_version(manager), 0);
+		if (!toplevel) {
+			wl_client_post_no_memory(mock->client);
+			return;
+		}
+		wl_resource_set_implementation(toplevel, &toplevel_impl, mock,
+			unlink_resource);
+		wl_list_insert(&mock->toplevels, wl_resource_get_link(toplevel));
+		zwlr_foreign_toplevel_manager_v1_send_toplevel(manager, toplevel);
+		zwlr_foreign_toplevel_handle_v1_send_app_id(toplevel, "mock");
+		struct wl_resource *wl_output;
+		wl_resource_for_each(wl_output, &output->resources) {
+			zwlr_foreign_toplevel_handle_v1_send_output_enter(toplevel,
+				wl_output);
+		}
+		send_toplevel_state(toplevel, true);
+	}
+}
+
+static void toplevel_manager_handle_stop(struct wl_client *client,
+		struct wl_resource *resource) {
+	zwlr_foreign_toplevel_manager_v1_send_finished(resource);
+	wl_resource_destroy(resource);
+}
+
+static const struct zwlr_foreign_toplevel_manager_v1_interface toplevel_manager_impl = {
+	.stop = toplevel_manager_handle_stop,
+};
+
+static void bind_toplevel_manager(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct mock *mock = data;
+	struct wl_resource *resource = wl_resource_create(client,
+		&zwlr_foreign_toplevel_manager_v1_interface, version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &toplevel_manager_impl, mock,
+		unlink_resource);
+	wl_list_insert(&mock->toplevel_managers, wl_resource_get_link(resource));
+}
+
+static bool create_globals(struct mock *mock) {
+	bool ok = wl_global_create(mock->display, &wl_compositor_interface, 4,
+			mock, bind_compositor) &&
+		wl_global_create(mock->display, &wl_shm_interface, 1,
+			mock, bind_shm) &&
+		wl_global_create(mock->display, &zwlr_layer_shell_v1_interface, 1,
+			mock, bind_layer_shell) &&
+		wl_global_create(mock->display, &wp_viewporter_interface, 1,
+			mock, bind_viewporter) &&
+		wl_global_create(mock->display,
+			&wp_fractional_scale_manager_v1_interface, 1,
+			mock, bind_fract_manager) &&
+		wl_global_create(mock->display,
+			&zwlr_foreign_toplevel_manager_v1_interface, 3,
+			mock, bind_toplevel_manager);
+	for (int i = 0; ok && i < mock->n_outputs; i++) {
+		struct mock_output *output = &mock->outputs[i];
+		output->global = wl_global_create(mock->display,
+			&wl_output_interface, 4, output, bind_output);
+		ok = output->global != NULL;
+	}
+	return ok;
+}
+
+static void handle_client_destroy(struct wl_listener *listener, void *data) {
+	struct mock *mock = wl_container_of(listener, mock, client_destroy);
+	wl_list_remove(&mock->client_destroy.link);
+	mock->client = NULL;
+}
+
+static bool all_outputs_done(struct mock *mock) {
+	int done = 0;
+	struct mock_surface *surface;
+	wl_list_for_each(surface, &mock->surfaces, link) {
+		if (surface->layer_surface && surface->frames >= mock->target_frames) {
+			done++;
+		}
+	}
+	return done >= mock->n_outputs;
+}
+
+// Send a command to the control socket of swaybg and read the whole reply,
+// and the file descriptor passed along if reply_fd is set, return whether
+// one came
+static bool control_request(const char *path, const char *cmd,
+		char *reply, size_t size, int *reply_fd) {
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		return false;
+	}
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		close(fd);
+		return false;
+	}
+	ssize_t len = strlen(cmd);
+	bool ok = write(fd, cmd, len) == len;
+	shutdown(fd, SHUT_WR);
+	if (reply_fd) {
+		*reply_fd = -1;
+	}
+	size_t n = 0;
+	while (ok && n < size - 1) {
+		struct iovec iov = { .iov_base = reply + n, .iov_len = size - 1 - n };
+		char control[CMSG_SPACE(sizeof(int))];
+		struct msghdr msg = {
+			.msg_iov = &iov,
+			.msg_iovlen = 1,
+			.msg_control = control,
+			.msg_controllen = sizeof(control),
+		};
+		struct pollfd pfd = { .fd = fd, .events = POLLIN };
+		ssize_t r = poll(&pfd, 1, 1000) > 0 ?
+			recvmsg(fd, &msg, MSG_CMSG_CLOEXEC) : -1;
+		if (r <= 0) {
+			ok = r == 0 && n > 0;
+			break;
+		}
+		n += r;
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		if (cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+				cmsg->cmsg_type == SCM_RIGHTS) {
+			int received;
+			memcpy(&received, CMSG_DATA(cmsg), sizeof(received));
+			if (reply_fd && *reply_fd < 0) {
+				*reply_fd = received;
+			} else {
+				close(received);
+			}
+		}
+	}
+	reply[n] = '\0';
+	close(fd);
+	if (!ok && reply_fd && *reply_fd >= 0) {
+		close(*reply_fd);
+		*reply_fd = -1;
+	}
+	return ok;
+}
+
+// Ask swaybg to step as fast as the control socket allows, return whether
+// the command went through
+static bool send_rate(const char *path, int rate) {
+	char cmd[32], reply[64];
+	snprintf(cmd, sizeof(cmd), "rate %d\n", rate);
+	return control_request(path, cmd, reply, sizeof(reply), NULL) &&
+		strncmp(reply, "ok", 2) == 0;
+}
+
+// Look up a column of the line of an output in the reply to stats
+static bool get_output_stat(const char *stats, const char *output,
+		const char *column, char *value, size_t size) {
+	const char *header = strstr(stats, "# output\t");
+	if (!header) {
+		return false;
+	}
+	header += 2;
+	size_t column_len = strlen(column);
+	int index = 0;
+	const char *p = header;
+	while (strncmp(p, column, column_len) != 0 ||
+			(p[column_len] != '\t' && p[column_len] != '\n')) {
+		p += strcspn(p, "\t\n");
+		if (*p != '\t') {
+			return false;
+		}
+		p++;
+		index++;
+	}
+
+	size_t output_len = strlen(output);
+	const char *line = stats;
+	while (strncmp(line, output, output_len) != 0 ||
+			line[output_len] != '\t') {
+		line = strchr(line, '\n');
+		if (!line) {
+			return false;
+		}
+		line++;
+	}
+	for (int i = 0; i < index; i++) {
+		line += strcspn(line, "\t\n");
+		if (*line != '\t') {
+			return false;
+		}
+		line++;
+	}
+	size_t len = strcspn(line, "\t\n");
+	if (len >= size) {
+		return false;
+	}
+	memcpy(value, line, len);
+	value[len] = '\0';
+	return true;
+}
+
+static bool get_first_output_stats(struct mock *mock, char *state,
+		size_t size, uint64_t *steps) {
+	char stats[MAX_REPLY], value[32];
+	if (!control_request(mock->sock_path, "stats\n", stats, sizeof(stats),
+				NULL) ||
+			!get_output_stat(stats, "MOCK-0", "state", state, size) ||
+			!get_output_stat(stats, "MOCK-0", "steps", value, sizeof(value))) {
+		fail(mock, "no stats for MOCK-0");
+		return false;
+	}
+	*steps = strtoull(value, NULL, 10);
+	return true;
+}
+
+static struct mock_surface *get_first_output_surface(struct mock *mock) {
+	struct mock_surface *surface;
+	wl_list_for_each(surface, &mock->surfaces, link) {
+		if (surface->layer_surface && surface->output == &mock->outputs[0]) {
+			return surface;
+		}
+	}
+	return NULL;
+}
+
+// Cover the first output with a fullscreen toplevel for a while, during
+// which it must not commit, and check that the missed steps are caught up
+// on once it is uncovered
+static void step_cover_check(struct mock *mock) {
+	struct mock_surface *surface = get_first_output_surface(mock);
+	uint64_t now = read_ns();
+	uint64_t elapsed_ms = (now - mock->check_since) / 1000000;
+	char state[32];
+	uint64_t steps;
+	enum mock_check_state next;
+	if (!surface && mock->check_state != CHECK_WAIT) {
+		fail(mock, "the surface of MOCK-0 is gone");
+		return;
+	}
+	switch (mock->check_state) {
+	case CHECK_WAIT:
+		if (!surface || surface->frames < CHECK_WARMUP_FRAMES) {
+			return;
+		}
+		if (wl_list_empty(&mock->toplevel_managers)) {
+			fail(mock, "swaybg did not bind the foreign toplevel manager");
+			return;
+		}
+		create_toplevel(mock, &mock->outputs[0]);
+		next = CHECK_COVERED;
+		break;
+	case CHECK_COVERED:
+		if (elapsed_ms < CHECK_COVER_MS) {
+			return;
+		}
+		if (!get_first_output_stats(mock, state, sizeof(state), &steps)) {
+			return;
+		}
+		// The frame requested before the toplevel showed up may still come
+		if (strcmp(state, "covered") != 0 ||
+				surface->frames - mock->check_frames > 1) {
+			fail(mock, "MOCK-0 is %s and committed %d frames while covered",
+				state, surface->frames - mock->check_frames);
+			return;
+		}
+		mock->check_steps = steps;
+		struct wl_resource *toplevel;
+		wl_resource_for_each(toplevel, &mock->toplevels) {
+			send_toplevel_state(toplevel, false);
+		}
+		next = CHECK_UNCOVERED;
+		break;
+	case CHECK_UNCOVERED:
+		if (surface->frames == mock->check_frames) {
+			if (elapsed_ms > 2000) {
+				fail(mock, "no frame on MOCK-0 after it was uncovered");
+			}
+			return;
+		}
+		if (!get_first_output_stats(mock, state, sizeof(state), &steps)) {
+			return;
+		}
+		// The steps of the time covered, give or take the timer slack
+		uint64_t expected = CHECK_COVER_MS * (uint64_t)mock->rate / 60000;
+		if (strcmp(state, "running") != 0 ||
+				steps - mock->check_steps < expected / 2) {
+			fail(mock, "MOCK-0 is %s and took %llu steps after it was "
+				"uncovered, expected at least %llu", state,
+				(unsigned long long)(steps - mock->check_steps),
+				(unsigned long long)expected / 2);
+			return;
+		}
+		printf("# check cover\tsteps %llu\n",
+			(unsigned long long)(steps - mock->check_steps));
+		next = CHECK_DONE;
+		break;
+	default:
+		return;
+	}
+	mock->check_state = next;
+	mock->check_since = now;
+	mock->check_frames = surface->frames;
+}
+
+static uint64_t checksum(const unsigned char *data, size_t size) {
+	// FNV-1a
+	uint64_t hash = 0xcbf29ce484222325;
+	for (size_t i = 0; i < size; i++) {
+		hash = (hash ^ data[i]) * 0x100000001b3;
+	}
+	return hash;
+}
+
+// Map the buffer of the frame the first output shows, right after it was
+// committed, and check that it is unchanged once the next one is
+static void step_frame_check(struct mock *mock) {
+	struct mock_surface *surface = get_first_output_surface(mock);
+	if (!surface) {
+		return;
+	}
+	int frames = mock->check_frames;
+	mock->check_frames = surface->frames;
+	if (surface->frames == frames) {
+		// No commit since the last time
+		return;
+	}
+	if (mock->check_state == CHECK_EXPORTED) {
+		bool unchanged = checksum(mock->check_data, mock->check_size) ==
+			mock->check_sum;
+		munmap((void *)mock->check_data, mock->check_size);
+		mock->check_data = NULL;
+		if (!unchanged) {
+			fail(mock, "the exported buffer of MOCK-0 was drawn into "
+				"before the next frame was committed");
+			return;
+		}
+		mock->check_state = ++mock->check_rounds < CHECK_FRAME_ROUNDS ?
+			CHECK_WAIT : CHECK_DONE;
+		if (mock->check_state == CHECK_DONE) {
+			printf("# check frame\trounds %d\n", mock->check_rounds);
+		}
+		// Wait for a frame committed after this check, not the one just seen
+		return;
+	}
+	if (mock->check_state != CHECK_WAIT ||
+			surface->frames < CHECK_WARMUP_FRAMES) {
+		return;
+	}
+
+	char reply[128];
+	int fd;
+	unsigned width, height, stride;
+	unsigned long long number;
+	if (!control_request(mock->sock_path, "frame MOCK-0\n", reply,
+			sizeof(reply), &fd)) {
+		fail(mock, "no reply to frame MOCK-0");
+		return;
+	}
+	if (fd < 0 || sscanf(reply, "%u %u %u xrgb8888 %llu",
+			&width, &height, &stride, &number) != 4) {
+		fail(mock, "unexpected reply to frame MOCK-0: %s", reply);
+		if (fd >= 0) {
+			close(fd);
+		}
+		return;
+	}
+	size_t size = (size_t)stride * height;
+	void *data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		fail(mock, "failed to map frame %llu: %s", number, strerror(errno));
+		return;
+	}
+	mock->check_data = data;
+	mock->check_size = size;
+	mock->check_sum = checksum(data, size);
+	mock->check_state = CHECK_EXPORTED;
+}
+
+// Send a command to the control socket of swaybg and close the connection
+// right away
+static bool send_and_hang_up(const char *path, const char *cmd) {
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		return false;
+	}
+	ssize_t len = strlen(cmd);
+	bool ok = connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0 &&
+		send(fd, cmd, len, MSG_NOSIGNAL) == len;
+	close(fd);
+	return ok;
+}
+
+// Hang up on swaybg before it replies, which it must survive to draw the next
+// frames and answer the next commands
+static void step_hangup_check(struct mock *mock) {
+	struct mock_surface *surface = get_first_output_surface(mock);
+	if (!surface || surface->frames < CHECK_WARMUP_FRAMES) {
+		return;
+	}
+	char state[32];
+	uint64_t steps;
+	switch (mock->check_state) {
+	case CHECK_WAIT:
+		for (int i = 0; i < CHECK_HANGUP_ROUNDS; i++) {
+			if (!send_and_hang_up(mock->sock_path,
+					i % 2 ? "rate\n" : "stats\n")) {
+				fail(mock, "failed to send a command to swaybg");
+				return;
+			}
+		}
+		mock->check_frames = surface->frames;
+		mock->check_state = CHECK_HUNG_UP;
+		break;
+	case CHECK_HUNG_UP:
+		// swaybg exiting shows up as a disconnection in the main loop
+		if (surface->frames - mock->check_frames < 2 ||
+				!get_first_output_stats(mock, state, sizeof(state), &steps)) {
+			return;
+		}
+		printf("# check hangup\trounds %d\n", CHECK_HANGUP_ROUNDS);
+		mock->check_state = CHECK_DONE;
+		break;
+	default:
+		break;
+	}
+}
+
+static bool is_check_done(const struct mock *mock) {
+	return mock->check == CHECK_NONE || mock->check_state == CHECK_DONE;
+}
+
+static pid_t spawn_swaybg(int fd, const char *sock_path, char **argv) {
+	pid_t pid = fork();
+	if (pid != 0) {
+		return pid;
+	}
+	char fd_str[16];
+	snprintf(fd_str, sizeof(fd_str), "%d", fd);
+	setenv("WAYLAND_SOCKET", fd_str, 1);
+	setenv("SWAYBG_SOCK", sock_path, 1);
+	execvp(argv[0], argv);
+	perror("execvp");
+	_exit(127);
+}
+
+static void print_stat(const char *name, uint64_t total, uint64_t frames) {
+	printf("%s\t%llu\t%.2f\n", name, (unsigned long long)total,
+		frames ? (double)total / frames : 0.0);
+}
+
+static void print_stats(const struct mock *mock, uint64_t elapsed_ns,
+		const struct rusage *usage) {
+	const struct mock_stats *s = &mock->stats;
+	uint64_t cpu_us = (uint64_t)(usage->ru_utime.tv_sec +
+		usage->ru_stime.tv_sec) * 1000000 +
+		usage->ru_utime.tv_usec + usage->ru_stime.tv_usec;
+	printf("# stat\ttotal\tper_frame\n");
+	print_stat("frames", s->frames, s->frames);
+	print_stat("requests", s->requests, s->frames);
+	print_stat("request_bytes", s->request_bytes, s->frames);
+	print_stat("events", s->events, s->frames);
+	print_stat("event_bytes", s->event_bytes, s->frames);
+	print_stat("commits", s->commits, s->frames);
+	print_stat("shm_pools", s->pools, s->frames);
+	print_stat("shm_bytes", s->shm_bytes, s->frames);
+	print_stat("buffers_created", s->buffers_created, s->frames);
+	print_stat("buffers_destroyed", s->buffers_destroyed, s->frames);
+	print_stat("buffer_releases", s->releases, s->frames);
+	print_stat("configures", s->configures, s->frames);
+	print_stat("configure_acks", s->acks, s->frames);
+	print_stat("damage_rects", s->damage_rects, s->frames);
+	print_stat("damage_area", s->damage_area, s->frames);
+	print_stat("client_cpu_us", cpu_us, s->frames);
+	print_stat("elapsed_us", elapsed_ns / 1000, s->frames);
+	for (int i = 0; i < mock->n_interfaces; i++) {
+		char name[64];
+		snprintf(name, sizeof(name), "requests.%s", mock->interfaces[i].name);
+		print_stat(name, mock->interfaces[i].requests, s->frames);
+	}
+}
+
+static bool parse_size(const char *str, int32_t *width, int32_t *height) {
+	char *end;
+	long w = strtol(str, &end, 10);
+	if (*end != 'x') {
+		return false;
+	}
+	long h = strtol(end + 1, &end, 10);
+	if (*end != '\0' || w <= 0 || h <= 0 || w > 16384 || h > 16384) {
+		return false;
+	}
+	*width = w;
+	*height = h;
+	return true;
+}
+
+int main(int argc, char **argv) {
+	static struct option long_options[] = {
+		{"check", required_argument, NULL, 'C'},
+		{"configure", required_argument, NULL, 'c'},
+		{"frames", required_argument, NULL, 'f'},
+		{"help", no_argument, NULL, 'h'},
+		{"outputs", required_argument, NULL, 'n'},
+		{"rate", required_argument, NULL, 'r'},
+		{"size", required_argument, NULL, 's'},
+		{"scale", required_argument, NULL, 'S'},
+		{"timeout", required_argument, NULL, 't'},
+		{"verbose", no_argument, NULL, 'v'},
+		{0, 0, 0, 0}
+	};
+
+	const char *usage =
+		"Usage: swaybg-mock-compositor <options...> [--] <swaybg> [<args>...]\n"
+		"\n"
+		"  -C, --check <name>     Also check a behaviour of swaybg: cover,\n"
+		"                         frame or hangup.\n"
+		"  -c, --configure <n>    Send a new configure every <n> frames.\n"
+		"  -f, --frames <n>       Frames to wait for on every output (200).\n"
+		"  -h, --help             Show help message and quit.\n"
+		"  -n, --outputs <n>      Number of outputs (1).\n"
+		"  -r, --rate <steps>     Animation steps per minute to ask for (6000).\n"
+		"  -s, --size <w>x<h>     Output mode size (1920x1080).\n"
+		"  -S, --scale <n>        Preferred scale in 120ths (120).\n"
+		"  -t, --timeout <s>      Give up after this many seconds (60).\n"
+		"  -v, --verbose          Print the statistics of every frame.\n"
+		"\n";
+
+	struct mock mock = { .n_outputs = 1, .target_frames = 200 };
+	int32_t width = 1920, height = 1080;
+	uint32_t scale120 = 120;
+	int timeout = 60;
+	mock.rate = 6000;
+
+	int c;
+	while ((c = getopt_long(argc, argv, "+C:c:f:hn:r:s:S:t:v",
+			long_options, NULL)) != -1) {
+		switch (c) {
+		case 'C':
+			if (strcmp(optarg, "cover") == 0) {
+				mock.check = CHECK_COVER;
+			} else if (strcmp(optarg, "frame") == 0) {
+				mock.check = CHECK_FRAME;
+			} else if (strcmp(optarg, "hangup") == 0) {
+				mock.check = CHECK_HANGUP;
+			} else {
+				fprintf(stderr, "Unknown check: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'c':
+			mock.reconfigure = atoi(optarg);
+			break;
+		case 'f':
+			mock.target_frames = atoi(optarg);
+			break;
+		case 'n':
+			mock.n_outputs = atoi(optarg);
+			if (mock.n_outputs < 1 || mock.n_outputs > MAX_OUTPUTS) {
+				fprintf(stderr, "Between 1 and %d outputs are supported\n",
+					MAX_OUTPUTS);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'r':
+			mock.rate = atoi(optarg);
+			break;
+		case 's':
+			if (!parse_size(optarg, &width, &height)) {
+				fprintf(stderr, "Invalid size: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'S':
+			scale120 = atoi(optarg);
+			if (scale120 < 60 || scale120 > 480) {
+				fprintf(stderr, "Invalid scale: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 't':
+			timeout = atoi(optarg);
+			break;
+		case 'v':
+			mock.verbose = true;
+			break;
+		default:
+			fprintf(c == 'h' ? stdout : stderr, "%s", usage);
+			return c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+	if (optind >= argc) {
+		fprintf(stderr, "%s", usage);
+		return EXIT_FAILURE;
+	}
+	for (int i = 0; i < mock.n_outputs; i++) {
+		mock.outputs[i] = (struct mock_output){
+			.mock = &mock,
+			.width = width,
+			.height = height,
+			.scale120 = scale120,
+		};
+		wl_list_init(&mock.outputs[i].resources);
+	}
+
+	wl_list_init(&mock.surfaces);
+	wl_list_init(&mock.toplevel_managers);
+	wl_list_init(&mock.toplevels);
+	mock.display = wl_display_create();
+	if (!mock.display) {
+		fprintf(stderr, "Failed to create the display\n");
+		return EXIT_FAILURE;
+	}
+	wl_display_add_protocol_logger(mock.display, log_message, &mock);
+	if (!create_globals(&mock)) {
+		fprintf(stderr, "Failed to create the globals\n");
+		wl_display_destroy(mock.display);
+		return EXIT_FAILURE;
+	}
+
+	char dir[] = "/tmp/swaybg-mock-XXXXXX";
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		return EXIT_FAILURE;
+	}
+	char sock_path[sizeof(dir) + 16];
+	snprintf(sock_path, sizeof(sock_path), "%s/ctl.sock", dir);
+	mock.sock_path = sock_path;
+
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+		perror("socketpair");
+		return EXIT_FAILURE;
+	}
+	pid_t pid = spawn_swaybg(fds[1], sock_path, argv + optind);
+	close(fds[1]);
+	if (pid < 0) {
+		perror("fork");
+		return EXIT_FAILURE;
+	}
+	mock.client = wl_client_create(mock.display, fds[0]);
+	if (!mock.client) {
+		fail(&mock, "failed to create the client");
+		close(fds[0]);
+	} else {
+		mock.client_destroy.notify = handle_client_destroy;
+		wl_client_add_destroy_listener(mock.client, &mock.client_destroy);
+	}
+
+	struct wl_event_loop *loop = wl_display_get_event_loop(mock.display);
+	uint64_t start = read_ns(), first_frame = 0;
+	bool rate_set = false;
+	while (!mock.failed && (!all_outputs_done(&mock) || !is_check_done(&mock))) {
+		if (read_ns() - start > (uint64_t)timeout * 1000000000) {
+			fail(&mock, "timed out after %llu frames",
+				(unsigned long long)mock.stats.frames);
+			break;
+		}
+		wl_display_flush_clients(mock.display);
+		if (wl_event_loop_dispatch(loop, 100) < 0 && errno != EINTR) {
+			fail(&mock, "dispatch failed: %s", strerror(errno));
+			break;
+		}
+		if (!mock.client) {
+			// Also after protocol errors, which disconnect the client
+			if (!mock.failed) {
+				fail(&mock, "swaybg disconnected");
+			}
+			break;
+		}
+		if (mock.stats.frames > 0 && !first_frame) {
+			first_frame = read_ns();
+		}
+		if (mock.stats.frames > 0 && !rate_set) {
+			rate_set = send_rate(sock_path, mock.rate);
+		}
+		if (rate_set && mock.check == CHECK_COVER) {
+			step_cover_check(&mock);
+		} else if (rate_set && mock.check == CHECK_FRAME) {
+			step_frame_check(&mock);
+		} else if (rate_set && mock.check == CHECK_HANGUP) {
+			step_hangup_check(&mock);
+		}
+	}
+	uint64_t elapsed = first_frame ? read_ns() - first_frame : 0;
+
+	// swaybg exits once the connection is gone
+	if (mock.client) {
+		wl_list_remove(&mock.client_destroy.link);
+		wl_client_destroy(mock.client);
+		mock.client = NULL;
+	}
+	int status = 0;
+	for (int i = 0; i < 50 && waitpid(pid, &status, WNOHANG) == 0; i++) {
+		nanosleep(&(struct timespec){ .tv_nsec = 100000000 }, NULL);
+	}
+	if (waitpid(pid, &status, WNOHANG) == 0) {
+		kill(pid, SIGKILL);
+		waitpid(pid, &status, 0);
+	}
+	struct rusage rusage;
+	getrusage(RUSAGE_CHILDREN, &rusage);
+	unlink(sock_path);
+	rmdir(dir);
+	wl_display_destroy(mock.display);
+
+	print_stats(&mock, elapsed, &rusage);
+	return mock.failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
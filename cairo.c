@@ -2,7 +2,9 @@
 #include <cairo.h>
 #include "cairo_util.h"
 #if HAVE_GDK_PIXBUF
-#include <gdk-pixbuf/gdk-pixbuf.h>
+#include "parallel.h"
+#include "pixbuf.h"
+#include "pixconv.h"
 #endif
 
 void cairo_set_source_u32(cairo_t *cairo, uint32_t color) {
@@ -30,19 +32,44 @@ cairo_subpixel_order_t to_cairo_subpixel_order(enum wl_output_subpixel subpixel)
 }
 
 #if HAVE_GDK_PIXBUF
+// Images larger than this are converted by several threads
+#define PARALLEL_MIN_PIXELS (1 << 20)
+#define PARALLEL_MIN_ROWS 64
+
+struct pixbuf_convert {
+	pixconv_row_func convert;
+	const guint8 *src;
+	int src_stride;
+	unsigned char *dst;
+	int dst_stride;
+	int width;
+};
+
+static void convert_rows(void *data, int start, int end) {
+	struct pixbuf_convert *pc = data;
+	for (int y = start; y < end; y++) {
+		pc->convert((uint32_t *)(pc->dst + (size_t)y * pc->dst_stride),
+			pc->src + (size_t)y * pc->src_stride, pc->width);
+	}
+}
+
 cairo_surface_t* gdk_cairo_image_surface_create_from_pixbuf(const GdkPixbuf *gdkbuf) {
-	int chan = gdk_pixbuf_get_n_channels(gdkbuf);
+	const struct pixbuf_funcs *pixbuf = pixbuf_get();
+	if (!pixbuf) {
+		return NULL;
+	}
+	int chan = pixbuf->get_n_channels(gdkbuf);
 	if (chan < 3) {
 		return NULL;
 	}
 
-	const guint8* gdkpix = gdk_pixbuf_read_pixels(gdkbuf);
+	const guint8* gdkpix = pixbuf->read_pixels(gdkbuf);
 	if (!gdkpix) {
 		return NULL;
 	}
-	gint w = gdk_pixbuf_get_width(gdkbuf);
-	gint h = gdk_pixbuf_get_height(gdkbuf);
-	int stride = gdk_pixbuf_get_rowstride(gdkbuf);
+	gint w = pixbuf->get_width(gdkbuf);
+	gint h = pixbuf->get_height(gdkbuf);
+	int stride = pixbuf->get_rowstride(gdkbuf);
 
 	cairo_format_t fmt = (chan == 3) ? CAIRO_FORMAT_RGB24 : CAIRO_FORMAT_ARGB32;
 	cairo_surface_t * cs = cairo_image_surface_create (fmt, w, h);
@@ -51,75 +78,21 @@ cairo_surface_t* gdk_cairo_image_surface_create_from_pixbuf(const GdkPixbuf *gdk
 		return NULL;
 	}
 
-	int cstride = cairo_image_surface_get_stride(cs);
-	unsigned char * cpix = cairo_image_surface_get_data(cs);
-
-	if (chan == 3) {
-		int i;
-		for (i = h; i; --i) {
-			const guint8 *gp = gdkpix;
-			unsigned char *cp = cpix;
-			const guint8* end = gp + 3*w;
-			while (gp < end) {
-#if G_BYTE_ORDER == G_LITTLE_ENDIAN
-				cp[0] = gp[2];
-				cp[1] = gp[1];
-				cp[2] = gp[0];
-#else
-				cp[1] = gp[0];
-				cp[2] = gp[1];
-				cp[3] = gp[2];
-#endif
-				gp += 3;
-				cp += 4;
-			}
-			gdkpix += stride;
-			cpix += cstride;
-		}
+	const struct pixconv_funcs *funcs = pixconv_get();
+	struct pixbuf_convert pc = {
+		.convert = (chan == 3) ? funcs->rgb_to_xrgb : funcs->rgba_premul,
+		.src = gdkpix,
+		.src_stride = stride,
+		.dst = cairo_image_surface_get_data(cs),
+		.dst_stride = cairo_image_surface_get_stride(cs),
+		.width = w,
+	};
+	if ((long long)w * h >= PARALLEL_MIN_PIXELS) {
+		parallel_for(h, PARALLEL_MIN_ROWS, convert_rows, &pc);
 	} else {
-		/* premul-color = alpha/255 * color/255 * 255 = (alpha*color)/255
-		 * (z/255) = z/256 * 256/255     = z/256 (1 + 1/255)
-		 *         = z/256 + (z/256)/255 = (z + z/255)/256
-		 *         # recurse once
-		 *         = (z + (z + z/255)/256)/256
-		 *         = (z + z/256 + z/256/255) / 256
-		 *         # only use 16bit uint operations, loose some precision,
-		 *         # result is floored.
-		 *       ->  (z + z>>8)>>8
-		 *         # add 0x80/255 = 0.5 to convert floor to round
-		 *       =>  (z+0x80 + (z+0x80)>>8 ) >> 8
-		 * ------
-		 * tested as equal to lround(z/255.0) for uint z in [0..0xfe02]
-		 */
-#define PREMUL_ALPHA(x,a,b,z) \
-		G_STMT_START { z = a * b + 0x80; x = (z + (z >> 8)) >> 8; } \
-		G_STMT_END
-		int i;
-		for (i = h; i; --i) {
-			const guint8 *gp = gdkpix;
-			unsigned char *cp = cpix;
-			const guint8* end = gp + 4*w;
-			guint z1, z2, z3;
-			while (gp < end) {
-#if G_BYTE_ORDER == G_LITTLE_ENDIAN
-				PREMUL_ALPHA(cp[0], gp[2], gp[3], z1);
-				PREMUL_ALPHA(cp[1], gp[1], gp[3], z2);
-				PREMUL_ALPHA(cp[2], gp[0], gp[3], z3);
-				cp[3] = gp[3];
-#else
-				PREMUL_ALPHA(cp[1], gp[0], gp[3], z1);
-				PREMUL_ALPHA(cp[2], gp[1], gp[3], z2);
-				PREMUL_ALPHA(cp[3], gp[2], gp[3], z3);
-				cp[0] = gp[3];
-#endif
-				gp += 4;
-				cp += 4;
-			}
-			gdkpix += stride;
-			cpix += cstride;
-		}
-#undef PREMUL_ALPHA
+		convert_rows(&pc, 0, h);
 	}
+
 	cairo_surface_mark_dirty(cs);
 	return cs;
 }
@@ -0,0 +1,439 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "control.h"
+#include "log.h"
+
+char *control_get_socket_path(void) {
+	const char *sock = getenv("SWAYBG_SOCK");
+	if (sock && sock[0]) {
+		return strdup(sock);
+	}
+	const char *dir = getenv("XDG_RUNTIME_DIR");
+	if (!dir || dir[0] != '/') {
+		return NULL;
+	}
+	const char *display = getenv("WAYLAND_DISPLAY");
+	if (!display || !display[0]) {
+		display = "wayland-0";
+	}
+	// WAYLAND_DISPLAY may be an absolute path
+	const char *slash = strrchr(display, '/');
+	if (slash) {
+		display = slash + 1;
+	}
+	size_t size = strlen(dir) + strlen(display) + sizeof("/swaybg-.sock");
+	char *path = malloc(size);
+	if (path) {
+		snprintf(path, size, "%s/swaybg-%s.sock", dir, display);
+	}
+	return path;
+}
+
+static bool get_socket_addr(const char *path, struct sockaddr_un *addr) {
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr->sun_path)) {
+		return false;
+	}
+	strcpy(addr->sun_path, path);
+	return true;
+}
+
+static bool set_cloexec_nonblock(int fd) {
+	return fcntl(fd, F_SETFD, FD_CLOEXEC) == 0 &&
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == 0;
+}
+
+// Whether another process is listening on the socket
+static bool socket_in_use(const struct sockaddr_un *addr) {
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return false;
+	}
+	bool in_use = connect(fd, (const struct sockaddr *)addr,
+		sizeof(*addr)) == 0;
+	close(fd);
+	return in_use;
+}
+
+bool control_init(struct control *control, control_handler handler,
+		void *data) {
+	*control = (struct control){
+		.fd = -1,
+		.handler = handler,
+		.data = data,
+		.reply_fd = -1,
+	};
+	for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+		control->clients[i].fd = -1;
+	}
+
+	control->path = control_get_socket_path();
+	if (!control->path) {
+		swaybg_log(LOG_INFO, "XDG_RUNTIME_DIR is not set, "
+			"control socket disabled");
+		return false;
+	}
+	struct sockaddr_un addr;
+	if (!get_socket_addr(control->path, &addr)) {
+		swaybg_log(LOG_ERROR, "Control socket path %s is too long",
+			control->path);
+		goto error;
+	}
+
+	control->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (control->fd < 0 || !set_cloexec_nonblock(control->fd)) {
+		swaybg_log_errno(LOG_ERROR, "Failed to create control socket");
+		goto error;
+	}
+	if (bind(control->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		if (errno != EADDRINUSE || socket_in_use(&addr)) {
+			swaybg_log_errno(LOG_ERROR, "Failed to bind control socket %s",
+				control->path);
+			goto error;
+		}
+		// Left behind by a process which did not exit cleanly
+		unlink(control->path);
+		if (bind(control->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+			swaybg_log_errno(LOG_ERROR, "Failed to bind control socket %s",
+				control->path);
+			goto error;
+		}
+	}
+	if (listen(control->fd, CONTROL_MAX_CLIENTS) != 0) {
+		swaybg_log_errno(LOG_ERROR, "Failed to listen on %s", control->path);
+		unlink(control->path);
+		goto error;
+	}
+	swaybg_log(LOG_DEBUG, "Listening for commands on %s", control->path);
+	return true;
+
+error:
+	if (control->fd >= 0) {
+		close(control->fd);
+		control->fd = -1;
+	}
+	free(control->path);
+	control->path = NULL;
+	return false;
+}
+
+static void close_client(struct control_client *client) {
+	close(client->fd);
+	client->fd = -1;
+	client->len = 0;
+	client->watching = false;
+	client->n_filters = 0;
+}
+
+void control_finish(struct control *control) {
+	for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+		if (control->clients[i].fd >= 0) {
+			close_client(&control->clients[i]);
+		}
+	}
+	if (control->fd >= 0) {
+		close(control->fd);
+		unlink(control->path);
+		control->fd = -1;
+	}
+	free(control->path);
+	control->path = NULL;
+}
+
+int control_get_pollfds(struct control *control, struct pollfd *fds) {
+	if (control->fd < 0) {
+		return 0;
+	}
+	int n = 0;
+	fds[n++] = (struct pollfd){ .fd = control->fd, .events = POLLIN };
+	for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+		if (control->clients[i].fd >= 0) {
+			// Watching clients are only polled for hangups, as they may
+			// have shut down their end already
+			fds[n++] = (struct pollfd){
+				.fd = control->clients[i].fd,
+				.events = control->clients[i].watching ? 0 : POLLIN,
+			};
+		}
+	}
+	return n;
+}
+
+// Whether a failed send can be tried again
+static bool can_retry_send(int fd) {
+	if (errno == EINTR) {
+		return true;
+	}
+	if (errno != EAGAIN && errno != EWOULDBLOCK) {
+		return false;
+	}
+	struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+	// Don't let a stuck client block the animation for long
+	return poll(&pfd, 1, 100) > 0;
+}
+
+// Clients may be gone by the time the reply is written, which must not raise
+// SIGPIPE
+static bool write_all(int fd, const char *data, size_t size) {
+	while (size > 0) {
+		ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (can_retry_send(fd)) {
+				continue;
+			}
+			return false;
+		}
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+// Write the reply, with the first chunk carrying the file descriptor if any,
+// return whether all of it went out
+static bool send_reply(int fd, const char *data, size_t size, int pass_fd) {
+	if (pass_fd >= 0 && size > 0) {
+		char control[CMSG_SPACE(sizeof(int))] = {0};
+		struct iovec iov = { .iov_base = (void *)data, .iov_len = size };
+		struct msghdr msg = {
+			.msg_iov = &iov,
+			.msg_iovlen = 1,
+			.msg_control = control,
+			.msg_controllen = sizeof(control),
+		};
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &pass_fd, sizeof(int));
+		ssize_t n;
+		while ((n = sendmsg(fd, &msg, MSG_NOSIGNAL)) < 0) {
+			if (!can_retry_send(fd)) {
+				return false;
+			}
+		}
+		data += n;
+		size -= n;
+	}
+	return write_all(fd, data, size);
+}
+
+void control_reply_fd(struct control *control, int fd) {
+	if (control->reply_fd >= 0) {
+		close(control->reply_fd);
+	}
+	control->reply_fd = fd;
+}
+
+void control_watch(struct control *control) {
+	control->current->watching = true;
+}
+
+void control_notify(struct control *control, control_filter match,
+		void *data, const char *line) {
+	size_t len = strlen(line);
+	for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+		struct control_client *client = &control->clients[i];
+		if (client->fd < 0 || !client->watching) {
+			continue;
+		}
+		bool matched = client->n_filters == 0;
+		for (int j = 0; !matched && j < client->n_filters; j++) {
+			matched = match(data, client->filters[j]);
+		}
+		if (!matched) {
+			continue;
+		}
+		// Never wait for a watcher, and never send it half a line
+		ssize_t n = send(client->fd, line, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (n != (ssize_t)len) {
+			swaybg_log(LOG_DEBUG, "Dropping a control client which does "
+				"not keep up with events");
+			close_client(client);
+		}
+	}
+}
+
+// Run the command in the line buffer of the client and reply, return false
+// if the reply could not be sent
+static bool run_command(struct control *control,
+		struct control_client *client) {
+	client->line[client->len] = '\0';
+	char *argv[CONTROL_MAX_ARGS + 1];
+	int argc = 0;
+	char *save = NULL;
+	for (char *word = strtok_r(client->line, " \t\r\n", &save); word;
+			word = strtok_r(NULL, " \t\r\n", &save)) {
+		if (argc == CONTROL_MAX_ARGS) {
+			break;
+		}
+		argv[argc++] = word;
+	}
+	argv[argc] = NULL;
+
+	char *reply = NULL;
+	size_t reply_len = 0;
+	FILE *f = open_memstream(&reply, &reply_len);
+	if (!f) {
+		return false;
+	}
+	control->current = client;
+	control->reply_fd = -1;
+	if (argc == 0) {
+		fprintf(f, "error: empty command\n");
+	} else {
+		control->handler(control->data, argc, argv, f);
+	}
+	fclose(f);
+	bool sent = send_reply(client->fd, reply, reply_len, control->reply_fd);
+	free(reply);
+	control_reply_fd(control, -1);
+	control->current = NULL;
+	if (client->watching) {
+		// The arguments stay in the line buffer, which is not used anymore
+		client->n_filters = argc - 1;
+		memcpy(client->filters, argv + 1,
+			client->n_filters * sizeof(client->filters[0]));
+	}
+	return sent;
+}
+
+static void accept_clients(struct control *control) {
+	int fd;
+	while ((fd = accept(control->fd, NULL, NULL)) >= 0) {
+		struct control_client *client = NULL;
+		for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+			if (control->clients[i].fd < 0) {
+				client = &control->clients[i];
+				break;
+			}
+		}
+		if (!client || !set_cloexec_nonblock(fd)) {
+			close(fd);
+			continue;
+		}
+		client->fd = fd;
+		client->len = 0;
+	}
+}
+
+static void read_client(struct control *control,
+		struct control_client *client) {
+	ssize_t n = read(client->fd, client->line + client->len,
+		sizeof(client->line) - 1 - client->len);
+	if (n < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+			close_client(client);
+		}
+		return;
+	}
+	client->len += n;
+	// Run the command once it is complete, the client closed its end or
+	// the line is as long as it gets
+	if (n == 0 || memchr(client->line, '\n', client->len) ||
+			client->len == sizeof(client->line) - 1) {
+		// Clients which did not get the whole reply see it end, rather
+		// than waiting for the rest
+		if (!run_command(control, client) || !client->watching) {
+			close_client(client);
+		}
+	}
+}
+
+void control_dispatch(struct control *control, const struct pollfd *fds,
+		int nfds) {
+	for (int i = 0; i < nfds; i++) {
+		if (!fds[i].revents) {
+			continue;
+		}
+		if (fds[i].fd == control->fd) {
+			accept_clients(control);
+			continue;
+		}
+		for (int j = 0; j < CONTROL_MAX_CLIENTS; j++) {
+			struct control_client *client = &control->clients[j];
+			if (client->fd != fds[i].fd) {
+				continue;
+			}
+			if (client->watching) {
+				// Gone
+				close_client(client);
+			} else {
+				read_client(control, client);
+			}
+			break;
+		}
+	}
+}
+
+int control_client_main(int argc, char **argv) {
+	if (argc < 2) {
+		fprintf(stderr, "Usage: swaybg ctl <command> [<args>...]\n"
+			"\n"
+			"Commands:\n"
+			"  pause [<output>...]    Stop animating, keep the current frame.\n"
+			"  resume [<output>...]   Continue animating.\n"
+			"  freeze [<output>...]   Show the background without traces and\n"
+			"                         stop animating.\n"
+			"  rate [<steps>]         Show or set the steps per minute.\n"
+			"  seek <step> [<output>...]\n"
+			"                         Jump to a step of a replayed walk.\n"
+			"  stats                  Show frame statistics per output.\n"
+			"  frame <output>         Show the size and format of the current\n"
+			"                         frame, whose buffer is passed along.\n"
+			"  watch [<output>...]    Print a line for every new frame.\n");
+		return EXIT_FAILURE;
+	}
+
+	char line[CONTROL_MAX_LINE];
+	size_t len = 0;
+	for (int i = 1; i < argc; i++) {
+		int n = snprintf(line + len, sizeof(line) - len, "%s%s",
+			argv[i], i + 1 < argc ? " " : "\n");
+		if (n < 0 || (size_t)n >= sizeof(line) - len) {
+			fprintf(stderr, "Command too long\n");
+			return EXIT_FAILURE;
+		}
+		len += n;
+	}
+
+	char *path = control_get_socket_path();
+	struct sockaddr_un addr;
+	if (!path || !get_socket_addr(path, &addr)) {
+		fprintf(stderr, "Unable to determine the swaybg socket path, "
+			"set SWAYBG_SOCK\n");
+		free(path);
+		return EXIT_FAILURE;
+	}
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		fprintf(stderr, "Unable to connect to %s: %s\n", path, strerror(errno));
+		free(path);
+		return EXIT_FAILURE;
+	}
+	free(path);
+
+	write_all(fd, line, len);
+	shutdown(fd, SHUT_WR);
+
+	int ret = EXIT_SUCCESS;
+	bool first = true;
+	char buf[4096];
+	ssize_t n;
+	while ((n = read(fd, buf, sizeof(buf))) > 0) {
+		if (first && strncmp(buf, "error", n < 5 ? n : 5) == 0) {
+			ret = EXIT_FAILURE;
+		}
+		first = false;
+		fwrite(buf, 1, n, ret == EXIT_SUCCESS ? stdout : stderr);
+	}
+	close(fd);
+	return ret;
+}
@@ -0,0 +1,72 @@
+#include <string.h>
+#include "damage.h"
+
+void damage_clear(struct damage *damage) {
+	damage->full = false;
+	damage->n_rects = 0;
+}
+
+void damage_set_full(struct damage *damage) {
+	damage->full = true;
+	damage->n_rects = 0;
+}
+
+bool damage_clip_rect(struct damage_rect *rect, int width, int height) {
+	if (rect->x < 0) {
+		rect->width += rect->x;
+		rect->x = 0;
+	}
+	if (rect->y < 0) {
+		rect->height += rect->y;
+		rect->y = 0;
+	}
+	if (rect->x + rect->width > width) {
+		rect->width = width - rect->x;
+	}
+	if (rect->y + rect->height > height) {
+		rect->height = height - rect->y;
+	}
+	return rect->width > 0 && rect->height > 0;
+}
+
+void damage_add_rect(struct damage *damage, struct damage_rect rect,
+		int width, int height) {
+	if (damage->full || !damage_clip_rect(&rect, width, height)) {
+		return;
+	}
+	if (damage->n_rects == DAMAGE_MAX_RECTS) {
+		damage_set_full(damage);
+		return;
+	}
+	damage->rects[damage->n_rects++] = rect;
+}
+
+void damage_add(struct damage *damage, const struct damage *other) {
+	if (other->full) {
+		damage_set_full(damage);
+		return;
+	}
+	for (int i = 0; i < other->n_rects; i++) {
+		// Already clipped
+		damage_add_rect(damage, other->rects[i], INT32_MAX, INT32_MAX);
+	}
+}
+
+void damage_copy(const struct damage *damage, uint8_t *dst,
+		const uint8_t *src, int stride, int height) {
+	if (damage->full) {
+		memcpy(dst, src, (size_t)stride * height);
+		return;
+	}
+	// Overlapping rectangles get copied twice, which is cheaper than
+	// computing their union for the handful of footprints there are
+	for (int i = 0; i < damage->n_rects; i++) {
+		const struct damage_rect *r = &damage->rects[i];
+		size_t offset = (size_t)r->y * stride + (size_t)r->x * 4;
+		size_t len = (size_t)r->width * 4;
+		for (int y = 0; y < r->height; y++) {
+			memcpy(dst + offset, src + offset, len);
+			offset += stride;
+		}
+	}
+}
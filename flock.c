@@ -0,0 +1,254 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "flock.h"
+
+// Neighbors looked at per bird and step, which keeps the cost of a step
+// linear in the number of birds however crowded they get
+#define FLOCK_MAX_NEIGHBORS 16
+
+static int clamp(int v, int min, int max) {
+	return v < min ? min : v > max ? max : v;
+}
+
+static int get_cell(const struct flock *flock, const struct anim_context *bird) {
+	int col = clamp(bird->nxt_x / flock->cell_size, 0, flock->cols - 1);
+	int row = clamp(bird->nxt_y / flock->cell_size, 0, flock->rows - 1);
+	return row * flock->cols + col;
+}
+
+static void grid_insert(struct flock *flock, int i, int cell) {
+	flock->cell[i] = cell;
+	flock->prev[i] = -1;
+	flock->next[i] = flock->head[cell];
+	if (flock->head[cell] >= 0) {
+		flock->prev[flock->head[cell]] = i;
+	}
+	flock->head[cell] = i;
+}
+
+static void grid_remove(struct flock *flock, int i) {
+	if (flock->prev[i] >= 0) {
+		flock->next[flock->prev[i]] = flock->next[i];
+	} else {
+		flock->head[flock->cell[i]] = flock->next[i];
+	}
+	if (flock->next[i] >= 0) {
+		flock->prev[flock->next[i]] = flock->prev[i];
+	}
+	flock->cell[i] = -1;
+}
+
+static bool grid_build(struct flock *flock, int width, int height) {
+	int cols = width / flock->cell_size + 1;
+	int rows = height / flock->cell_size + 1;
+	int *head = malloc((size_t)cols * rows * sizeof(int));
+	if (!head) {
+		return false;
+	}
+	free(flock->head);
+	flock->head = head;
+	flock->cols = cols;
+	flock->rows = rows;
+	flock->width = width;
+	flock->height = height;
+	for (int c = 0; c < cols * rows; c++) {
+		head[c] = -1;
+	}
+	for (int i = 0; i < flock->count; i++) {
+		flock->cell[i] = -1;
+		if (flock->birds[i]) {
+			grid_insert(flock, i, get_cell(flock, flock->birds[i]));
+		}
+	}
+	return true;
+}
+
+struct flock *flock_create(const struct anim_config *cf, int count,
+		int width, int height) {
+	struct flock *flock = calloc(1, sizeof(struct flock));
+	if (!flock) {
+		return NULL;
+	}
+	flock->count = count;
+	flock->cf = *cf;
+	// Birds move by up to max_velocity per step
+	flock->cell_size = 2 * cf->max_velocity;
+	flock->birds = calloc(count, sizeof(*flock->birds));
+	flock->next = calloc(count, sizeof(int));
+	flock->prev = calloc(count, sizeof(int));
+	flock->cell = calloc(count, sizeof(int));
+	if (!flock->birds || !flock->next || !flock->prev || !flock->cell) {
+		flock_destroy(flock);
+		return NULL;
+	}
+	for (int i = 0; i < count; i++) {
+		flock->birds[i] = anim_create(cf, width, height);
+	}
+	if (!grid_build(flock, width, height)) {
+		flock_destroy(flock);
+		return NULL;
+	}
+	return flock;
+}
+
+struct steering {
+	float x, y;		// where the bird heads to
+	float ahead_x, ahead_y;	// and one more step further
+	float away_x, away_y;	// sum of the pushes away from close paths
+	float sum_x, sum_y;	// sum of the neighbor positions
+	int neighbors;
+};
+
+static void add_neighbor(struct steering *st, const struct anim_context *other,
+		float radius) {
+	float x = other->nxt_x, y = other->nxt_y;
+	float dx = st->x - x, dy = st->y - y;
+	if (dx * dx + dy * dy >= radius * radius) {
+		return;
+	}
+	st->sum_x += x;
+	st->sum_y += y;
+	st->neighbors++;
+
+	// Compare where both are about to step rather than where they are,
+	// so that paths about to cross push the birds apart
+	float ax = st->ahead_x - (2 * other->nxt_x - other->cur_x);
+	float ay = st->ahead_y - (2 * other->nxt_y - other->cur_y);
+	float dist = sqrtf(ax * ax + ay * ay);
+	float close = radius / 2;
+	if (dist >= close) {
+		return;
+	}
+	if (dist < 1) {
+		ax = 1;
+		ay = 0;
+		dist = 1;
+	}
+	float weight = (close - dist) / close;
+	st->away_x += ax / dist * weight;
+	st->away_y += ay / dist * weight;
+}
+
+// Acceleration steering bird i away from the paths of its close neighbors,
+// and a little towards the middle of all of them
+static void get_steering(const struct flock *flock, int i,
+		const struct anim_context *lead, int *ax, int *ay) {
+	const struct anim_context *bird = flock->birds[i];
+	struct steering st = {
+		.x = bird->nxt_x,
+		.y = bird->nxt_y,
+		.ahead_x = 2 * bird->nxt_x - bird->cur_x,
+		.ahead_y = 2 * bird->nxt_y - bird->cur_y,
+	};
+	float radius = flock->cell_size;
+	int col = flock->cell[i] % flock->cols;
+	int row = flock->cell[i] / flock->cols;
+	int seen = 0;
+	for (int r = row - 1; r <= row + 1; r++) {
+		for (int c = col - 1; c <= col + 1; c++) {
+			if (r < 0 || r >= flock->rows || c < 0 || c >= flock->cols) {
+				continue;
+			}
+			int j = flock->head[r * flock->cols + c];
+			for (; j >= 0 && seen < FLOCK_MAX_NEIGHBORS; j = flock->next[j]) {
+				if (j != i) {
+					add_neighbor(&st, flock->birds[j], radius);
+					seen++;
+				}
+			}
+		}
+	}
+	if (lead) {
+		add_neighbor(&st, lead, radius);
+	}
+
+	const struct anim_config *cf = &bird->cf;
+	float steer_x = st.away_x * cf->max_accel;
+	float steer_y = st.away_y * cf->max_accel;
+	if (st.neighbors > 0) {
+		steer_x += (st.sum_x / st.neighbors - st.x) / radius * cf->max_accel / 4;
+		steer_y += (st.sum_y / st.neighbors - st.y) / radius * cf->max_accel / 4;
+	}
+	// Leave room for the random part of the acceleration
+	*ax = clamp(lroundf(steer_x), cf->min_accel / 2, cf->max_accel / 2);
+	*ay = clamp(lroundf(steer_y), cf->min_accel / 2, cf->max_accel / 2);
+}
+
+void flock_step(struct flock *flock, const struct anim_context *lead,
+		int width, int height) {
+	if ((width != flock->width || height != flock->height) &&
+			!grid_build(flock, width, height)) {
+		return;
+	}
+	for (int i = 0; i < flock->count; i++) {
+		struct anim_context *bird = flock->birds[i];
+		if (!bird) {
+			bird = anim_create(&flock->cf, width, height);
+		} else {
+			int ax, ay;
+			get_steering(flock, i, lead, &ax, &ay);
+			bird = anim_step_steered(bird, width, height, ax, ay);
+		}
+		flock->birds[i] = bird;
+
+		int cell = bird ? get_cell(flock, bird) : -1;
+		if (cell == flock->cell[i]) {
+			continue;
+		}
+		if (flock->cell[i] >= 0) {
+			grid_remove(flock, i);
+		}
+		if (cell >= 0) {
+			grid_insert(flock, i, cell);
+		}
+	}
+}
+
+void flock_rescale(struct flock *flock, int from_width, int from_height,
+		int to_width, int to_height) {
+	for (int i = 0; i < flock->count; i++) {
+		if (flock->birds[i]) {
+			anim_rescale(flock->birds[i], from_width, from_height,
+				to_width, to_height);
+		}
+	}
+	// Rebuilt on the next step if this fails
+	grid_build(flock, to_width, to_height);
+}
+
+void flock_draw(struct flock *flock, cairo_t *cr, int decay_levels,
+		const struct anim_view *view) {
+	for (int i = 0; i < flock->count; i++) {
+		if (flock->birds[i]) {
+			flock->birds[i]->decay_levels = decay_levels;
+			anim_draw_view(cr, flock->birds[i], view);
+		}
+	}
+}
+
+void flock_damage(const struct flock *flock, struct damage *damage,
+		const struct anim_view *view) {
+	for (int i = 0; i < flock->count; i++) {
+		if (flock->birds[i]) {
+			anim_damage_view(flock->birds[i], view, damage);
+		}
+	}
+}
+
+void flock_destroy(struct flock *flock) {
+	if (!flock) {
+		return;
+	}
+	if (flock->birds) {
+		for (int i = 0; i < flock->count; i++) {
+			anim_done(flock->birds[i]);
+		}
+	}
+	free(flock->birds);
+	free(flock->next);
+	free(flock->prev);
+	free(flock->cell);
+	free(flock->head);
+	free(flock);
+}
@@ -0,0 +1,295 @@
+#include <ctype.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "glyph.h"
+#include "log.h"
+
+// Line segments every curve is flattened into
+#define CURVE_SEGMENTS 8
+#define MAX_FILE_SIZE (64 * 1024)
+
+struct glyph_builder {
+	int n_vertices, n_paths;
+	float x[GLYPH_MAX_VERTICES], y[GLYPH_MAX_VERTICES];
+	int path_end[GLYPH_MAX_VERTICES];
+	int path_start;		// first vertex of the current polyline
+	float cx, cy;		// current point
+	float sx, sy;		// start of the current subpath, for Z
+};
+
+static bool add_vertex(struct glyph_builder *b, float x, float y) {
+	if (b->n_vertices == GLYPH_MAX_VERTICES) {
+		return false;
+	}
+	b->x[b->n_vertices] = x;
+	b->y[b->n_vertices] = y;
+	b->n_vertices++;
+	b->cx = x;
+	b->cy = y;
+	return true;
+}
+
+// Keep the current polyline if it has a segment at all
+static void end_path(struct glyph_builder *b) {
+	if (b->n_vertices - b->path_start >= 2) {
+		b->path_end[b->n_paths++] = b->n_vertices;
+	} else {
+		b->n_vertices = b->path_start;
+	}
+	b->path_start = b->n_vertices;
+}
+
+static bool move_to(struct glyph_builder *b, float x, float y) {
+	end_path(b);
+	b->sx = x;
+	b->sy = y;
+	return add_vertex(b, x, y);
+}
+
+static bool line_to(struct glyph_builder *b, float x, float y) {
+	// Drawing on after Z starts from the start of the closed subpath
+	if (b->n_vertices == b->path_start &&
+			!add_vertex(b, b->cx, b->cy)) {
+		return false;
+	}
+	return add_vertex(b, x, y);
+}
+
+static bool quad_to(struct glyph_builder *b, float x1, float y1,
+		float x, float y) {
+	float x0 = b->cx, y0 = b->cy;
+	for (int i = 1; i <= CURVE_SEGMENTS; i++) {
+		float t = (float)i / CURVE_SEGMENTS, u = 1 - t;
+		if (!line_to(b, u * u * x0 + 2 * u * t * x1 + t * t * x,
+				u * u * y0 + 2 * u * t * y1 + t * t * y)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool cubic_to(struct glyph_builder *b, float x1, float y1,
+		float x2, float y2, float x, float y) {
+	float x0 = b->cx, y0 = b->cy;
+	for (int i = 1; i <= CURVE_SEGMENTS; i++) {
+		float t = (float)i / CURVE_SEGMENTS, u = 1 - t;
+		float k0 = u * u * u, k1 = 3 * u * u * t, k2 = 3 * u * t * t,
+			k3 = t * t * t;
+		if (!line_to(b, k0 * x0 + k1 * x1 + k2 * x2 + k3 * x,
+				k0 * y0 + k1 * y1 + k2 * y2 + k3 * y)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool close_path(struct glyph_builder *b) {
+	if (b->n_vertices > b->path_start &&
+			(b->cx != b->sx || b->cy != b->sy) &&
+			!add_vertex(b, b->sx, b->sy)) {
+		return false;
+	}
+	end_path(b);
+	b->cx = b->sx;
+	b->cy = b->sy;
+	return true;
+}
+
+static const char *skip_separators(const char *p) {
+	while (isspace((unsigned char)*p) || *p == ',' || *p == '#') {
+		if (*p == '#') {
+			while (*p && *p != '\n') {
+				p++;
+			}
+		} else {
+			p++;
+		}
+	}
+	return p;
+}
+
+static bool parse_numbers(const char **p, float *v, int n) {
+	for (int i = 0; i < n; i++) {
+		const char *start = skip_separators(*p);
+		char *end;
+		v[i] = strtof(start, &end);
+		if (end == start || !isfinite(v[i])) {
+			return false;
+		}
+		*p = end;
+	}
+	return true;
+}
+
+// Scale the vertices to a reach of 1 and pack them into one allocation
+static struct glyph *build_glyph(const struct glyph_builder *b) {
+	float reach = 0;
+	for (int i = 0; i < b->n_vertices; i++) {
+		reach = fmaxf(reach, hypotf(b->x[i], b->y[i]));
+	}
+	if (b->n_paths == 0 || reach == 0) {
+		return NULL;
+	}
+
+	int n = b->n_vertices;
+	struct glyph *glyph = malloc(sizeof(struct glyph) +
+		2 * n * sizeof(float) + b->n_paths * sizeof(int));
+	if (!glyph) {
+		return NULL;
+	}
+	glyph->n_vertices = n;
+	glyph->n_paths = b->n_paths;
+	glyph->x = (float *)&glyph[1];
+	glyph->y = glyph->x + n;
+	glyph->path_end = (int *)(glyph->y + n);
+	glyph->x0 = glyph->y0 = INFINITY;
+	glyph->x1 = glyph->y1 = -INFINITY;
+	for (int i = 0; i < n; i++) {
+		float x = b->x[i] / reach, y = b->y[i] / reach;
+		glyph->x[i] = x;
+		glyph->y[i] = y;
+		glyph->x0 = fminf(glyph->x0, x);
+		glyph->y0 = fminf(glyph->y0, y);
+		glyph->x1 = fmaxf(glyph->x1, x);
+		glyph->y1 = fmaxf(glyph->y1, y);
+	}
+	for (int i = 0; i < b->n_paths; i++) {
+		glyph->path_end[i] = b->path_end[i];
+	}
+	return glyph;
+}
+
+struct glyph *glyph_parse(const char *data, const char *name) {
+	struct glyph_builder *b = calloc(1, sizeof(struct glyph_builder));
+	if (!b) {
+		return NULL;
+	}
+
+	const char *error = NULL;
+	const char *p = data;
+	char cmd = 0;
+	while (!error) {
+		p = skip_separators(p);
+		if (*p == '\0') {
+			break;
+		}
+		if (isalpha((unsigned char)*p)) {
+			cmd = *p++;
+		} else if (!cmd) {
+			error = "expected a command";
+			break;
+		}
+
+		// Coordinates of the lowercase commands are relative
+		bool rel = islower((unsigned char)cmd);
+		float ox = rel ? b->cx : 0, oy = rel ? b->cy : 0;
+		float v[6];
+		bool ok = true;
+		switch (toupper((unsigned char)cmd)) {
+		case 'M':
+			if (!parse_numbers(&p, v, 2)) {
+				error = "expected coordinates";
+				break;
+			}
+			ok = move_to(b, ox + v[0], oy + v[1]);
+			// Further coordinate pairs are lines
+			cmd = rel ? 'l' : 'L';
+			break;
+		case 'L':
+			if (!parse_numbers(&p, v, 2)) {
+				error = "expected coordinates";
+				break;
+			}
+			ok = line_to(b, ox + v[0], oy + v[1]);
+			break;
+		case 'H':
+			if (!parse_numbers(&p, v, 1)) {
+				error = "expected a coordinate";
+				break;
+			}
+			ok = line_to(b, ox + v[0], b->cy);
+			break;
+		case 'V':
+			if (!parse_numbers(&p, v, 1)) {
+				error = "expected a coordinate";
+				break;
+			}
+			ok = line_to(b, b->cx, oy + v[0]);
+			break;
+		case 'Q':
+			if (!parse_numbers(&p, v, 4)) {
+				error = "expected coordinates";
+				break;
+			}
+			ok = quad_to(b, ox + v[0], oy + v[1], ox + v[2], oy + v[3]);
+			break;
+		case 'C':
+			if (!parse_numbers(&p, v, 6)) {
+				error = "expected coordinates";
+				break;
+			}
+			ok = cubic_to(b, ox + v[0], oy + v[1], ox + v[2], oy + v[3],
+				ox + v[4], oy + v[5]);
+			break;
+		case 'Z':
+			ok = close_path(b);
+			// Numbers may not follow
+			cmd = 0;
+			break;
+		default:
+			error = "unsupported command";
+			break;
+		}
+		if (!error && !ok) {
+			error = "too many vertices";
+		}
+	}
+	end_path(b);
+
+	struct glyph *glyph = NULL;
+	if (error) {
+		swaybg_log(LOG_ERROR, "Invalid footprint %s: %s at offset %ld",
+			name, error, (long)(p - data));
+	} else {
+		glyph = build_glyph(b);
+		if (!glyph) {
+			swaybg_log(LOG_ERROR, "Footprint %s has no lines", name);
+		}
+	}
+	free(b);
+	return glyph;
+}
+
+struct glyph *glyph_load(const char *path) {
+	FILE *f = fopen(path, "re");
+	if (!f) {
+		swaybg_log_errno(LOG_ERROR, "Failed to open footprint %s", path);
+		return NULL;
+	}
+	char *data = malloc(MAX_FILE_SIZE + 1);
+	size_t size = data ? fread(data, 1, MAX_FILE_SIZE + 1, f) : 0;
+	bool failed = ferror(f);
+	fclose(f);
+	if (!data || failed) {
+		swaybg_log(LOG_ERROR, "Failed to read footprint %s", path);
+		free(data);
+		return NULL;
+	}
+	if (size > MAX_FILE_SIZE) {
+		swaybg_log(LOG_ERROR, "Footprint %s is larger than %d bytes",
+			path, MAX_FILE_SIZE);
+		free(data);
+		return NULL;
+	}
+	data[size] = '\0';
+
+	struct glyph *glyph = glyph_parse(data, path);
+	free(data);
+	return glyph;
+}
+
+void glyph_destroy(struct glyph *glyph) {
+	free(glyph);
+}
@@ -0,0 +1,62 @@
+#include <limits.h>
+#include "governor.h"
+
+// Frames in a row over budget before lowering the quality, and well below
+// it before raising the quality again
+#define GOVERNOR_DOWN_FRAMES 3
+#define GOVERNOR_UP_FRAMES 30
+// Raise the quality only while frames take less than this part of the budget
+#define GOVERNOR_HEADROOM_DIV 3
+// Frames to average before deciding anything after a level change
+#define GOVERNOR_SETTLE_FRAMES 4
+
+static const struct governor_quality levels[] = {
+	{ "full", CAIRO_ANTIALIAS_DEFAULT, INT_MAX, 1 },
+	{ "fast-antialias", CAIRO_ANTIALIAS_FAST, INT_MAX, 1 },
+	{ "fewer-fades", CAIRO_ANTIALIAS_FAST, 2, 1 },
+	{ "no-antialias", CAIRO_ANTIALIAS_NONE, 0, 1 },
+	{ "half-scale", CAIRO_ANTIALIAS_NONE, 0, 2 },
+};
+
+#define GOVERNOR_LEVELS (int)(sizeof(levels) / sizeof(levels[0]))
+
+void governor_init(struct governor *gov) {
+	*gov = (struct governor){0};
+}
+
+const struct governor_quality *governor_get_quality(const struct governor *gov) {
+	return &levels[gov->level];
+}
+
+static void set_level(struct governor *gov, int level) {
+	*gov = (struct governor){ .level = level };
+}
+
+bool governor_sample(struct governor *gov, uint64_t frame_ns,
+		uint64_t budget_ns) {
+	gov->avg_ns = gov->samples == 0 ? frame_ns :
+		(gov->avg_ns * 7 + frame_ns) / 8;
+	if (++gov->samples < GOVERNOR_SETTLE_FRAMES) {
+		return false;
+	}
+
+	if (gov->avg_ns > budget_ns) {
+		gov->over++;
+		gov->under = 0;
+	} else if (gov->avg_ns < budget_ns / GOVERNOR_HEADROOM_DIV) {
+		gov->under++;
+		gov->over = 0;
+	} else {
+		gov->over = gov->under = 0;
+	}
+
+	if (gov->over >= GOVERNOR_DOWN_FRAMES && gov->level + 1 < GOVERNOR_LEVELS) {
+		set_level(gov, gov->level + 1);
+		return true;
+	}
+	if (gov->under >= GOVERNOR_UP_FRAMES && gov->level > 0) {
+		set_level(gov, gov->level - 1);
+		return true;
+	}
+	return false;
+}
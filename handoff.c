@@ -0,0 +1,290 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "handoff.h"
+#include "log.h"
+
+// Copies torn by the publisher before giving up until the next frame
+#define HANDOFF_READ_ATTEMPTS 64
+// Reads without a new state before checking that the publisher still runs
+#define HANDOFF_STALLED_READS 8
+
+// Segment names live in a namespace shared by all users
+static char *get_segment_name(const char *key, const char *output_name) {
+	const char *fmt = "/swaybg-%u-%s-%s";
+	int size = snprintf(NULL, 0, fmt, (unsigned)getuid(), key, output_name);
+	char *name = malloc(size + 1);
+	if (!name) {
+		return NULL;
+	}
+	snprintf(name, size + 1, fmt, (unsigned)getuid(), key, output_name);
+	// Only the leading slash is allowed
+	for (char *c = name + 1; *c; c++) {
+		if (*c == '/') {
+			*c = '_';
+		}
+	}
+	return name;
+}
+
+static size_t get_segment_size(const struct anim_config *cf) {
+	return sizeof(struct handoff_state) +
+		(size_t)cf->total_traces * sizeof(struct trace);
+}
+
+static bool is_publisher_alive(const struct handoff_state *state) {
+	return kill(state->pid, 0) == 0 || errno == EPERM;
+}
+
+// Mark the segment of a previous publisher closed, for the instances
+// attached to it to stop following it
+static void close_segment(const char *name) {
+	int fd = shm_open(name, O_RDWR | O_CLOEXEC, 0);
+	if (fd < 0) {
+		return;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct handoff_state)) {
+		close(fd);
+		return;
+	}
+	struct handoff_state *state = mmap(NULL, sizeof(struct handoff_state),
+		PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (state == MAP_FAILED) {
+		return;
+	}
+	if (memcmp(state->magic, HANDOFF_MAGIC, sizeof(state->magic)) == 0) {
+		atomic_store_explicit(&state->closed, true, memory_order_release);
+	}
+	munmap(state, sizeof(struct handoff_state));
+}
+
+struct handoff_publisher *handoff_publish(const char *key,
+		const char *output_name, const struct anim_config *cf) {
+	struct handoff_publisher *pub = calloc(1, sizeof(struct handoff_publisher));
+	if (!pub) {
+		return NULL;
+	}
+	pub->name = get_segment_name(key, output_name);
+	pub->size = get_segment_size(cf);
+	if (!pub->name) {
+		free(pub);
+		return NULL;
+	}
+
+	// Readers of a previous segment keep their mapping, which must not
+	// shrink under them, so always start from a new one
+	close_segment(pub->name);
+	shm_unlink(pub->name);
+	int fd = shm_open(pub->name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		swaybg_log_errno(LOG_ERROR, "Failed to create %s", pub->name);
+		goto error;
+	}
+	if (ftruncate(fd, pub->size) != 0) {
+		swaybg_log_errno(LOG_ERROR, "Failed to resize %s", pub->name);
+		close(fd);
+		shm_unlink(pub->name);
+		goto error;
+	}
+	struct handoff_state *state = mmap(NULL, pub->size,
+		PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (state == MAP_FAILED) {
+		swaybg_log_errno(LOG_ERROR, "Failed to map %s", pub->name);
+		shm_unlink(pub->name);
+		goto error;
+	}
+
+	state->version = HANDOFF_VERSION;
+	state->pid = getpid();
+	atomic_init(&state->seq, 0);
+	atomic_init(&state->closed, false);
+	state->cf = *cf;
+	// Readers only look at a segment with the magic in place
+	atomic_thread_fence(memory_order_release);
+	memcpy(state->magic, HANDOFF_MAGIC, sizeof(state->magic));
+	pub->state = state;
+	swaybg_log(LOG_DEBUG, "Publishing the animation as %s", pub->name);
+	return pub;
+
+error:
+	free(pub->name);
+	free(pub);
+	return NULL;
+}
+
+bool handoff_update(struct handoff_publisher *pub,
+		const struct anim_context *actx, int width, int height) {
+	struct handoff_state *state = pub->state;
+	if (memcmp(&actx->cf, &state->cf, sizeof(state->cf)) != 0) {
+		return false;
+	}
+	unsigned seq = atomic_load_explicit(&state->seq, memory_order_relaxed);
+	atomic_store_explicit(&state->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	state->width = width;
+	state->height = height;
+	state->cur_x = actx->cur_x;
+	state->cur_y = actx->cur_y;
+	state->nxt_x = actx->nxt_x;
+	state->nxt_y = actx->nxt_y;
+	state->nxt_foot = actx->nxt_foot;
+	state->nxt_pos = actx->nxt_pos;
+	memcpy(state->traces, actx->traces,
+		(size_t)state->cf.total_traces * sizeof(struct trace));
+
+	atomic_store_explicit(&state->seq, seq + 2, memory_order_release);
+	return true;
+}
+
+void handoff_unpublish(struct handoff_publisher *pub) {
+	if (!pub) {
+		return;
+	}
+	atomic_store_explicit(&pub->state->closed, true, memory_order_release);
+	munmap(pub->state, pub->size);
+	shm_unlink(pub->name);
+	free(pub->name);
+	free(pub);
+}
+
+static bool check_state(const struct handoff_state *state, size_t size) {
+	if (memcmp(state->magic, HANDOFF_MAGIC, sizeof(state->magic)) != 0) {
+		return false;
+	}
+	atomic_thread_fence(memory_order_acquire);
+	if (state->version != HANDOFF_VERSION || state->cf.total_traces <= 0 ||
+			size < get_segment_size(&state->cf) ||
+			atomic_load_explicit(&state->closed, memory_order_acquire)) {
+		return false;
+	}
+	// Left behind by a publisher which got killed
+	return is_publisher_alive(state);
+}
+
+struct handoff_subscriber *handoff_attach(const char *key,
+		const char *output_name) {
+	char *name = get_segment_name(key, output_name);
+	if (!name) {
+		return NULL;
+	}
+	int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+	free(name);
+	if (fd < 0) {
+		return NULL;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct handoff_state)) {
+		close(fd);
+		return NULL;
+	}
+	size_t size = st.st_size;
+	struct handoff_state *state = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (state == MAP_FAILED) {
+		return NULL;
+	}
+	struct handoff_subscriber *sub = NULL;
+	if (check_state(state, size)) {
+		sub = calloc(1, sizeof(struct handoff_subscriber));
+	}
+	if (!sub) {
+		munmap(state, size);
+		return NULL;
+	}
+	sub->state = state;
+	sub->size = size;
+	sub->last_seq = atomic_load_explicit(&state->seq, memory_order_relaxed);
+	return sub;
+}
+
+static int scale(int v, int to, int from) {
+	return (int64_t)v * to / from;
+}
+
+bool handoff_read(struct handoff_subscriber *sub, struct anim_context **actx,
+		int width, int height) {
+	struct handoff_state *state = sub->state;
+	if (atomic_load_explicit(&state->closed, memory_order_acquire)) {
+		return false;
+	}
+	// A publisher which crashed or got killed never closes the segment, so
+	// check it is still there once it has not published for a while, as when
+	// paused
+	unsigned last_seq = atomic_load_explicit(&state->seq, memory_order_relaxed);
+	if (last_seq != sub->last_seq) {
+		sub->last_seq = last_seq;
+		sub->stalled_reads = 0;
+	} else if (++sub->stalled_reads >= HANDOFF_STALLED_READS) {
+		sub->stalled_reads = 0;
+		if (!is_publisher_alive(state)) {
+			return false;
+		}
+	}
+	struct anim_context *ctx = *actx;
+	if (!ctx || memcmp(&ctx->cf, &state->cf, sizeof(state->cf)) != 0) {
+		struct anim_context *fresh = anim_alloc(&state->cf);
+		if (!fresh) {
+			return true;
+		}
+		if (ctx) {
+			anim_done(ctx);
+		}
+		*actx = ctx = fresh;
+	}
+
+	for (int i = 0; i < HANDOFF_READ_ATTEMPTS; i++) {
+		unsigned seq = atomic_load_explicit(&state->seq, memory_order_acquire);
+		if (seq & 1) {
+			continue;
+		}
+		int src_width = state->width, src_height = state->height;
+		int cur_x = state->cur_x, cur_y = state->cur_y;
+		int nxt_x = state->nxt_x, nxt_y = state->nxt_y;
+		int nxt_foot = state->nxt_foot, nxt_pos = state->nxt_pos;
+		memcpy(ctx->traces, state->traces,
+			(size_t)ctx->cf.total_traces * sizeof(struct trace));
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&state->seq, memory_order_relaxed) != seq) {
+			continue;
+		}
+
+		if (src_width <= 0 || src_height <= 0) {
+			// Nothing published yet
+			ctx->nxt_pos = 0;
+			return true;
+		}
+		if (src_width != width || src_height != height) {
+			for (int j = 0; j < ctx->cf.total_traces; j++) {
+				ctx->traces[j].x = scale(ctx->traces[j].x, width, src_width);
+				ctx->traces[j].y = scale(ctx->traces[j].y, height, src_height);
+			}
+		}
+		ctx->cur_x = scale(cur_x, width, src_width);
+		ctx->cur_y = scale(cur_y, height, src_height);
+		ctx->nxt_x = scale(nxt_x, width, src_width);
+		ctx->nxt_y = scale(nxt_y, height, src_height);
+		ctx->nxt_foot = nxt_foot == BIRD_RIGHT ? BIRD_RIGHT : BIRD_LEFT;
+		ctx->nxt_pos = nxt_pos < 0 ? 0 : nxt_pos;
+		return true;
+	}
+	// Keep showing what was copied last, the next frame will catch up
+	return true;
+}
+
+void handoff_detach(struct handoff_subscriber *sub) {
+	if (!sub) {
+		return;
+	}
+	munmap(sub->state, sub->size);
+	free(sub);
+}
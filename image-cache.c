@@ -0,0 +1,267 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "image-cache.h"
+#include "log.h"
+
+#define IMAGE_CACHE_MAGIC "SWBGIMG1"
+#define IMAGE_CACHE_SUFFIX ".img"
+// Entries which have not been used for this long are removed
+#define IMAGE_CACHE_MAX_AGE (30 * 24 * 60 * 60)
+
+// Pixel data starts right after the header, which keeps it aligned
+#define IMAGE_CACHE_HEADER_SIZE 64
+
+struct image_cache_header {
+	char magic[8];
+	uint32_t format;	// cairo_format_t
+	int32_t width, height, stride;
+	uint64_t content_hash;
+};
+
+_Static_assert(sizeof(struct image_cache_header) <= IMAGE_CACHE_HEADER_SIZE,
+	"image cache header too large");
+
+static const cairo_user_data_key_t mapping_key;
+
+struct image_mapping {
+	void *data;
+	size_t size;
+};
+
+bool image_cache_hash_file(const char *path, uint64_t *hash) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		swaybg_log_errno(LOG_ERROR, "Failed to open %s", path);
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return false;
+	}
+	size_t size = st.st_size;
+	const unsigned char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		swaybg_log_errno(LOG_ERROR, "Failed to map %s", path);
+		return false;
+	}
+
+	// Multiply-xorshift over 64-bit words, much cheaper than decoding
+	uint64_t h = 0xcbf29ce484222325 ^ size;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t w;
+		memcpy(&w, data + i, sizeof(w));
+		h = (h ^ w) * 0x9e3779b97f4a7c15;
+		h ^= h >> 32;
+	}
+	for (; i < size; i++) {
+		h = (h ^ data[i]) * 0x100000001b3;
+	}
+	h ^= h >> 29;
+
+	munmap((void *)data, size);
+	*hash = h;
+	return true;
+}
+
+static bool get_cache_dir(char *dir, size_t size) {
+	const char *xdg = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	int n;
+	if (xdg && xdg[0] == '/') {
+		n = snprintf(dir, size, "%s/swaybg", xdg);
+	} else if (home && home[0] == '/') {
+		n = snprintf(dir, size, "%s/.cache/swaybg", home);
+	} else {
+		return false;
+	}
+	return n > 0 && (size_t)n < size;
+}
+
+static bool get_cache_path(const struct image_cache_key *key,
+		char *path, size_t size) {
+	char dir[PATH_MAX];
+	if (!get_cache_dir(dir, sizeof(dir))) {
+		return false;
+	}
+	int n = snprintf(path, size, "%s/%016llx-%dx%d-%u-%08x" IMAGE_CACHE_SUFFIX,
+		dir, (unsigned long long)key->content_hash, key->width, key->height,
+		key->mode, key->color);
+	return n > 0 && (size_t)n < size;
+}
+
+static bool make_dirs(char *path) {
+	for (char *p = path + 1; *p; p++) {
+		if (*p != '/') {
+			continue;
+		}
+		*p = '\0';
+		int ret = mkdir(path, 0700);
+		*p = '/';
+		if (ret != 0 && errno != EEXIST) {
+			return false;
+		}
+	}
+	return mkdir(path, 0700) == 0 || errno == EEXIST;
+}
+
+static void unmap_image(void *data) {
+	struct image_mapping *mapping = data;
+	munmap(mapping->data, mapping->size);
+	free(mapping);
+}
+
+cairo_surface_t *image_cache_load(const struct image_cache_key *key) {
+	char path[PATH_MAX];
+	if (!get_cache_path(key, path, sizeof(path))) {
+		return NULL;
+	}
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return NULL;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < IMAGE_CACHE_HEADER_SIZE) {
+		close(fd);
+		return NULL;
+	}
+	size_t size = st.st_size;
+	unsigned char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// Remember when the entry was last used, for pruning
+	futimens(fd, NULL);
+	close(fd);
+	if (data == MAP_FAILED) {
+		return NULL;
+	}
+
+	struct image_cache_header header;
+	memcpy(&header, data, sizeof(header));
+	if (memcmp(header.magic, IMAGE_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+			header.content_hash != key->content_hash ||
+			header.width != key->width || header.height != key->height ||
+			header.stride != cairo_format_stride_for_width(
+				header.format, header.width) ||
+			size < IMAGE_CACHE_HEADER_SIZE +
+				(size_t)header.stride * header.height) {
+		swaybg_log(LOG_DEBUG, "Ignoring invalid image cache entry %s", path);
+		munmap(data, size);
+		return NULL;
+	}
+
+	struct image_mapping *mapping = malloc(sizeof(*mapping));
+	if (!mapping) {
+		munmap(data, size);
+		return NULL;
+	}
+	*mapping = (struct image_mapping){ .data = data, .size = size };
+
+	// The surface is only ever used as a source, so a read-only mapping
+	// is fine
+	cairo_surface_t *surface = cairo_image_surface_create_for_data(
+		data + IMAGE_CACHE_HEADER_SIZE, header.format,
+		header.width, header.height, header.stride);
+	if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS ||
+			cairo_surface_set_user_data(surface, &mapping_key, mapping,
+				unmap_image) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(surface);
+		unmap_image(mapping);
+		return NULL;
+	}
+	swaybg_log(LOG_DEBUG, "Loaded cached background %s", path);
+	return surface;
+}
+
+static void prune_cache(const char *dir) {
+	DIR *d = opendir(dir);
+	if (!d) {
+		return;
+	}
+	time_t now = time(NULL);
+	struct dirent *ent;
+	while ((ent = readdir(d))) {
+		size_t len = strlen(ent->d_name);
+		size_t suffix_len = strlen(IMAGE_CACHE_SUFFIX);
+		if (len <= suffix_len || strcmp(ent->d_name + len - suffix_len,
+				IMAGE_CACHE_SUFFIX) != 0) {
+			continue;
+		}
+		struct stat st;
+		if (fstatat(dirfd(d), ent->d_name, &st, 0) == 0 &&
+				S_ISREG(st.st_mode) &&
+				now - st.st_mtime > IMAGE_CACHE_MAX_AGE) {
+			unlinkat(dirfd(d), ent->d_name, 0);
+		}
+	}
+	closedir(d);
+}
+
+static bool write_all(int fd, const void *data, size_t size) {
+	const unsigned char *p = data;
+	while (size > 0) {
+		ssize_t n = write(fd, p, size);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+void image_cache_store(const struct image_cache_key *key,
+		cairo_surface_t *surface) {
+	char dir[PATH_MAX], path[PATH_MAX], tmp[PATH_MAX + 32];
+	if (!get_cache_dir(dir, sizeof(dir)) ||
+			!get_cache_path(key, path, sizeof(path))) {
+		return;
+	}
+	if (!make_dirs(dir)) {
+		swaybg_log_errno(LOG_ERROR, "Failed to create cache directory %s", dir);
+		return;
+	}
+	prune_cache(dir);
+
+	cairo_surface_flush(surface);
+	struct image_cache_header header = {
+		.format = cairo_image_surface_get_format(surface),
+		.width = cairo_image_surface_get_width(surface),
+		.height = cairo_image_surface_get_height(surface),
+		.stride = cairo_image_surface_get_stride(surface),
+		.content_hash = key->content_hash,
+	};
+	memcpy(header.magic, IMAGE_CACHE_MAGIC, sizeof(header.magic));
+	unsigned char padded[IMAGE_CACHE_HEADER_SIZE] = {0};
+	memcpy(padded, &header, sizeof(header));
+
+	// Write to a temporary file first so readers never see partial entries
+	snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		swaybg_log_errno(LOG_ERROR, "Failed to create %s", tmp);
+		return;
+	}
+	bool ok = write_all(fd, padded, sizeof(padded)) &&
+		write_all(fd, cairo_image_surface_get_data(surface),
+			(size_t)header.stride * header.height);
+	close(fd);
+	if (!ok || rename(tmp, path) != 0) {
+		swaybg_log_errno(LOG_ERROR, "Failed to write image cache entry %s", path);
+		unlink(tmp);
+		return;
+	}
+	swaybg_log(LOG_DEBUG, "Stored background in cache %s", path);
+}
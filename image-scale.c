@@ -0,0 +1,310 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cairo_util.h"
+#include "parallel.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_SSE2 1
+#else
+#define HAVE_SSE2 0
+#endif
+
+/*
+ * Separable resampler for 32-bit cairo image surfaces. Each axis gets its
+ * own filter depending on the scale ratio:
+ *  - box (area average) when shrinking by more than 2x,
+ *  - Lanczos-3 when shrinking by up to 2x,
+ *  - bilinear when enlarging.
+ * Weights are precomputed per destination row and column in 2.14 fixed
+ * point. Every destination row first combines its source rows vertically
+ * into a temporary row, which is then combined horizontally.
+ */
+
+#define WEIGHT_BITS 14
+#define WEIGHT_ONE (1 << WEIGHT_BITS)
+#define LANCZOS_LOBES 3
+#define PI 3.14159265358979323846
+// Rows per thread below which splitting the work is not worth it
+#define PARALLEL_MIN_ROWS 32
+
+struct scale_filter {
+	int taps;		// maximum number of contributions per pixel
+	int *start;		// first source pixel, per destination pixel
+	int *count;		// number of contributions, per destination pixel
+	int16_t *weights;	// taps weights per destination pixel
+};
+
+static double sinc(double x) {
+	if (x == 0) {
+		return 1;
+	}
+	x *= PI;
+	return sin(x) / x;
+}
+
+static double lanczos(double x) {
+	if (fabs(x) >= LANCZOS_LOBES) {
+		return 0;
+	}
+	return sinc(x) * sinc(x / LANCZOS_LOBES);
+}
+
+static double triangle(double x) {
+	x = fabs(x);
+	return x < 1 ? 1 - x : 0;
+}
+
+static void destroy_filter(struct scale_filter *f) {
+	free(f->start);
+	free(f->count);
+	free(f->weights);
+}
+
+static bool create_filter(struct scale_filter *f, int src_size, int dst_size) {
+	double ratio = (double)src_size / dst_size;
+	enum { FILTER_BOX, FILTER_LANCZOS, FILTER_BILINEAR } type =
+		ratio > 2 ? FILTER_BOX : ratio > 1 ? FILTER_LANCZOS : FILTER_BILINEAR;
+	// Filter support in source pixels, on each side of the center
+	double support = type == FILTER_BOX ? ratio / 2 :
+		type == FILTER_LANCZOS ? LANCZOS_LOBES * ratio : 1;
+
+	f->taps = (int)ceil(support) * 2 + 1;
+	f->start = calloc(dst_size, sizeof(int));
+	f->count = calloc(dst_size, sizeof(int));
+	f->weights = calloc((size_t)dst_size * f->taps, sizeof(int16_t));
+	double *w = calloc(f->taps, sizeof(double));
+	if (!f->start || !f->count || !f->weights || !w) {
+		destroy_filter(f);
+		free(w);
+		return false;
+	}
+
+	for (int i = 0; i < dst_size; i++) {
+		double center = (i + 0.5) * ratio;
+		int lo = (int)floor(center - support);
+		int hi = (int)ceil(center + support);
+		if (lo < 0) {
+			lo = 0;
+		}
+		if (hi > src_size) {
+			hi = src_size;
+		}
+		if (hi - lo > f->taps) {
+			hi = lo + f->taps;
+		}
+
+		double sum = 0;
+		for (int j = lo; j < hi; j++) {
+			switch (type) {
+			case FILTER_BOX: {
+				// Overlap of source pixel [j, j+1] with the destination
+				// pixel's footprint
+				double a = fmax(j, center - support);
+				double b = fmin(j + 1, center + support);
+				w[j - lo] = b > a ? b - a : 0;
+				break;
+			}
+			case FILTER_LANCZOS:
+				w[j - lo] = lanczos((j + 0.5 - center) / ratio);
+				break;
+			case FILTER_BILINEAR:
+				w[j - lo] = triangle(j + 0.5 - center);
+				break;
+			}
+			sum += w[j - lo];
+		}
+		if (sum == 0) {
+			// Rounding at the very edge, just take the nearest pixel
+			w[0] = sum = 1;
+		}
+
+		// Quantize, putting the rounding error on the largest weight so
+		// that the weights add up to exactly one
+		int16_t *fw = &f->weights[(size_t)i * f->taps];
+		int total = 0, largest = 0;
+		for (int j = 0; j < hi - lo; j++) {
+			fw[j] = (int16_t)lround(w[j] / sum * WEIGHT_ONE);
+			total += fw[j];
+			if (fw[j] > fw[largest]) {
+				largest = j;
+			}
+		}
+		fw[largest] += WEIGHT_ONE - total;
+		f->start[i] = lo;
+		f->count[i] = hi - lo;
+	}
+	free(w);
+	return true;
+}
+
+static inline uint8_t clamp_u8(int32_t v) {
+	v = (v + WEIGHT_ONE / 2) >> WEIGHT_BITS;
+	return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+// Combine the source rows rows[0..count) into dst, n bytes each
+static void scale_vertical(uint8_t *dst, const uint8_t **rows,
+		const int16_t *weights, int count, int n) {
+	int x = 0;
+#if HAVE_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi32(WEIGHT_ONE / 2);
+	for (; x + 16 <= n; x += 16) {
+		__m128i acc0 = zero, acc1 = zero, acc2 = zero, acc3 = zero;
+		for (int t = 0; t < count; t++) {
+			__m128i v = _mm_loadu_si128((const __m128i *)(rows[t] + x));
+			__m128i w = _mm_set1_epi16(weights[t]);
+			__m128i lo = _mm_unpacklo_epi8(v, zero);
+			__m128i hi = _mm_unpackhi_epi8(v, zero);
+			// 16x16 -> 32 bit products from the low and high halves
+			__m128i pl = _mm_mullo_epi16(lo, w), ph = _mm_mulhi_epi16(lo, w);
+			acc0 = _mm_add_epi32(acc0, _mm_unpacklo_epi16(pl, ph));
+			acc1 = _mm_add_epi32(acc1, _mm_unpackhi_epi16(pl, ph));
+			pl = _mm_mullo_epi16(hi, w);
+			ph = _mm_mulhi_epi16(hi, w);
+			acc2 = _mm_add_epi32(acc2, _mm_unpacklo_epi16(pl, ph));
+			acc3 = _mm_add_epi32(acc3, _mm_unpackhi_epi16(pl, ph));
+		}
+		acc0 = _mm_srai_epi32(_mm_add_epi32(acc0, round), WEIGHT_BITS);
+		acc1 = _mm_srai_epi32(_mm_add_epi32(acc1, round), WEIGHT_BITS);
+		acc2 = _mm_srai_epi32(_mm_add_epi32(acc2, round), WEIGHT_BITS);
+		acc3 = _mm_srai_epi32(_mm_add_epi32(acc3, round), WEIGHT_BITS);
+		_mm_storeu_si128((__m128i *)(dst + x), _mm_packus_epi16(
+			_mm_packs_epi32(acc0, acc1), _mm_packs_epi32(acc2, acc3)));
+	}
+#endif
+	for (; x < n; x++) {
+		int32_t acc = 0;
+		for (int t = 0; t < count; t++) {
+			acc += rows[t][x] * weights[t];
+		}
+		dst[x] = clamp_u8(acc);
+	}
+}
+
+// Combine the pixels of src horizontally into dst
+static void scale_horizontal(uint32_t *dst, const uint32_t *src,
+		const struct scale_filter *f, int width, bool premultiplied) {
+	for (int i = 0; i < width; i++) {
+		const uint32_t *px = src + f->start[i];
+		const int16_t *weights = &f->weights[(size_t)i * f->taps];
+		int count = f->count[i];
+		uint32_t out;
+#if HAVE_SSE2
+		const __m128i zero = _mm_setzero_si128();
+		__m128i acc = zero;
+		for (int t = 0; t < count; t++) {
+			__m128i p = _mm_unpacklo_epi8(_mm_cvtsi32_si128(px[t]), zero);
+			__m128i w = _mm_set1_epi16(weights[t]);
+			acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(
+				_mm_mullo_epi16(p, w), _mm_mulhi_epi16(p, w)));
+		}
+		acc = _mm_srai_epi32(_mm_add_epi32(acc,
+			_mm_set1_epi32(WEIGHT_ONE / 2)), WEIGHT_BITS);
+		acc = _mm_packs_epi32(acc, acc);
+		out = _mm_cvtsi128_si32(_mm_packus_epi16(acc, acc));
+#else
+		int32_t acc[4] = {0};
+		for (int t = 0; t < count; t++) {
+			for (int c = 0; c < 4; c++) {
+				acc[c] += (int32_t)(px[t] >> (8 * c) & 0xff) * weights[t];
+			}
+		}
+		out = 0;
+		for (int c = 0; c < 4; c++) {
+			out |= (uint32_t)clamp_u8(acc[c]) << (8 * c);
+		}
+#endif
+		if (premultiplied) {
+			// Lanczos ringing must not push colors above alpha
+			uint32_t a = out >> 24;
+			uint32_t r = out >> 16 & 0xff, g = out >> 8 & 0xff, b = out & 0xff;
+			out = a << 24 | (r < a ? r : a) << 16 |
+				(g < a ? g : a) << 8 | (b < a ? b : a);
+		}
+		dst[i] = out;
+	}
+}
+
+struct scale_job {
+	const uint8_t *src;
+	int src_stride, src_width;
+	uint8_t *dst;
+	int dst_stride, dst_width;
+	struct scale_filter horiz, vert;
+	bool premultiplied;
+};
+
+static void scale_rows(void *data, int start, int end) {
+	struct scale_job *job = data;
+	uint32_t *tmp = malloc((size_t)job->src_width * sizeof(uint32_t));
+	const uint8_t **rows = malloc(job->vert.taps * sizeof(*rows));
+	if (!tmp || !rows) {
+		free(tmp);
+		free(rows);
+		return;
+	}
+	for (int y = start; y < end; y++) {
+		int count = job->vert.count[y];
+		for (int t = 0; t < count; t++) {
+			rows[t] = job->src + (size_t)(job->vert.start[y] + t) * job->src_stride;
+		}
+		scale_vertical((uint8_t *)tmp, rows,
+			&job->vert.weights[(size_t)y * job->vert.taps], count,
+			job->src_width * 4);
+		scale_horizontal((uint32_t *)(job->dst + (size_t)y * job->dst_stride),
+			tmp, &job->horiz, job->dst_width, job->premultiplied);
+	}
+	free(rows);
+	free(tmp);
+}
+
+cairo_surface_t *cairo_image_surface_scale(cairo_surface_t *image,
+		int width, int height) {
+	cairo_format_t format = cairo_image_surface_get_format(image);
+	if ((format != CAIRO_FORMAT_ARGB32 && format != CAIRO_FORMAT_RGB24) ||
+			width <= 0 || height <= 0) {
+		return NULL;
+	}
+	int src_width = cairo_image_surface_get_width(image);
+	int src_height = cairo_image_surface_get_height(image);
+	if (src_width <= 0 || src_height <= 0) {
+		return NULL;
+	}
+
+	cairo_surface_t *scaled = cairo_image_surface_create(format, width, height);
+	if (cairo_surface_status(scaled) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(scaled);
+		return NULL;
+	}
+
+	cairo_surface_flush(image);
+	struct scale_job job = {
+		.src = cairo_image_surface_get_data(image),
+		.src_stride = cairo_image_surface_get_stride(image),
+		.src_width = src_width,
+		.dst = cairo_image_surface_get_data(scaled),
+		.dst_stride = cairo_image_surface_get_stride(scaled),
+		.dst_width = width,
+		.premultiplied = format == CAIRO_FORMAT_ARGB32,
+	};
+	if (!create_filter(&job.horiz, src_width, width)) {
+		cairo_surface_destroy(scaled);
+		return NULL;
+	}
+	if (!create_filter(&job.vert, src_height, height)) {
+		destroy_filter(&job.horiz);
+		cairo_surface_destroy(scaled);
+		return NULL;
+	}
+
+	parallel_for(height, PARALLEL_MIN_ROWS, scale_rows, &job);
+
+	destroy_filter(&job.horiz);
+	destroy_filter(&job.vert);
+	cairo_surface_mark_dirty(scaled);
+	return scaled;
+}
@@ -1,7 +1,123 @@
 #ifndef _SWAY_BIRD_ANIM_H
 #define _SWAY_BIRD_ANIM_H
 
+#include <stdbool.h>
 #include "cairo_util.h"
+#include "damage.h"
+
+struct glyph;
+
+struct anim_config {
+	int total_traces;
+	int min_velocity;
+	int max_velocity;
+	int min_accel;
+	int max_accel;
+	int line_width;
+	int trace_len;
+	int decay_limit;
+};
+
+enum anim_foot {
+	BIRD_LEFT,
+	BIRD_RIGHT,
+};
+
+struct trace {
+	int x, y;		// Trace root position
+	float angle;		// Trace rotation
+};
+
+/*
+ * Endpoints of the visible traces, oldest first, in structure-of-arrays
+ * layout so that they are computed for all traces at once
+ */
+struct anim_geometry {
+	int count;
+	float *alpha;		// decaying traces first
+	float *angle, *sin, *cos;
+	float *x, *y;		// Trace root
+	float *tip_x, *tip_y;	// End of the main line
+	float *fork_x, *fork_y;	// Where the toes branch off
+	float *toe_lx, *toe_ly;
+	float *toe_rx, *toe_ry;
+};
+
+#define ANIM_GEOMETRY_ARRAYS 14
+
+struct anim_context {
+	int cur_x, cur_y;	// Where the BIRD is now
+	int nxt_x, nxt_y;	// Where the BIRD is heading
+	enum anim_foot nxt_foot;
+	int nxt_pos;		// Next trace position in the list
+	struct anim_config cf;
+	int decay_levels;	// Fading traces drawn, at most cf.decay_limit
+	const struct glyph *glyph;	// Footprint shape, NULL for the built-in one
+	struct anim_geometry geometry;	// Scratch space for anim_draw()
+	struct trace traces[0];
+};
+
+/*
+ * Part of the animation area shown in a buffer, when one animation spans
+ * several outputs. The rectangle is scaled to the buffer size.
+ */
+struct anim_view {
+	int x, y, width, height;
+	int buffer_width, buffer_height;
+};
+
+extern const struct anim_config anim_default_config;
+
+/* Seed the random generator; without this, it is seeded from the clock */
+void anim_seed(unsigned int seed);
+int anim_randrange(int min, int max);
+
+bool anim_check_velocity(const struct anim_context *actx,
+		int dx, int dy, int width, int height);
+float anim_trace_angle(int dx, int dy, float foot);
+
+/* Context without any traces or motion, for callers which fill it in */
+struct anim_context *anim_alloc(const struct anim_config *cf);
+struct anim_context *anim_create(const struct anim_config *cf,
+		int width, int height);
+/* Advance the BIRD by one step. May replace actx if the BIRD got stuck. */
+struct anim_context *anim_step(struct anim_context *actx, int width, int height);
+/* Same, with the acceleration shifted by ax, ay, e.g. to steer around other
+ * birds. The shift is dropped if no velocity fits with it. */
+struct anim_context *anim_step_steered(struct anim_context *actx,
+		int width, int height, int ax, int ay);
+/* Advance by the given number of steps without drawing. Only the ones which
+ * still leave visible traces are simulated. */
+struct anim_context *anim_fast_forward(struct anim_context *actx, int steps,
+		int width, int height);
+
+/* Move the BIRD and its traces, e.g. when the area origin changes */
+void anim_translate(struct anim_context *actx, int dx, int dy);
+/* Scale the positions of the BIRD and its traces to another area size */
+void anim_rescale(struct anim_context *actx, int from_width, int from_height,
+		int to_width, int to_height);
+
+/* Set the trace color with the given opacity as cairo source */
+void anim_set_trace_source(cairo_t *cr, double alpha);
+void anim_draw_trace(cairo_t *cr, const struct anim_context *actx,
+		const struct trace *trace, double alpha);
+void anim_draw_background(cairo_t *cr, int width, int height);
+/* Draw the traces on top of whatever background is already there, with one
+ * path and one stroke per opacity level */
+void anim_draw(cairo_t *cr, struct anim_context *actx, int width, int height);
+/* Draw only the traces which are within the view, scaled to the buffer */
+void anim_draw_view(cairo_t *cr, struct anim_context *actx,
+		const struct anim_view *view);
+
+/* Area covered by a drawn trace, including the line width */
+struct damage_rect anim_trace_bounds(const struct anim_context *actx,
+		const struct trace *trace);
+/* Add the area covered by every visible trace to the damage */
+void anim_damage(const struct anim_context *actx, struct damage *damage,
+		int width, int height);
+/* Add the buffer area covered by the traces within the view */
+void anim_damage_view(const struct anim_context *actx,
+		const struct anim_view *view, struct damage *damage);
 
 struct anim_context *render_anim(cairo_t *, struct anim_context *, int, int);
 void anim_done(struct anim_context *);
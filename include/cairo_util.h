@@ -11,6 +11,10 @@
 void cairo_set_source_u32(cairo_t *cairo, uint32_t color);
 cairo_subpixel_order_t to_cairo_subpixel_order(enum wl_output_subpixel subpixel);
 
+/*
+ * Resample an ARGB32 or RGB24 image to the given size into a new surface,
+ * or return NULL if that is not possible.
+ */
 cairo_surface_t *cairo_image_surface_scale(cairo_surface_t *image,
 		int width, int height);
 
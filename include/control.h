@@ -0,0 +1,76 @@
+#ifndef _SWAYBG_CONTROL_H
+#define _SWAYBG_CONTROL_H
+#include <poll.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define CONTROL_MAX_CLIENTS 8
+#define CONTROL_MAX_LINE 512
+#define CONTROL_MAX_ARGS 32
+// Listening socket and clients
+#define CONTROL_MAX_FDS (1 + CONTROL_MAX_CLIENTS)
+
+/*
+ * Handle one command, split into words. Anything written to reply is sent
+ * back to the client; replies starting with "error" make `swaybg ctl` fail.
+ * The handler may also pass a file descriptor along with the reply, or keep
+ * the client around for events, see control_reply_fd() and control_watch().
+ */
+typedef void (*control_handler)(void *data, int argc, char **argv,
+		FILE *reply);
+
+struct control_client {
+	int fd;
+	size_t len;
+	char line[CONTROL_MAX_LINE];
+	// waiting for events matching one of the filters, or any without them
+	bool watching;
+	int n_filters;
+	char *filters[CONTROL_MAX_ARGS];  // point into line
+};
+
+/*
+ * Unix-domain socket accepting one newline-terminated command per
+ * connection, driven by the poll loop of main().
+ */
+struct control {
+	int fd;
+	char *path;
+	control_handler handler;
+	void *data;
+	struct control_client clients[CONTROL_MAX_CLIENTS];
+	// state of the command being handled
+	struct control_client *current;
+	int reply_fd;
+};
+
+/* Match the filter argument of a watching client against an event */
+typedef bool (*control_filter)(void *data, const char *filter);
+
+/* Socket path from $SWAYBG_SOCK, or derived from the Wayland display */
+char *control_get_socket_path(void);
+
+bool control_init(struct control *control, control_handler handler,
+		void *data);
+void control_finish(struct control *control);
+/* Fill in up to CONTROL_MAX_FDS descriptors to poll, return their count */
+int control_get_pollfds(struct control *control, struct pollfd *fds);
+/* Accept clients and run complete commands after poll() returned */
+void control_dispatch(struct control *control, const struct pollfd *fds,
+		int nfds);
+
+/* From a handler: send fd with the reply and close it afterwards */
+void control_reply_fd(struct control *control, int fd);
+/* From a handler: keep the connection open after the reply, to send it the
+ * events matching one of the arguments after the command name */
+void control_watch(struct control *control);
+/* Send a line to the watching clients whose filters match. Clients which do
+ * not keep up are disconnected. */
+void control_notify(struct control *control, control_filter match,
+		void *data, const char *line);
+
+/* Entry point of `swaybg ctl <command> [<args>...]` */
+int control_client_main(int argc, char **argv);
+
+#endif
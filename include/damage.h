@@ -0,0 +1,39 @@
+#ifndef _SWAYBG_DAMAGE_H
+#define _SWAYBG_DAMAGE_H
+#include <stdbool.h>
+#include <stdint.h>
+
+#define DAMAGE_MAX_RECTS 64
+
+struct damage_rect {
+	int x, y, width, height;
+};
+
+/*
+ * A small set of buffer-local rectangles. Once it would overflow, it turns
+ * into damage covering the whole buffer.
+ */
+struct damage {
+	bool full;
+	int n_rects;
+	struct damage_rect rects[DAMAGE_MAX_RECTS];
+};
+
+// Clip a rectangle to a buffer of the given size, false if nothing is left
+bool damage_clip_rect(struct damage_rect *rect, int width, int height);
+
+void damage_clear(struct damage *damage);
+void damage_set_full(struct damage *damage);
+// Add a rectangle, clipped to a buffer of the given size
+void damage_add_rect(struct damage *damage, struct damage_rect rect,
+		int width, int height);
+void damage_add(struct damage *damage, const struct damage *other);
+
+/*
+ * Copy the damaged area of a 32-bit image with the given number of rows from
+ * src to dst, both with the same stride.
+ */
+void damage_copy(const struct damage *damage, uint8_t *dst,
+		const uint8_t *src, int stride, int height);
+
+#endif
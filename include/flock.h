@@ -0,0 +1,46 @@
+#ifndef _SWAYBG_FLOCK_H
+#define _SWAYBG_FLOCK_H
+#include "anim.h"
+#include "cairo_util.h"
+#include "damage.h"
+
+#define FLOCK_MAX_BIRDS 10000
+
+/*
+ * Birds walking the same area, which steer away from the paths of their
+ * close neighbors and loosely towards the farther ones.
+ *
+ * Neighbors are looked up in a uniform grid over the positions the birds
+ * head to, with cells as large as the interaction radius, so that only the
+ * 3x3 cells around a bird are searched, and at most FLOCK_MAX_NEIGHBORS of
+ * the birds in there. A bird only moves from one cell list to another when
+ * its step crosses a cell boundary, the grid is not rebuilt every step.
+ */
+struct flock {
+	struct anim_config cf;
+	int count;
+	struct anim_context **birds;
+	int width, height;	// area the grid covers
+	int cell_size, cols, rows;
+	// doubly-linked list of birds per cell, -1 terminated
+	int *head;		// per cell
+	int *next, *prev;	// per bird
+	int *cell;		// per bird, the cell it is listed in
+};
+
+struct flock *flock_create(const struct anim_config *cf, int count,
+		int width, int height);
+/* Step every bird. The lead bird, which the caller steps on its own, is
+ * avoided like the others. */
+void flock_step(struct flock *flock, const struct anim_context *lead,
+		int width, int height);
+void flock_rescale(struct flock *flock, int from_width, int from_height,
+		int to_width, int to_height);
+/* Draw and damage the birds within the view, scaled to the buffer */
+void flock_draw(struct flock *flock, cairo_t *cr, int decay_levels,
+		const struct anim_view *view);
+void flock_damage(const struct flock *flock, struct damage *damage,
+		const struct anim_view *view);
+void flock_destroy(struct flock *flock);
+
+#endif
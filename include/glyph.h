@@ -0,0 +1,29 @@
+#ifndef _SWAYBG_GLYPH_H
+#define _SWAYBG_GLYPH_H
+
+#define GLYPH_MAX_VERTICES 512
+
+/*
+ * Footprint shape read from SVG path data, restricted to the M, L, H, V, C,
+ * Q and Z commands and their relative forms, with # starting a comment that
+ * runs to the end of the line. The root of the footprint is at the origin
+ * and the bird walks towards +x.
+ *
+ * Curves are flattened when loading, and the vertices scaled so that the
+ * farthest one lies at distance 1 from the root, like the tip of the
+ * built-in footprint. Drawing only rotates and scales these vertices by the
+ * trace length.
+ */
+struct glyph {
+	int n_vertices, n_paths;
+	float *x, *y;
+	int *path_end;	// per polyline, the index past its last vertex
+	float x0, y0, x1, y1;	// bounding box of the vertices
+};
+
+/* Parse path data, name is only used in error messages */
+struct glyph *glyph_parse(const char *data, const char *name);
+struct glyph *glyph_load(const char *path);
+void glyph_destroy(struct glyph *glyph);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef _SWAYBG_GOVERNOR_H
+#define _SWAYBG_GOVERNOR_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <cairo.h>
+
+/*
+ * Trades rendering quality for frame cost. The CPU time spent drawing each
+ * frame is averaged and compared to a budget: a few frames in a row over
+ * budget lower the quality by one level, and many frames well below it
+ * raise it again. The gap between both thresholds keeps the level from
+ * going back and forth.
+ */
+struct governor_quality {
+	const char *name;
+	cairo_antialias_t antialias;
+	int decay_levels;	// fading traces drawn, see anim_context
+	int scale_div;		// buffer size divisor, needs a viewport
+};
+
+struct governor {
+	int level;		// index into the quality levels, 0 is the best
+	uint64_t avg_ns;	// moving average of the frame cost at this level
+	int samples;		// frames measured at this level
+	int over, under;	// consecutive frames over budget, or well below
+};
+
+void governor_init(struct governor *gov);
+const struct governor_quality *governor_get_quality(const struct governor *gov);
+/* Account for the CPU time of a frame, return whether the level changed */
+bool governor_sample(struct governor *gov, uint64_t frame_ns,
+		uint64_t budget_ns);
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef _SWAYBG_HANDOFF_H
+#define _SWAYBG_HANDOFF_H
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "anim.h"
+
+/*
+ * Live animation state of an output, published in a shared memory segment
+ * so that another instance, e.g. the lockscreen, can show the same bird
+ * without simulating it. The publisher updates it after every step under a
+ * seqlock: the sequence number is odd while the state is being written, and
+ * readers retry if it changed while they copied the state.
+ *
+ * Both sides are the same program, so the layout is native.
+ */
+#define HANDOFF_MAGIC "SWBGLIVE"
+#define HANDOFF_VERSION 1
+
+struct handoff_state {
+	char magic[8];
+	uint32_t version;
+	pid_t pid;		// publisher
+	atomic_uint seq;
+	atomic_bool closed;	// the publisher is gone
+	struct anim_config cf;	// fixed for the lifetime of the segment
+	// covered by the seqlock
+	int32_t width, height;	// buffer size the positions refer to
+	int32_t cur_x, cur_y, nxt_x, nxt_y;
+	int32_t nxt_foot, nxt_pos;
+	struct trace traces[];
+};
+
+struct handoff_publisher {
+	char *name;
+	struct handoff_state *state;
+	size_t size;
+};
+
+struct handoff_subscriber {
+	struct handoff_state *state;
+	size_t size;
+	unsigned last_seq;
+	int stalled_reads;	// since the sequence number last moved
+};
+
+/* Create the segment for the given key and output, replacing any previous
+ * one. Instances attached to that one see it as closed. */
+struct handoff_publisher *handoff_publish(const char *key,
+		const char *output_name, const struct anim_config *cf);
+/* Publish the state after a step, return false if actx does not fit the
+ * segment anymore and a new one is needed */
+bool handoff_update(struct handoff_publisher *pub,
+		const struct anim_context *actx, int width, int height);
+/* Mark the segment closed and remove it */
+void handoff_unpublish(struct handoff_publisher *pub);
+
+/* Map the segment of a running publisher, or return NULL */
+struct handoff_subscriber *handoff_attach(const char *key,
+		const char *output_name);
+/* Copy the published state into *actx, allocated or replaced as needed,
+ * with positions scaled to the given buffer size. Returns false once the
+ * publisher is gone, closed or not, leaving *actx as last published. */
+bool handoff_read(struct handoff_subscriber *sub, struct anim_context **actx,
+		int width, int height);
+void handoff_detach(struct handoff_subscriber *sub);
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef _SWAYBG_IMAGE_CACHE_H
+#define _SWAYBG_IMAGE_CACHE_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <cairo.h>
+
+/*
+ * On-disk cache of background images which are already decoded and scaled
+ * for a given buffer size, stored in the cairo pixel format. Entries live in
+ * $XDG_CACHE_HOME/swaybg and are memory-mapped on load.
+ */
+struct image_cache_key {
+	uint64_t content_hash;	// see image_cache_hash_file()
+	int32_t width, height;	// buffer size
+	uint32_t mode;		// enum background_mode
+	uint32_t color;		// color painted under the image
+};
+
+bool image_cache_hash_file(const char *path, uint64_t *hash);
+cairo_surface_t *image_cache_load(const struct image_cache_key *key);
+void image_cache_store(const struct image_cache_key *key,
+		cairo_surface_t *surface);
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef _SWAYBG_PARALLEL_H
+#define _SWAYBG_PARALLEL_H
+
+/*
+ * Process the range [0, count) with func(data, start, end), split into
+ * contiguous chunks of at least min_chunk items across worker threads. Runs
+ * on the calling thread only if the range is too small to be worth it.
+ */
+typedef void (*parallel_func)(void *data, int start, int end);
+
+void parallel_for(int count, int min_chunk, parallel_func func, void *data);
+/* Use at most this many threads instead of one per online CPU */
+void parallel_set_max_threads(int count);
+
+#endif
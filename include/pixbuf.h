@@ -0,0 +1,28 @@
+#ifndef _SWAYBG_PIXBUF_H
+#define _SWAYBG_PIXBUF_H
+#if HAVE_GDK_PIXBUF
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+/*
+ * The parts of gdk-pixbuf and GLib used to decode images. The libraries are
+ * only loaded with dlopen() once an image has to be decoded, so that color
+ * backgrounds and images found in the cache do not pay for them, nor for the
+ * loader modules they pull in, at startup.
+ */
+struct pixbuf_funcs {
+	GdkPixbuf *(*new_from_file)(const char *filename, GError **error);
+	GdkPixbuf *(*apply_embedded_orientation)(GdkPixbuf *src);
+	int (*get_n_channels)(const GdkPixbuf *pixbuf);
+	int (*get_width)(const GdkPixbuf *pixbuf);
+	int (*get_height)(const GdkPixbuf *pixbuf);
+	int (*get_rowstride)(const GdkPixbuf *pixbuf);
+	const guint8 *(*read_pixels)(const GdkPixbuf *pixbuf);
+	void (*object_unref)(gpointer object);
+	void (*error_free)(GError *error);
+};
+
+/* Load the libraries on first use, return NULL if they are not available */
+const struct pixbuf_funcs *pixbuf_get(void);
+
+#endif // HAVE_GDK_PIXBUF
+#endif
@@ -0,0 +1,23 @@
+#ifndef _SWAYBG_PIXCONV_H
+#define _SWAYBG_PIXCONV_H
+#include <stdint.h>
+
+/*
+ * Row conversion from 8-bit RGB or non-premultiplied RGBA, as used by
+ * gdk-pixbuf, to the native-endian XRGB and premultiplied ARGB pixels of
+ * cairo. All implementations produce bit-identical results.
+ */
+typedef void (*pixconv_row_func)(uint32_t *dst, const uint8_t *src, int width);
+
+struct pixconv_funcs {
+	const char *name;
+	pixconv_row_func rgb_to_xrgb;
+	pixconv_row_func rgba_premul;
+};
+
+/* Best implementation for the running CPU */
+const struct pixconv_funcs *pixconv_get(void);
+/* Portable reference implementation */
+const struct pixconv_funcs *pixconv_get_scalar(void);
+
+#endif
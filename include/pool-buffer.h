@@ -10,11 +10,23 @@ struct pool_buffer {
 	cairo_surface_t *surface;
 	cairo_t *cairo;
 	void *data;
+	int fd;  // memory of the pool, valid along with buffer
 	size_t size;
+	uint32_t width, height;
+	bool busy;
 };
 
 bool create_buffer(struct pool_buffer *buffer, struct wl_shm *shm,
 		int32_t width, int32_t height, uint32_t format);
+// Return a buffer of the pool which is neither used by the compositor nor
+// the shown one, (re)created for the given size if needed, or NULL if there
+// is none
+struct pool_buffer *get_next_buffer(struct wl_shm *shm,
+		struct pool_buffer pool[static 2], const struct pool_buffer *shown,
+		uint32_t width, uint32_t height, uint32_t format);
 void destroy_buffer(struct pool_buffer *buffer);
+// Open the buffer memory for another process to map it, read-only where
+// /proc allows it, or return -1
+int export_buffer(const struct pool_buffer *buffer);
 
 #endif
@@ -0,0 +1,40 @@
+#ifndef _SWAYBG_PRIORITY_H
+#define _SWAYBG_PRIORITY_H
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Keep the wallpaper out of the way of foreground work. Scheduling settings
+ * apply to the calling thread, which should be the main thread before any
+ * worker got spawned: the workers inherit them.
+ */
+
+/* Only run when no other thread wants the CPU (SCHED_IDLE), or at the
+ * lowest nice level where that is not available */
+bool priority_set_background(void);
+/* Restrict the process to a CPU list such as "2-3,6", return the number of
+ * CPUs in it, or 0 on failure */
+int priority_set_affinity(const char *cpus);
+
+/*
+ * CPU time the process may use per wall-clock minute, measured with
+ * CLOCK_PROCESS_CPUTIME_ID so that worker threads count too. Once a minute
+ * used it up, animations wait for the next one.
+ */
+struct cpu_quota {
+	uint64_t quota_ns;	// 0 for no limit
+	uint64_t window_start;	// CLOCK_MONOTONIC
+	uint64_t cpu_start;	// process CPU time at window_start
+	bool exhausted;
+};
+
+void cpu_quota_init(struct cpu_quota *quota, int ms_per_minute);
+/* Start a new window if the current one is over, return whether the
+ * quota of the current one is used up */
+bool cpu_quota_exhausted(struct cpu_quota *quota);
+/* Milliseconds until the next window, for sleeping while exhausted */
+int cpu_quota_timeout(const struct cpu_quota *quota);
+/* CPU time used in the current window */
+uint64_t cpu_quota_used_ns(const struct cpu_quota *quota);
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef _SWAYBG_REPLAY_H
+#define _SWAYBG_REPLAY_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "anim.h"
+
+/*
+ * Recorded walks start with a header holding the output size and the
+ * animation config, in native byte order. It is followed by one record per
+ * step, made of unsigned LEB128 varints:
+ *
+ *   tag            1 if the bird got stuck and its traces were cleared, or
+ *                  zigzag(angle delta) << 2 | foot << 1
+ *   zigzag(dx)     root of the trace relative to the previous one
+ *   zigzag(dy)
+ *
+ * Angles are quantized to 1/65536 of a full turn, and only the tag is
+ * present for a clearing step. A typical step takes 5 to 7 bytes.
+ */
+#define REPLAY_MAGIC "SWBGWALK"
+#define REPLAY_VERSION 1
+// Steps between two seek points of the in-memory index
+#define REPLAY_INDEX_INTERVAL 1024
+
+struct replay_header {
+	char magic[8];
+	uint32_t version;
+	int32_t width, height;	// buffer size of the recorded output
+	int32_t total_traces;
+	int32_t min_velocity, max_velocity;
+	int32_t min_accel, max_accel;
+	int32_t line_width;
+	int32_t trace_len;
+	int32_t decay_limit;
+};
+
+struct recorder {
+	FILE *file;
+	int nxt_pos;		// animation position as of the last step written
+	int x, y;		// root of the last trace written
+	uint32_t angle;		// quantized angle of the last trace written
+};
+
+/* Create the file and write its header */
+struct recorder *recorder_create(const char *path,
+		const struct anim_config *cf, int width, int height);
+/* Write the steps taken since the last call, return false on write errors */
+bool recorder_step(struct recorder *rec, const struct anim_context *actx);
+void recorder_destroy(struct recorder *rec);
+
+/* Position in a recording, decoding state included. A zeroed cursor is
+ * before the start. */
+struct replay_cursor {
+	size_t offset;
+	int step;
+	int x, y;
+	uint32_t angle;
+	// nxt_pos of a context which took every step so far
+	int nxt_pos;
+};
+
+/* Memory-mapped recording */
+struct replay {
+	const uint8_t *data;
+	size_t map_size;
+	size_t size;		// up to the end of the last complete step
+	int width, height;
+	struct anim_config cf;
+	int steps;
+	// cursors at every REPLAY_INDEX_INTERVAL steps
+	struct replay_cursor *index;
+	int n_index;
+};
+
+struct replay *replay_open(const char *path);
+void replay_close(struct replay *replay);
+/* Context to feed with replay_step() or replay_seek() */
+struct anim_context *replay_create_context(const struct replay *replay);
+/* Apply the next step to actx, starting over after the last one. Positions
+ * are scaled from the recorded size to the given one. */
+void replay_step(const struct replay *replay, struct replay_cursor *cursor,
+		struct anim_context *actx, int width, int height);
+/* Bring actx to the state after the given number of steps, modulo the
+ * length of the recording */
+void replay_seek(const struct replay *replay, struct replay_cursor *cursor,
+		struct anim_context *actx, int step, int width, int height);
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef _SWAYBG_STARTUP_H
+#define _SWAYBG_STARTUP_H
+
+/*
+ * Timeline of the startup, from the exec of the process to the first frame
+ * on screen, logged once that frame got committed.
+ */
+enum startup_event {
+	STARTUP_EXEC,		// from the process start time, if available
+	STARTUP_MAIN,
+	STARTUP_REGISTRY,	// globals received
+	STARTUP_CONFIGURE,	// first layer surface configured
+	STARTUP_COMMIT,		// first frame committed
+	STARTUP_EVENT_COUNT,
+};
+
+/* Record main() and, where the kernel tells, the exec of the process */
+void startup_init(void);
+/* Record the first occurrence of an event, and log the timeline after the
+ * first commit */
+void startup_mark(enum startup_event event);
+
+#endif
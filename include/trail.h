@@ -0,0 +1,57 @@
+#ifndef _SWAYBG_TRAIL_H
+#define _SWAYBG_TRAIL_H
+#include <stdint.h>
+#include "anim.h"
+#include "cairo_util.h"
+#include "damage.h"
+
+#define TRAIL_MAX_LENGTH 1000000
+
+/*
+ * Long trails are accumulated in an 8-bit mask at the buffer size instead
+ * of being redrawn from the trace history. Every step stamps the newest
+ * footprint into the mask, and every few steps the whole mask is faded by
+ * a constant factor, so the cost does not depend on the trail length.
+ */
+struct trail {
+	cairo_surface_t *mask;	// A8
+	cairo_t *cairo;
+	int width, height;
+	int div;		// animation pixels per mask pixel
+	int fade_interval;	// steps between two fades
+	uint8_t fade_factor;	// multiplier in 0.8 fixed point
+	int steps;
+	// area stamped since the mask was created, which is all that can fade
+	struct damage_rect extent;
+};
+
+/* Multiply n mask bytes by factor / 256, rounding down */
+typedef void (*trail_fade_func)(uint8_t *row, int n, uint8_t factor);
+
+struct trail_fade_funcs {
+	const char *name;
+	trail_fade_func fade;
+};
+
+/* Best implementation for the running CPU */
+const struct trail_fade_funcs *trail_fade_get(void);
+/* Portable reference implementation */
+const struct trail_fade_funcs *trail_fade_get_scalar(void);
+
+/* A footprint fades out after about `length` steps. The footprints are
+ * those of an animation `div` times the mask size. */
+struct trail *trail_create(int width, int height, int div, int length);
+/* Carry the footprints of a trail of another size over, scaled to this one,
+ * e.g. when the output changes size */
+void trail_scale_from(struct trail *trail, const struct trail *old);
+/* Fade if it is time to, stamp the newest footprint and add what changed */
+void trail_step(struct trail *trail, const struct anim_context *actx,
+		struct damage *damage);
+/* Only stamp the newest footprint, e.g. of another bird in the same step */
+void trail_stamp(struct trail *trail, const struct anim_context *actx,
+		struct damage *damage);
+/* Paint the trail within the damage */
+void trail_draw(struct trail *trail, cairo_t *cr, const struct damage *damage);
+void trail_destroy(struct trail *trail);
+
+#endif
@@ -1,6 +1,11 @@
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
 #include <getopt.h>
+#include <limits.h>
+#if HAVE_MALLOC_TRIM
+#include <malloc.h>
+#endif
 #include <poll.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -10,10 +15,24 @@
 #include <time.h>
 #include <wayland-client.h>
 #include "anim.h"
+#include "background-image.h"
 #include "cairo_util.h"
+#include "control.h"
+#include "damage.h"
+#include "flock.h"
+#include "glyph.h"
+#include "governor.h"
+#include "handoff.h"
+#include "image-cache.h"
 #include "log.h"
 #include "pool-buffer.h"
+#include "priority.h"
+#include "replay.h"
+#include "startup.h"
+#include "trail.h"
+#include "wlr-foreign-toplevel-management-unstable-v1-client-protocol.h"
 #include "wlr-layer-shell-unstable-v1-client-protocol.h"
+#include "wlr-output-power-management-unstable-v1-client-protocol.h"
 #include "viewporter-client-protocol.h"
 #include "single-pixel-buffer-v1-client-protocol.h"
 #include "fractional-scale-v1-client-protocol.h"
@@ -43,6 +62,18 @@ static bool parse_color(const char *color, uint32_t *result) {
 	return true;
 }
 
+// Default animation steps per minute, and the most the control socket allows
+#define FPM 180
+#define MAX_RATE 6000
+
+// Animation shared by the outputs with the span option, running in the
+// bounding box of their layout rectangles
+struct swaybg_span {
+	struct anim_context *actx;
+	int32_t x, y;  // top left corner in the layout
+	int32_t width, height;
+};
+
 struct swaybg_state {
 	struct wl_display *display;
 	struct wl_compositor *compositor;
@@ -50,17 +81,77 @@ struct swaybg_state {
 	struct zwlr_layer_shell_v1 *layer_shell;
 	struct wp_viewporter *viewporter;
 	struct wp_fractional_scale_manager_v1 *fract_scale_manager;
+	struct zwlr_foreign_toplevel_manager_v1 *toplevel_manager;
+	struct zwlr_output_power_manager_v1 *power_manager;
 	struct wl_list configs;  // struct swaybg_output_config::link
 	struct wl_list outputs;  // struct swaybg_output::link
+	// removed outputs kept for a while, the most recent first
+	struct wl_list parked;  // struct swaybg_output::link
+	struct wl_list images;   // struct swaybg_image::link
+	struct wl_list toplevels;  // struct swaybg_toplevel::link
+	struct control control;
+	struct swaybg_span span;
+	int rate;  // animation steps per minute
 	bool run_display;
+	// process-wide scheduling options
+	bool background_priority;
+	char *cpu_affinity;
+	struct cpu_quota cpu_quota;
+	// take over the power control of the outputs to follow their mode
+	bool watch_power;
+};
+
+struct swaybg_image {
+	struct wl_list link;
+	const char *path;
+	// decoded image, only kept until the outputs got their backgrounds
+	cairo_surface_t *surface;
+	// CLOCK_MONOTONIC time to unload it at, once no output waits for it
+	uint64_t unload_at;
+	uint64_t content_hash;
+	bool hashed, failed;
 };
 
 struct swaybg_output_config {
 	char *output;
+	const char *image_path;
+	struct swaybg_image *image;
+	enum background_mode mode;
 	uint32_t color;
+	char *mirror_group;
+	bool span;
+	int trail_length;
+	int birds;  // on each output, 0 for a single one
+	char *footprint_path;
+	struct glyph *glyph;  // NULL for the built-in footprint
+	int budget_ms;  // frame cost the governor aims for, 0 for the default
+	char *record_path;
+	// walk to replay instead of simulating one, shared by the outputs
+	char *replay_path;
+	struct replay *replay;
+	bool recording;  // an output claimed record_path
+	// key of the shared memory segments to publish the animation in, or to
+	// follow the animation of another instance from
+	char *publish_key;
+	char *attach_key;
 	struct wl_list link;
 };
 
+enum anim_state {
+	ANIM_RUNNING,
+	ANIM_PAUSED,	// the last frame stays up
+	ANIM_FROZEN,	// only the background is shown
+};
+
+struct swaybg_output_stats {
+	uint64_t frames;	// frames committed
+	uint64_t drawn;		// frames drawn rather than mirrored
+	uint64_t skipped;	// frames dropped because no buffer could be drawn into
+	uint64_t coalesced;	// buffer sizes never allocated as they changed again
+	uint64_t steps;		// animation steps, including the fast-forwarded ones
+	uint64_t draw_ns, draw_max_ns;
+};
+
 struct swaybg_output {
 	uint32_t wl_name;
 	struct wl_output *wl_output;
@@ -76,7 +167,42 @@ struct swaybg_output {
 	struct wp_fractional_scale_v1 *fract_scale;
 
 	struct anim_context *actx;
-
+	// the other birds with --birds, which keep clear of actx and each other
+	struct flock *flock;
+	struct recorder *recorder;
+	struct replay_cursor replay_cursor;
+	struct handoff_publisher *publisher;
+	struct handoff_subscriber *subscriber;
+	// static part of every frame at the buffer size, traces are drawn on
+	// top: the scaled background image, or the color and the ground
+	cairo_surface_t *background;
+	struct pool_buffer buffers[2];
+	// area of each buffer covered by the traces drawn into it last time,
+	// which gets restored from the background before drawing again
+	struct damage buffer_damage[2];
+	// traces and surface damage of the last committed frame
+	struct damage trace_damage, frame_damage;
+	// accumulated footprints when the config asks for a long trail
+	struct trail *trail;
+	// buffer drawn during the current tick, shared with mirror group members
+	struct wl_buffer *frame_buffer;
+	// buffer of the last frame drawn, if it was not destroyed since
+	struct pool_buffer *shown;
+	// mirror group leader whose buffer was attached during the last tick
+	struct swaybg_output *mirrored;
+	enum anim_state anim_state;
+	// under a fullscreen toplevel
+	bool covered;
+	struct zwlr_output_power_v1 *power;
+	bool powered_off;
+	// covered or powered off since the given CLOCK_MONOTONIC time
+	uint64_t suspended_since;
+	// the animation context was dropped while powered off
+	bool rebuild_anim;
+	struct swaybg_output_stats stats;
+	struct governor governor;
+
+	int32_t x, y;  // position in the layout
 	uint32_t width, height;
 	int32_t scale;
 	uint32_t pref_fract_scale;
@@ -85,38 +211,468 @@ struct swaybg_output {
 	bool dirty, needs_ack;
 	// dimensions of the wl_buffer attached to the wl_surface
 	uint32_t buffer_width, buffer_height;
+	// scale divisor of the quality level it was drawn at: the animation
+	// runs at the buffer size times this, and is scaled down when drawn
+	int buffer_div;
+	// size changes are held back until the given CLOCK_MONOTONIC time, in
+	// a window opened at settle_since; the last buffer size held back
+	uint64_t settle_since, settle_until;
+	uint32_t pending_width, pending_height;
+	// removed at the given CLOCK_MONOTONIC time, waiting to be revived
+	uint64_t parked_since;
+	// animation size of a revived output, until its first frame on the new
+	// surface
+	uint32_t revived_width, revived_height;
+
+	struct wl_list link;
+};
 
+struct swaybg_toplevel {
+	struct swaybg_state *state;
+	struct zwlr_foreign_toplevel_handle_v1 *handle;
+	// struct wl_output *, as of the last done event and as received since
+	struct wl_array outputs, pending_outputs;
+	// fullscreen and not minimized
+	bool fullscreen, pending_fullscreen;
 	struct wl_list link;
 };
 
-// Create a wl_buffer with the specified dimensions and content
-static struct wl_buffer *draw_buffer(struct swaybg_output *output,
+static uint32_t get_bg_color(const struct swaybg_output_config *config) {
+	return config->color ? config->color : 0x000000ff;
+}
+
+// Decode and scale the image of the output's config for the given buffer
+// size, or map a previously scaled copy from the image cache
+static cairo_surface_t *load_output_background(struct swaybg_output *output,
 		uint32_t buffer_width, uint32_t buffer_height) {
-	uint32_t bg_color = output->config->color ? output->config->color : 0x000000ff;
+	struct swaybg_output_config *config = output->config;
+	struct swaybg_image *image = config->image;
 
-	struct pool_buffer buffer;
-	if (!create_buffer(&buffer, output->state->shm,
-			buffer_width, buffer_height, WL_SHM_FORMAT_XRGB8888)) {
+	if (!image->hashed) {
+		image->hashed = image_cache_hash_file(image->path,
+			&image->content_hash);
+	}
+	struct image_cache_key key = {
+		.content_hash = image->content_hash,
+		.width = buffer_width,
+		.height = buffer_height,
+		.mode = config->mode,
+		.color = get_bg_color(config),
+	};
+	cairo_surface_t *surface = NULL;
+	if (image->hashed) {
+		surface = image_cache_load(&key);
+		if (surface) {
+			return surface;
+		}
+	}
+
+	if (!image->surface) {
+		image->surface = load_background_image(image->path);
+		if (!image->surface) {
+			image->failed = true;
+			return NULL;
+		}
+	}
+
+	surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+		buffer_width, buffer_height);
+	if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(surface);
 		return NULL;
 	}
+	cairo_t *cairo = cairo_create(surface);
+	cairo_set_source_u32(cairo, get_bg_color(config));
+	cairo_paint(cairo);
+	render_background_image(cairo, image->surface, config->mode,
+		buffer_width, buffer_height);
+	cairo_destroy(cairo);
+
+	if (image->hashed) {
+		image_cache_store(&key, surface);
+	}
+	return surface;
+}
 
-	cairo_t *cairo = buffer.cairo;
-	cairo_set_source_u32(cairo, bg_color);
+static cairo_surface_t *create_color_background(struct swaybg_output *output,
+		uint32_t buffer_width, uint32_t buffer_height) {
+	cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+		buffer_width, buffer_height);
+	if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(surface);
+		return NULL;
+	}
+	cairo_t *cairo = cairo_create(surface);
+	cairo_set_source_u32(cairo, get_bg_color(output->config));
 	cairo_paint(cairo);
+	anim_draw_background(cairo, buffer_width, buffer_height);
+	cairo_destroy(cairo);
+	return surface;
+}
 
-	output->actx = render_anim(cairo, output->actx, buffer_width, buffer_height);
+// Return the background layer of the output at the given buffer size
+static cairo_surface_t *get_output_background(struct swaybg_output *output,
+		uint32_t buffer_width, uint32_t buffer_height) {
+	if (output->background) {
+		if ((uint32_t)cairo_image_surface_get_width(output->background) ==
+				buffer_width &&
+				(uint32_t)cairo_image_surface_get_height(output->background) ==
+				buffer_height) {
+			return output->background;
+		}
+		cairo_surface_destroy(output->background);
+		output->background = NULL;
+	}
+
+	struct swaybg_output_config *config = output->config;
+	if (config->image && !config->image->failed &&
+			config->mode != BACKGROUND_MODE_SOLID_COLOR) {
+		output->background = load_output_background(output,
+			buffer_width, buffer_height);
+	}
+	if (!output->background) {
+		output->background = create_color_background(output,
+			buffer_width, buffer_height);
+	}
 
-	// return wl_buffer for caller to use and destroy
-	struct wl_buffer *wl_buf = buffer.buffer;
-	buffer.buffer = NULL;
-	destroy_buffer(&buffer);
-	return wl_buf;
+	// The buffers have a different size or show an older background, so
+	// they need to be filled completely
+	damage_set_full(&output->buffer_damage[0]);
+	damage_set_full(&output->buffer_damage[1]);
+	return output->background;
+}
+
+// Copy the damaged area of the background layer into the buffer
+static void restore_background(struct pool_buffer *buffer,
+		cairo_surface_t *background, const struct damage *damage) {
+	int stride = cairo_image_surface_get_stride(buffer->surface);
+	assert(stride == cairo_image_surface_get_stride(background));
+
+	cairo_surface_flush(buffer->surface);
+	cairo_surface_flush(background);
+	damage_copy(damage, buffer->data,
+		cairo_image_surface_get_data(background), stride, buffer->height);
+	cairo_surface_mark_dirty(buffer->surface);
+}
+
+// Return the trail of the output at the given buffer size and divisor, or
+// NULL if it draws the recent traces only
+static struct trail *get_output_trail(struct swaybg_output *output,
+		uint32_t buffer_width, uint32_t buffer_height, int div) {
+	if (!output->config->trail_length || output->config->span) {
+		return NULL;
+	}
+	if (output->trail && (uint32_t)output->trail->width == buffer_width &&
+			(uint32_t)output->trail->height == buffer_height &&
+			output->trail->div == div) {
+		return output->trail;
+	}
+	struct trail *trail = trail_create(buffer_width, buffer_height, div,
+		output->config->trail_length);
+	if (trail && output->trail) {
+		// Keep the footprints when the output or the quality changes size
+		trail_scale_from(trail, output->trail);
+	}
+	trail_destroy(output->trail);
+	output->trail = trail;
+	return output->trail;
+}
+
+// Advance the animation by one step: replay the recorded walk, or simulate
+// one and record it if asked to
+static void advance_output_anim(struct swaybg_output *output,
+		uint32_t buffer_width, uint32_t buffer_height) {
+	struct swaybg_output_config *config = output->config;
+	if (config->replay) {
+		if (!output->actx) {
+			output->actx = replay_create_context(config->replay);
+			output->replay_cursor = (struct replay_cursor){0};
+		}
+		if (output->actx) {
+			replay_step(config->replay, &output->replay_cursor,
+				output->actx, buffer_width, buffer_height);
+		}
+		return;
+	}
+
+	if (!output->actx) {
+		output->actx = anim_create(&anim_default_config,
+			buffer_width, buffer_height);
+	}
+	if (!output->actx) {
+		return;
+	}
+	output->actx = anim_step(output->actx, buffer_width, buffer_height);
+	if (!output->actx) {
+		return;
+	}
+
+	if (config->record_path && !config->recording) {
+		// Only the first output using the config gets recorded
+		config->recording = true;
+		output->recorder = recorder_create(config->record_path,
+			&output->actx->cf, buffer_width, buffer_height);
+	}
+	if (output->recorder && !recorder_step(output->recorder, output->actx)) {
+		swaybg_log_errno(LOG_ERROR, "Failed to write recording %s, "
+			"stopping", config->record_path);
+		recorder_destroy(output->recorder);
+		output->recorder = NULL;
+	}
+}
+
+static const char *get_output_key_name(const struct swaybg_output *output) {
+	return output->name ? output->name : "";
+}
+
+// Show the animation another instance publishes for this output, return
+// false if there is none
+static bool follow_published_anim(struct swaybg_output *output,
+		uint32_t buffer_width, uint32_t buffer_height) {
+	const char *key = output->config->attach_key;
+	if (!output->subscriber) {
+		output->subscriber =
+			handoff_attach(key, get_output_key_name(output));
+		if (!output->subscriber) {
+			return false;
+		}
+		swaybg_log(LOG_DEBUG, "Output %s follows the animation published "
+			"as %s", output->name, key);
+	}
+	if (handoff_read(output->subscriber, &output->actx,
+			buffer_width, buffer_height)) {
+		return true;
+	}
+	// Go on with the bird from where the publisher left it
+	swaybg_log(LOG_DEBUG, "Animation %s of output %s is not published "
+		"anymore", key, output->name);
+	handoff_detach(output->subscriber);
+	output->subscriber = NULL;
+	return false;
+}
+
+static void publish_output_anim(struct swaybg_output *output,
+		uint32_t buffer_width, uint32_t buffer_height) {
+	struct swaybg_output_config *config = output->config;
+	if (output->publisher && !handoff_update(output->publisher,
+			output->actx, buffer_width, buffer_height)) {
+		// The animation settings changed, e.g. for a replay
+		handoff_unpublish(output->publisher);
+		output->publisher = NULL;
+	}
+	if (output->publisher) {
+		return;
+	}
+	output->publisher = handoff_publish(config->publish_key,
+		get_output_key_name(output), &output->actx->cf);
+	if (!output->publisher) {
+		swaybg_log(LOG_ERROR, "Not publishing the animation as %s",
+			config->publish_key);
+		free(config->publish_key);
+		config->publish_key = NULL;
+		return;
+	}
+	handoff_update(output->publisher, output->actx,
+		buffer_width, buffer_height);
+}
+
+// Step the birds besides the one of actx
+static void step_output_flock(struct swaybg_output *output,
+		uint32_t buffer_width, uint32_t buffer_height) {
+	if (output->config->birds <= 1) {
+		return;
+	}
+	if (!output->flock) {
+		output->flock = flock_create(output->actx ? &output->actx->cf :
+			&anim_default_config, output->config->birds - 1,
+			buffer_width, buffer_height);
+	}
+	if (output->flock) {
+		flock_step(output->flock, output->actx, buffer_width, buffer_height);
+	}
+}
+
+// Advance the animation by one step, or follow the one of another instance
+static void step_output_anim(struct swaybg_output *output,
+		uint32_t buffer_width, uint32_t buffer_height) {
+	struct swaybg_output_config *config = output->config;
+	output->stats.steps++;
+	if (config->attach_key &&
+			follow_published_anim(output, buffer_width, buffer_height)) {
+		step_output_flock(output, buffer_width, buffer_height);
+		return;
+	}
+	advance_output_anim(output, buffer_width, buffer_height);
+	if (config->publish_key && output->actx) {
+		publish_output_anim(output, buffer_width, buffer_height);
+	}
+	step_output_flock(output, buffer_width, buffer_height);
+}
+
+// Like the quality level, the footprint is set on the contexts before
+// drawing, since stepping may replace them
+static void set_output_glyph(struct swaybg_output *output) {
+	const struct glyph *glyph = output->config->glyph;
+	if (output->actx) {
+		output->actx->glyph = glyph;
+	}
+	for (int i = 0; output->flock && i < output->flock->count; i++) {
+		if (output->flock->birds[i]) {
+			output->flock->birds[i]->glyph = glyph;
+		}
+	}
+}
+
+static void draw_traces(struct swaybg_output *output,
+		struct pool_buffer *buffer, int div, cairo_surface_t *background,
+		bool step, struct damage *changed) {
+	// Only the traces drawn into this buffer last time need to be erased
+	struct damage *damage = &output->buffer_damage[buffer - output->buffers];
+	restore_background(buffer, background, damage);
+
+	damage_clear(damage);
+	const struct governor_quality *quality =
+		governor_get_quality(&output->governor);
+	struct swaybg_span *span = &output->state->span;
+	if (output->config->span) {
+		// Only the part of the shared animation within the output, which
+		// the main loop already advanced
+		if (span->actx) {
+			span->actx->decay_levels = quality->decay_levels;
+			span->actx->glyph = output->config->glyph;
+			struct anim_view view = {
+				.x = output->x - span->x,
+				.y = output->y - span->y,
+				.width = output->width,
+				.height = output->height,
+				.buffer_width = buffer->width,
+				.buffer_height = buffer->height,
+			};
+			anim_draw_view(buffer->cairo, span->actx, &view);
+			anim_damage_view(span->actx, &view, damage);
+		}
+	} else {
+		// The animation keeps its size when buffers are drawn smaller
+		struct anim_view view = {
+			.width = buffer->width * div,
+			.height = buffer->height * div,
+			.buffer_width = buffer->width,
+			.buffer_height = buffer->height,
+		};
+		if (step) {
+			step_output_anim(output, view.width, view.height);
+		} else if (output->config->attach_key) {
+			// Show where the other instance's bird is right now
+			follow_published_anim(output, view.width, view.height);
+		}
+		set_output_glyph(output);
+		if (output->actx) {
+			output->actx->decay_levels = quality->decay_levels;
+			anim_draw_view(buffer->cairo, output->actx, &view);
+			anim_damage_view(output->actx, &view, damage);
+		}
+		if (output->flock) {
+			flock_draw(output->flock, buffer->cairo,
+				quality->decay_levels, &view);
+			flock_damage(output->flock, damage, &view);
+		}
+	}
+
+	*changed = *damage;
+	damage_add(changed, &output->trace_damage);
+	output->trace_damage = *damage;
+}
+
+static void draw_trail(struct swaybg_output *output, struct trail *trail,
+		struct pool_buffer *buffer, cairo_surface_t *background,
+		bool step, struct damage *changed) {
+	damage_clear(changed);
+	if (step) {
+		step_output_anim(output, buffer->width * trail->div,
+			buffer->height * trail->div);
+		set_output_glyph(output);
+		trail_step(trail, output->actx, changed);
+		for (int i = 0; output->flock && i < output->flock->count; i++) {
+			trail_stamp(trail, output->flock->birds[i], changed);
+		}
+	}
+
+	// Besides this step's changes, this buffer still misses those made
+	// while the other one was drawn
+	int index = buffer - output->buffers;
+	struct damage *damage = &output->buffer_damage[index];
+	damage_add(damage, changed);
+	restore_background(buffer, background, damage);
+	trail_draw(trail, buffer->cairo, damage);
+	damage_clear(damage);
+	damage_add(&output->buffer_damage[!index], changed);
+}
+
+// Show the background only, leaving the animation state alone
+static void draw_static(struct swaybg_output *output,
+		struct pool_buffer *buffer, cairo_surface_t *background,
+		struct damage *changed) {
+	// Both buffers have to be redrawn completely once the animation goes on
+	damage_set_full(&output->buffer_damage[0]);
+	damage_set_full(&output->buffer_damage[1]);
+	restore_background(buffer, background,
+		&output->buffer_damage[buffer - output->buffers]);
+	damage_clear(&output->trace_damage);
+	damage_set_full(changed);
+}
+
+// Draw the next frame into a buffer of the output's pool, or return NULL if
+// the compositor still uses both of them. The animation runs at `div` times
+// the buffer size and only advances if `step` is set. `changed` receives
+// the area that differs from the previous frame.
+static struct pool_buffer *draw_buffer(struct swaybg_output *output,
+		uint32_t buffer_width, uint32_t buffer_height, int div, bool step,
+		struct damage *changed) {
+	cairo_surface_t *background =
+		get_output_background(output, buffer_width, buffer_height);
+	if (!background) {
+		return NULL;
+	}
+
+	struct pool_buffer *buffer = get_next_buffer(output->state->shm,
+		output->buffers, output->shown, buffer_width, buffer_height,
+		WL_SHM_FORMAT_XRGB8888);
+	if (!buffer) {
+		return NULL;
+	}
+
+	struct trail *trail =
+		get_output_trail(output, buffer_width, buffer_height, div);
+	cairo_set_antialias(buffer->cairo,
+		governor_get_quality(&output->governor)->antialias);
+	if (output->anim_state == ANIM_FROZEN) {
+		draw_static(output, buffer, background, changed);
+	} else if (trail) {
+		draw_trail(output, trail, buffer, background, step, changed);
+	} else {
+		draw_traces(output, buffer, div, background, step, changed);
+	}
+	return buffer;
+}
+
+static void damage_surface(struct wl_surface *surface,
+		const struct damage *damage,
+		uint32_t buffer_width, uint32_t buffer_height) {
+	if (damage->full) {
+		wl_surface_damage_buffer(surface, 0, 0, buffer_width, buffer_height);
+		return;
+	}
+	for (int i = 0; i < damage->n_rects; i++) {
+		const struct damage_rect *r = &damage->rects[i];
+		wl_surface_damage_buffer(surface, r->x, r->y, r->width, r->height);
+	}
 }
 
 #define FRACT_DENOM 120
 
-// Return the size of the buffer that should be attached to this output
-static void get_buffer_size(const struct swaybg_output *output,
+// Return the size of the buffer that should be attached to this output, and
+// the divisor applied to it by the quality level
+static int get_buffer_size(const struct swaybg_output *output,
 		uint32_t *buffer_width, uint32_t *buffer_height) {
 	if (output->pref_fract_scale && output->state->viewporter) {
 		// rounding mode is 'round half up'
@@ -128,24 +684,228 @@ static void get_buffer_size(const struct swaybg_output *output,
 		*buffer_width = output->width * output->scale;
 		*buffer_height = output->height * output->scale;
 	}
+	// The compositor scales the buffer up to the output size
+	int div = governor_get_quality(&output->governor)->scale_div;
+	if (!output->viewport || div <= 1) {
+		return 1;
+	}
+	*buffer_width = (*buffer_width + div - 1) / div;
+	*buffer_height = (*buffer_height + div - 1) / div;
+	return div;
 }
 
-static void render_frame(struct swaybg_output *output) {
-	uint32_t buffer_width, buffer_height;
-	get_buffer_size(output, &buffer_width, &buffer_height);
+// Return the output that already drew a frame for this output's mirror
+// group during the current tick, if its buffer can be reused as is
+static struct swaybg_output *find_mirror_leader(struct swaybg_output *output,
+		uint32_t buffer_width, uint32_t buffer_height) {
+	const char *group = output->config->mirror_group;
+	if (!group) {
+		return NULL;
+	}
+	struct swaybg_output *other;
+	wl_list_for_each(other, &output->state->outputs, link) {
+		if (other == output) {
+			break;
+		}
+		if (other->frame_buffer && other->config->mirror_group &&
+				strcmp(other->config->mirror_group, group) == 0 &&
+				other->buffer_width == buffer_width &&
+				other->buffer_height == buffer_height) {
+			return other;
+		}
+	}
+	return NULL;
+}
+
+static uint64_t get_time_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
-	// Attach a new buffer if the desired size has changed
-	struct wl_buffer *buf = draw_buffer(output, buffer_width, buffer_height);
-	if (!buf) {
+// Hotplug and mode changes come with bursts of configure and scale events:
+// wait for the size to stop changing before allocating buffers for it, but
+// not forever
+#define SETTLE_MS 150
+#define SETTLE_MAX_MS 1000
+
+static bool is_settling(const struct swaybg_output *output) {
+	return output->settle_until > get_time_ns();
+}
+
+// Open or extend the settle window after an event that may change the size
+static void start_settling(struct swaybg_output *output) {
+	if (output->buffer_width == 0) {
+		// Nothing shown yet, draw the first frame right away
 		return;
 	}
+	uint64_t now = get_time_ns();
+	if (output->settle_until <= now) {
+		output->settle_since = now;
+	}
+	uint64_t limit = output->settle_since + SETTLE_MAX_MS * 1000000ull;
+	output->settle_until = now + SETTLE_MS * 1000000ull;
+	if (output->settle_until > limit) {
+		output->settle_until = limit;
+	}
+}
 
-	wl_surface_attach(output->surface, buf, 0, 0);
-	wl_surface_damage_buffer(output->surface, 0, 0,
+// While the size settles, keep drawing into the current buffers, which the
+// viewport scales to the output, and count the sizes skipped on the way.
+// Returns false if the frame has to wait for the final size instead.
+static bool settle_buffer_size(struct swaybg_output *output,
+		uint32_t *buffer_width, uint32_t *buffer_height) {
+	bool changed = *buffer_width != output->buffer_width ||
+		*buffer_height != output->buffer_height;
+	if (output->buffer_width == 0 || !is_settling(output)) {
+		if (output->pending_width && !changed) {
+			// Back to the current size, nothing to allocate after all
+			output->stats.coalesced++;
+		}
+		output->pending_width = output->pending_height = 0;
+		return true;
+	}
+	if (!changed) {
+		return true;
+	}
+	if (output->pending_width && (output->pending_width != *buffer_width ||
+			output->pending_height != *buffer_height)) {
+		output->stats.coalesced++;
+	}
+	output->pending_width = *buffer_width;
+	output->pending_height = *buffer_height;
+	if (!output->viewport) {
+		// The buffer scale could not match the old size
+		return false;
+	}
+	*buffer_width = output->buffer_width;
+	*buffer_height = output->buffer_height;
+	return true;
+}
+
+// Milliseconds until the first output waiting for its size to settle can be
+// drawn, or -1 if there is none
+static int get_settle_timeout(struct swaybg_state *state) {
+	uint64_t now = get_time_ns();
+	int timeout = -1;
+	struct swaybg_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		if (!output->dirty || output->settle_until <= now) {
+			continue;
+		}
+		int ms = (output->settle_until - now + 999999) / 1000000;
+		if (timeout < 0 || ms < timeout) {
+			timeout = ms;
+		}
+	}
+	return timeout;
+}
+
+static uint64_t get_thread_time_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Adjust the rendering quality to the CPU time the frame took
+static void govern_output(struct swaybg_output *output, uint64_t frame_ns) {
+	uint64_t budget_ns = output->config->budget_ms ?
+		(uint64_t)output->config->budget_ms * 1000000 :
+		// A quarter of the step period by default
+		60000000000ull / output->state->rate / 4;
+	if (governor_sample(&output->governor, frame_ns, budget_ns)) {
+		swaybg_log(LOG_INFO, "Output %s: quality level %d (%s), "
+			"frames took %.2f ms for a budget of %.2f ms", output->name,
+			output->governor.level,
+			governor_get_quality(&output->governor)->name,
+			frame_ns / 1e6, budget_ns / 1e6);
+	}
+}
+
+static void render_frame(struct swaybg_output *output, bool step) {
+	uint32_t buffer_width, buffer_height;
+	int div = get_buffer_size(output, &buffer_width, &buffer_height);
+	if (!settle_buffer_size(output, &buffer_width, &buffer_height)) {
+		return;
+	}
+
+	bool resized = buffer_width != output->buffer_width ||
+		buffer_height != output->buffer_height;
+	if (!resized) {
+		// Still the current buffers, e.g. while the size settles
+		div = output->buffer_div;
+	}
+	struct swaybg_output *leader =
+		find_mirror_leader(output, buffer_width, buffer_height);
+	if (leader) {
+		// The group leader runs the simulation for all of us
+		if (output->actx) {
+			anim_done(output->actx);
+			output->actx = NULL;
+		}
+		flock_destroy(output->flock);
+		output->flock = NULL;
+		// Our surface changes like the leader's if it showed its last
+		// frame too
+		if (resized || output->mirrored != leader) {
+			damage_set_full(&output->frame_damage);
+		} else {
+			output->frame_damage = leader->frame_damage;
+		}
+		output->mirrored = leader;
+		wl_surface_attach(output->surface, leader->frame_buffer, 0, 0);
+	} else {
+		// Carry on with the bird where it was rather than where the old
+		// coordinates land, also after the output got revived
+		uint32_t anim_width = output->buffer_width ?
+			output->buffer_width * output->buffer_div : output->revived_width;
+		uint32_t anim_height = output->buffer_width ?
+			output->buffer_height * output->buffer_div :
+			output->revived_height;
+		if (anim_width > 0 && (anim_width != buffer_width * div ||
+				anim_height != buffer_height * div)) {
+			if (output->actx) {
+				anim_rescale(output->actx, anim_width, anim_height,
+					buffer_width * div, buffer_height * div);
+			}
+			if (output->flock) {
+				flock_rescale(output->flock, anim_width, anim_height,
+					buffer_width * div, buffer_height * div);
+			}
+		}
+		uint64_t start = get_time_ns();
+		uint64_t cpu_start = get_thread_time_ns();
+		struct pool_buffer *buffer = draw_buffer(output,
+			buffer_width, buffer_height, div, step, &output->frame_damage);
+		if (!buffer) {
+			output->stats.skipped++;
+			return;
+		}
+		uint64_t draw_ns = get_time_ns() - start;
+		// Frames which rebuilt the background say little about the next
+		if (!resized) {
+			govern_output(output, get_thread_time_ns() - cpu_start);
+		}
+		output->stats.drawn++;
+		output->stats.draw_ns += draw_ns;
+		if (draw_ns > output->stats.draw_max_ns) {
+			output->stats.draw_max_ns = draw_ns;
+		}
+		if (resized || output->mirrored) {
+			damage_set_full(&output->frame_damage);
+		}
+		output->mirrored = NULL;
+		output->frame_buffer = buffer->buffer;
+		output->shown = buffer;
+		wl_surface_attach(output->surface, buffer->buffer, 0, 0);
+	}
+	damage_surface(output->surface, &output->frame_damage,
 		buffer_width, buffer_height);
 
+	output->revived_width = output->revived_height = 0;
 	output->buffer_width = buffer_width;
 	output->buffer_height = buffer_height;
+	output->buffer_div = div;
 
 	if (output->viewport) {
 		wp_viewport_set_destination(output->viewport, output->width, output->height);
@@ -153,9 +913,80 @@ static void render_frame(struct swaybg_output *output) {
 		wl_surface_set_buffer_scale(output->surface, output->scale);
 	}
 	wl_surface_commit(output->surface);
-	if (buf) {
-		wl_buffer_destroy(buf);
+	startup_mark(STARTUP_COMMIT);
+	// Drawn at the size held back while it settles, the final one follows
+	output->dirty = output->pending_width != 0;
+	output->stats.frames++;
+}
+
+// Forget the buffers drawn during this tick once every mirror group member
+// had the chance to attach them
+static void release_frame_buffers(struct swaybg_state *state) {
+	struct swaybg_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		output->frame_buffer = NULL;
+	}
+}
+
+static void destroy_swaybg_image(struct swaybg_image *image) {
+	if (!image) {
+		return;
+	}
+	if (image->surface != NULL) {
+		cairo_surface_destroy(image->surface);
+	}
+	wl_list_remove(&image->link);
+	free(image);
+}
+
+// Keep decoded images this long after the last output got its scaled copy,
+// for outputs configured late, at another size or plugged in again
+#define IMAGE_UNLOAD_MS 10000
+
+// Whether an output showing the image still has to draw its background.
+// Powered off ones have to as well, but not any time soon.
+static bool is_image_pending(struct swaybg_state *state,
+		const struct swaybg_image *image) {
+	struct swaybg_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		if (output->config && output->config->image == image &&
+				!output->background && !output->powered_off) {
+			return true;
+		}
 	}
+	return false;
+}
+
+// Decoded images are only needed until every output has its scaled copy,
+// unload them a while after, return the milliseconds until the next one is
+// due or -1
+static int unload_images(struct swaybg_state *state) {
+	uint64_t now = get_time_ns();
+	int timeout = -1;
+	struct swaybg_image *image;
+	wl_list_for_each(image, &state->images, link) {
+		if (image->surface == NULL) {
+			continue;
+		}
+		if (is_image_pending(state, image)) {
+			image->unload_at = 0;
+			continue;
+		}
+		if (!image->unload_at) {
+			image->unload_at = now + IMAGE_UNLOAD_MS * 1000000ull;
+		}
+		if (image->unload_at > now) {
+			int ms = (image->unload_at - now + 999999) / 1000000;
+			if (timeout < 0 || ms < timeout) {
+				timeout = ms;
+			}
+			continue;
+		}
+		cairo_surface_destroy(image->surface);
+		image->surface = NULL;
+		image->unload_at = 0;
+	}
+	return timeout;
 }
 
 static void destroy_swaybg_output_config(struct swaybg_output_config *config) {
@@ -164,33 +995,401 @@ static void destroy_swaybg_output_config(struct swaybg_output_config *config) {
 	}
 	wl_list_remove(&config->link);
 	free(config->output);
+	free((char *)config->image_path);
+	free(config->mirror_group);
+	free(config->record_path);
+	free(config->replay_path);
+	free(config->footprint_path);
+	free(config->publish_key);
+	free(config->attach_key);
+	replay_close(config->replay);
+	glyph_destroy(config->glyph);
 	free(config);
 }
 
-static void destroy_swaybg_output(struct swaybg_output *output) {
-	if (!output) {
+// Pass the running animation of a departing mirror group leader on to another
+// member of the same size, so that the group keeps its bird
+static void hand_over_mirror_anim(struct swaybg_output *output) {
+	if (!output->config || !output->config->mirror_group) {
 		return;
 	}
-	wl_list_remove(&output->link);
+	struct swaybg_output *other;
+	wl_list_for_each(other, &output->state->outputs, link) {
+		if (other != output && !other->actx && other->config &&
+				other->config->mirror_group &&
+				strcmp(other->config->mirror_group,
+					output->config->mirror_group) == 0 &&
+				other->buffer_width == output->buffer_width &&
+				other->buffer_height == output->buffer_height &&
+				other->buffer_div == output->buffer_div) {
+			other->actx = output->actx;
+			other->replay_cursor = output->replay_cursor;
+			other->flock = output->flock;
+			output->actx = NULL;
+			output->flock = NULL;
+			return;
+		}
+	}
+}
+
+static void remove_toplevel_output(struct wl_array *outputs,
+		struct wl_output *wl_output) {
+	struct wl_output **entries = outputs->data;
+	size_t n = outputs->size / sizeof(*entries);
+	for (size_t i = 0; i < n; i++) {
+		if (entries[i] == wl_output) {
+			entries[i] = entries[n - 1];
+			outputs->size -= sizeof(*entries);
+			return;
+		}
+	}
+}
+
+static bool is_output_suspended(const struct swaybg_output *output) {
+	return output->covered || output->powered_off;
+}
+
+// Catch up with the steps missed while the output was suspended. Only the
+// last few of them leave visible traces. Trails are left as they are, as
+// stamping every missed footprint would stall the frame.
+static void fast_forward_output(struct swaybg_output *output) {
+	uint64_t elapsed_ms =
+		(get_time_ns() - output->suspended_since) / 1000000;
+	uint64_t steps = elapsed_ms * output->state->rate / 60000;
+	swaybg_log(LOG_DEBUG, "Output %s is visible again after %llu steps",
+		output->name, (unsigned long long)steps);
+	// At the animation size, which buffers drawn smaller are a fraction of
+	uint32_t buffer_width = output->buffer_width * output->buffer_div;
+	uint32_t buffer_height = output->buffer_height * output->buffer_div;
+	struct replay *replay = output->config ? output->config->replay : NULL;
+	if (output->rebuild_anim && output->width > 0) {
+		// The context was dropped while the output was powered off
+		int div = get_buffer_size(output, &buffer_width, &buffer_height);
+		buffer_width *= div;
+		buffer_height *= div;
+		output->actx = replay ? replay_create_context(replay) :
+			anim_create(&anim_default_config, buffer_width, buffer_height);
+	}
+	output->rebuild_anim = false;
+	if (!output->actx || output->trail ||
+			output->anim_state != ANIM_RUNNING || buffer_width == 0) {
+		return;
+	}
+	if (replay) {
+		replay_seek(replay, &output->replay_cursor, output->actx,
+			(output->replay_cursor.step + steps) % replay->steps,
+			buffer_width, buffer_height);
+	} else {
+		output->actx = anim_fast_forward(output->actx,
+			steps > INT_MAX ? INT_MAX : (int)steps,
+			buffer_width, buffer_height);
+	}
+	output->stats.steps += steps;
+}
+
+// Start counting the missed steps when the output gets suspended, and catch
+// up once it is neither covered nor powered off anymore
+static void update_suspended(struct swaybg_output *output, bool was_suspended) {
+	bool suspended = is_output_suspended(output);
+	if (suspended == was_suspended) {
+		return;
+	}
+	if (suspended) {
+		output->suspended_since = get_time_ns();
+	} else {
+		fast_forward_output(output);
+	}
+}
+
+// Suspend the outputs under a fullscreen toplevel, and catch up on those
+// which became visible again
+static void update_covered_outputs(struct swaybg_state *state) {
+	struct swaybg_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		bool covered = false;
+		struct swaybg_toplevel *toplevel;
+		wl_list_for_each(toplevel, &state->toplevels, link) {
+			if (!toplevel->fullscreen) {
+				continue;
+			}
+			struct wl_output **wl_output;
+			wl_array_for_each(wl_output, &toplevel->outputs) {
+				covered |= *wl_output == output->wl_output;
+			}
+		}
+		if (covered == output->covered) {
+			continue;
+		}
+		bool was_suspended = is_output_suspended(output);
+		output->covered = covered;
+		if (covered) {
+			swaybg_log(LOG_DEBUG, "Output %s is under a fullscreen window, "
+				"suspending", output->name);
+		}
+		update_suspended(output, was_suspended);
+	}
+}
+
+// Give back the memory of an output nobody can see until it is powered on
+// again: its buffers, the background at buffer size and the animation
+// context. Trails are kept, as they cannot be rebuilt.
+static void release_output_memory(struct swaybg_output *output) {
+	destroy_buffer(&output->buffers[0]);
+	destroy_buffer(&output->buffers[1]);
+	if (output->background != NULL) {
+		cairo_surface_destroy(output->background);
+		output->background = NULL;
+	}
+	if (output->actx != NULL) {
+		hand_over_mirror_anim(output);
+	}
+	if (output->actx != NULL) {
+		anim_done(output->actx);
+		output->actx = NULL;
+		output->rebuild_anim = true;
+	}
+	// The other birds start over
+	flock_destroy(output->flock);
+	output->flock = NULL;
+	// The first frame after power on fills a new buffer completely
+	output->buffer_width = output->buffer_height = 0;
+	output->frame_buffer = NULL;
+#if HAVE_MALLOC_TRIM
+	malloc_trim(0);
+#endif
+}
+
+static void output_power_mode(void *data, struct zwlr_output_power_v1 *power,
+		uint32_t mode) {
+	struct swaybg_output *output = data;
+	bool powered_off = mode == ZWLR_OUTPUT_POWER_V1_MODE_OFF;
+	if (powered_off == output->powered_off) {
+		return;
+	}
+	bool was_suspended = is_output_suspended(output);
+	output->powered_off = powered_off;
+	if (powered_off) {
+		swaybg_log(LOG_DEBUG, "Output %s is powered off, suspending",
+			output->name);
+		release_output_memory(output);
+	}
+	update_suspended(output, was_suspended);
+}
+
+static void output_power_failed(void *data,
+		struct zwlr_output_power_v1 *power) {
+	// The output does not support power management, or another client
+	// controls it
+	struct swaybg_output *output = data;
+	swaybg_log(LOG_DEBUG, "Not tracking the power mode of output %s",
+		output->name);
+	zwlr_output_power_v1_destroy(power);
+	output->power = NULL;
+	output_power_mode(output, NULL, ZWLR_OUTPUT_POWER_V1_MODE_ON);
+}
+
+static const struct zwlr_output_power_v1_listener output_power_listener = {
+	.mode = output_power_mode,
+	.failed = output_power_failed,
+};
+
+// Destroy the Wayland objects of an output and drop the references others
+// hold to it
+static void detach_swaybg_output(struct swaybg_output *output) {
 	if (output->layer_surface != NULL) {
 		zwlr_layer_surface_v1_destroy(output->layer_surface);
+		output->layer_surface = NULL;
 	}
 	if (output->surface != NULL) {
 		wl_surface_destroy(output->surface);
+		output->surface = NULL;
 	}
 	if (output->viewport != NULL) {
 		wp_viewport_destroy(output->viewport);
+		output->viewport = NULL;
+	}
+	if (output->fract_scale != NULL) {
+		wp_fractional_scale_v1_destroy(output->fract_scale);
+		output->fract_scale = NULL;
+	}
+	if (output->power != NULL) {
+		zwlr_output_power_v1_destroy(output->power);
+		output->power = NULL;
+	}
+	if (output->actx != NULL) {
+		hand_over_mirror_anim(output);
+	}
+	struct swaybg_output *other;
+	wl_list_for_each(other, &output->state->outputs, link) {
+		if (other->mirrored == output) {
+			other->mirrored = NULL;
+		}
+	}
+	if (output->wl_output != NULL) {
+		struct swaybg_toplevel *toplevel;
+		wl_list_for_each(toplevel, &output->state->toplevels, link) {
+			remove_toplevel_output(&toplevel->outputs, output->wl_output);
+			remove_toplevel_output(&toplevel->pending_outputs,
+				output->wl_output);
+		}
+		wl_output_destroy(output->wl_output);
+		output->wl_output = NULL;
+	}
+}
+
+static void destroy_swaybg_output(struct swaybg_output *output) {
+	if (!output) {
+		return;
+	}
+	wl_list_remove(&output->link);
+	detach_swaybg_output(output);
+	if (output->actx != NULL) {
+		anim_done(output->actx);
+	}
+	flock_destroy(output->flock);
+	recorder_destroy(output->recorder);
+	handoff_unpublish(output->publisher);
+	handoff_detach(output->subscriber);
+	trail_destroy(output->trail);
+	destroy_buffer(&output->buffers[0]);
+	destroy_buffer(&output->buffers[1]);
+	if (output->background != NULL) {
+		cairo_surface_destroy(output->background);
+	}
+	free(output->name);
+	free(output->identifier);
+	free(output);
+}
+
+// Docking, undocking and KVM switches remove outputs which come back soon.
+// Their animation, trail and buffers are kept for a few of them, and the
+// buffers only for a while, see revive_parked_output().
+#define PARKED_OUTPUTS_MAX 4
+#define PARKED_BUFFERS_MS 60000
+
+// Keep the state of a removed output around instead of destroying it
+static void park_swaybg_output(struct swaybg_output *output) {
+	struct swaybg_state *state = output->state;
+	if (!output->config || !output->layer_surface ||
+			(!output->identifier && !output->name)) {
+		destroy_swaybg_output(output);
+		return;
+	}
+	swaybg_log(LOG_DEBUG, "Parking output %s (%s)",
+			output->name, output->identifier);
+	wl_list_remove(&output->link);
+	detach_swaybg_output(output);
+
+	uint64_t now = get_time_ns();
+	if (!is_output_suspended(output)) {
+		output->suspended_since = now;
+	}
+	output->covered = output->powered_off = false;
+	// Powered off outputs lost their animation, a new one starts
+	output->rebuild_anim = false;
+	output->dirty = output->needs_ack = false;
+	output->settle_since = output->settle_until = 0;
+	output->pending_width = output->pending_height = 0;
+	output->frame_buffer = NULL;
+	output->shown = NULL;
+	output->mirrored = NULL;
+	output->parked_since = now;
+	wl_list_insert(&state->parked, &output->link);
+
+	if (wl_list_length(&state->parked) > PARKED_OUTPUTS_MAX) {
+		struct swaybg_output *oldest =
+			wl_container_of(state->parked.prev, oldest, link);
+		destroy_swaybg_output(oldest);
+	}
+}
+
+static struct swaybg_output *find_parked_output(
+		const struct swaybg_output *output) {
+	struct swaybg_output *parked;
+	wl_list_for_each(parked, &output->state->parked, link) {
+		if (parked->config != output->config) {
+			continue;
+		}
+		// The connector name changes from one dock to another, the make,
+		// model and serial number do not
+		if (output->identifier && parked->identifier) {
+			if (strcmp(output->identifier, parked->identifier) == 0) {
+				return parked;
+			}
+		} else if (output->name && parked->name &&
+				strcmp(output->name, parked->name) == 0) {
+			return parked;
+		}
 	}
-	if (output->fract_scale != NULL) {
-		wp_fractional_scale_v1_destroy(output->fract_scale);
+	return NULL;
+}
+
+// Move the wl_output of a new output over to the parked state of the same
+// monitor, which replaces it. The pool buffers stay where their release
+// listeners expect them.
+static struct swaybg_output *revive_parked_output(
+		struct swaybg_output *parked, struct swaybg_output *output) {
+	swaybg_log(LOG_DEBUG, "Reviving output %s (%s) after %.1f s",
+			output->name, output->identifier,
+			(get_time_ns() - parked->parked_since) / 1e9);
+	wl_list_remove(&parked->link);
+	wl_list_insert(&output->link, &parked->link);
+	wl_list_remove(&output->link);
+
+	parked->wl_name = output->wl_name;
+	parked->wl_output = output->wl_output;
+	wl_output_set_user_data(parked->wl_output, parked);
+	free(parked->name);
+	free(parked->identifier);
+	parked->name = output->name;
+	parked->identifier = output->identifier;
+	parked->scale = output->scale;
+	parked->x = output->x;
+	parked->y = output->y;
+	parked->parked_since = 0;
+	free(output);
+
+	// The compositor should have released them along with the surface
+	for (int i = 0; i < 2; i++) {
+		if (parked->buffers[i].busy) {
+			destroy_buffer(&parked->buffers[i]);
+		}
 	}
-	if (output->actx != NULL) {
-		anim_done(output->actx);
+	fast_forward_output(parked);
+	// Nothing is attached to the new surface yet
+	parked->revived_width = parked->buffer_width * parked->buffer_div;
+	parked->revived_height = parked->buffer_height * parked->buffer_div;
+	parked->buffer_width = parked->buffer_height = 0;
+	return parked;
+}
+
+// Release the buffers of outputs parked for too long, return the
+// milliseconds until the next ones are due or -1
+static int trim_parked_outputs(struct swaybg_state *state) {
+	uint64_t now = get_time_ns();
+	int timeout = -1;
+	struct swaybg_output *output;
+	wl_list_for_each(output, &state->parked, link) {
+		if (!output->background && !output->buffers[0].buffer &&
+				!output->buffers[1].buffer) {
+			continue;
+		}
+		uint64_t due = output->parked_since + PARKED_BUFFERS_MS * 1000000ull;
+		if (due > now) {
+			int ms = (due - now + 999999) / 1000000;
+			if (timeout < 0 || ms < timeout) {
+				timeout = ms;
+			}
+			continue;
+		}
+		destroy_buffer(&output->buffers[0]);
+		destroy_buffer(&output->buffers[1]);
+		if (output->background != NULL) {
+			cairo_surface_destroy(output->background);
+			output->background = NULL;
+		}
 	}
-	wl_output_destroy(output->wl_output);
-	free(output->name);
-	free(output->identifier);
-	free(output);
+	return timeout;
 }
 
 static void layer_surface_configure(void *data,
@@ -202,14 +1401,14 @@ static void layer_surface_configure(void *data,
 	output->dirty = true;
 	output->configure_serial = serial;
 	output->needs_ack = true;
+	start_settling(output);
+	startup_mark(STARTUP_CONFIGURE);
 }
 
 static void layer_surface_closed(void *data,
 		struct zwlr_layer_surface_v1 *surface) {
 	struct swaybg_output *output = data;
-	swaybg_log(LOG_DEBUG, "Destroying output %s (%s)",
-			output->name, output->identifier);
-	destroy_swaybg_output(output);
+	park_swaybg_output(output);
 }
 
 static const struct zwlr_layer_surface_v1_listener layer_surface_listener = {
@@ -220,22 +1419,34 @@ static const struct zwlr_layer_surface_v1_listener layer_surface_listener = {
 static void fract_preferred_scale(void *data, struct wp_fractional_scale_v1 *f,
 		uint32_t scale) {
 	struct swaybg_output *output = data;
-	output->pref_fract_scale = scale;
+	if (output->pref_fract_scale != scale) {
+		output->pref_fract_scale = scale;
+		start_settling(output);
+	}
 }
 
 static const struct wp_fractional_scale_v1_listener fract_scale_listener = {
 	.preferred_scale = fract_preferred_scale
 };
 
-static void output_geometry(void *data, struct wl_output *output, int32_t x,
+static void output_geometry(void *data, struct wl_output *wl_output, int32_t x,
 		int32_t y, int32_t width_mm, int32_t height_mm, int32_t subpixel,
 		const char *make, const char *model, int32_t transform) {
-	// Who cares
+	struct swaybg_output *output = data;
+	if (output->x == x && output->y == y) {
+		return;
+	}
+	output->x = x;
+	output->y = y;
+	// Spanning outputs show another part of the shared animation now
+	if (output->config && output->config->span && output->width > 0) {
+		output->dirty = true;
+	}
 }
 
 static void output_mode(void *data, struct wl_output *output, uint32_t flags,
 		int32_t width, int32_t height, int32_t refresh) {
-	// Who cares
+	// The logical size comes with the layer surface configure
 }
 
 static void create_layer_surface(struct swaybg_output *output) {
@@ -257,8 +1468,8 @@ static void create_layer_surface(struct swaybg_output *output) {
 			&fract_scale_listener, output);
 	}
 
-	if (output->state->viewporter &&
-	    output->state->fract_scale_manager) {
+	// Also used to scale buffers up when the governor lowers their size
+	if (output->state->viewporter) {
 		output->viewport = wp_viewporter_get_viewport(
 			output->state->viewporter, output->surface);
 	}
@@ -289,13 +1500,26 @@ static void output_done(void *data, struct wl_output *wl_output) {
 	} else if (!output->layer_surface) {
 		swaybg_log(LOG_DEBUG, "Found config %s for output %s (%s)",
 				output->config->output, output->name, output->identifier);
+		struct swaybg_output *parked = find_parked_output(output);
+		if (parked) {
+			output = revive_parked_output(parked, output);
+		}
 		create_layer_surface(output);
+		if (output->state->power_manager) {
+			output->power = zwlr_output_power_manager_v1_get_output_power(
+				output->state->power_manager, output->wl_output);
+			zwlr_output_power_v1_add_listener(output->power,
+				&output_power_listener, output);
+		}
 	}
 }
 
 static void output_scale(void *data, struct wl_output *wl_output,
 		int32_t scale) {
 	struct swaybg_output *output = data;
+	if (output->scale != scale) {
+		start_settling(output);
+	}
 	output->scale = scale;
 	if (output->state->run_display && output->width > 0 && output->height > 0) {
 		output->dirty = true;
@@ -356,6 +1580,121 @@ static const struct wl_output_listener output_listener = {
 	.description = output_description,
 };
 
+static void toplevel_handle_title(void *data,
+		struct zwlr_foreign_toplevel_handle_v1 *handle, const char *title) {
+	// Who cares
+}
+
+static void toplevel_handle_app_id(void *data,
+		struct zwlr_foreign_toplevel_handle_v1 *handle, const char *app_id) {
+	// Who cares
+}
+
+static void toplevel_handle_output_enter(void *data,
+		struct zwlr_foreign_toplevel_handle_v1 *handle,
+		struct wl_output *wl_output) {
+	struct swaybg_toplevel *toplevel = data;
+	struct wl_output **entry =
+		wl_array_add(&toplevel->pending_outputs, sizeof(*entry));
+	if (entry) {
+		*entry = wl_output;
+	}
+}
+
+static void toplevel_handle_output_leave(void *data,
+		struct zwlr_foreign_toplevel_handle_v1 *handle,
+		struct wl_output *wl_output) {
+	struct swaybg_toplevel *toplevel = data;
+	remove_toplevel_output(&toplevel->pending_outputs, wl_output);
+}
+
+static void toplevel_handle_state(void *data,
+		struct zwlr_foreign_toplevel_handle_v1 *handle,
+		struct wl_array *states) {
+	struct swaybg_toplevel *toplevel = data;
+	bool fullscreen = false, minimized = false;
+	uint32_t *entry;
+	wl_array_for_each(entry, states) {
+		if (*entry == ZWLR_FOREIGN_TOPLEVEL_HANDLE_V1_STATE_FULLSCREEN) {
+			fullscreen = true;
+		} else if (*entry == ZWLR_FOREIGN_TOPLEVEL_HANDLE_V1_STATE_MINIMIZED) {
+			minimized = true;
+		}
+	}
+	toplevel->pending_fullscreen = fullscreen && !minimized;
+}
+
+static void toplevel_handle_done(void *data,
+		struct zwlr_foreign_toplevel_handle_v1 *handle) {
+	struct swaybg_toplevel *toplevel = data;
+	wl_array_copy(&toplevel->outputs, &toplevel->pending_outputs);
+	toplevel->fullscreen = toplevel->pending_fullscreen;
+	update_covered_outputs(toplevel->state);
+}
+
+static void destroy_swaybg_toplevel(struct swaybg_toplevel *toplevel) {
+	wl_list_remove(&toplevel->link);
+	zwlr_foreign_toplevel_handle_v1_destroy(toplevel->handle);
+	wl_array_release(&toplevel->outputs);
+	wl_array_release(&toplevel->pending_outputs);
+	free(toplevel);
+}
+
+static void toplevel_handle_closed(void *data,
+		struct zwlr_foreign_toplevel_handle_v1 *handle) {
+	struct swaybg_toplevel *toplevel = data;
+	struct swaybg_state *state = toplevel->state;
+	destroy_swaybg_toplevel(toplevel);
+	update_covered_outputs(state);
+}
+
+static void toplevel_handle_parent(void *data,
+		struct zwlr_foreign_toplevel_handle_v1 *handle,
+		struct zwlr_foreign_toplevel_handle_v1 *parent) {
+	// Who cares
+}
+
+static const struct zwlr_foreign_toplevel_handle_v1_listener toplevel_listener = {
+	.title = toplevel_handle_title,
+	.app_id = toplevel_handle_app_id,
+	.output_enter = toplevel_handle_output_enter,
+	.output_leave = toplevel_handle_output_leave,
+	.state = toplevel_handle_state,
+	.done = toplevel_handle_done,
+	.closed = toplevel_handle_closed,
+	.parent = toplevel_handle_parent,
+};
+
+static void toplevel_manager_handle_toplevel(void *data,
+		struct zwlr_foreign_toplevel_manager_v1 *manager,
+		struct zwlr_foreign_toplevel_handle_v1 *handle) {
+	struct swaybg_state *state = data;
+	struct swaybg_toplevel *toplevel = calloc(1, sizeof(struct swaybg_toplevel));
+	if (!toplevel) {
+		zwlr_foreign_toplevel_handle_v1_destroy(handle);
+		return;
+	}
+	toplevel->state = state;
+	toplevel->handle = handle;
+	wl_array_init(&toplevel->outputs);
+	wl_array_init(&toplevel->pending_outputs);
+	zwlr_foreign_toplevel_handle_v1_add_listener(handle,
+		&toplevel_listener, toplevel);
+	wl_list_insert(&state->toplevels, &toplevel->link);
+}
+
+static void toplevel_manager_handle_finished(void *data,
+		struct zwlr_foreign_toplevel_manager_v1 *manager) {
+	struct swaybg_state *state = data;
+	zwlr_foreign_toplevel_manager_v1_destroy(manager);
+	state->toplevel_manager = NULL;
+}
+
+static const struct zwlr_foreign_toplevel_manager_v1_listener toplevel_manager_listener = {
+	.toplevel = toplevel_manager_handle_toplevel,
+	.finished = toplevel_manager_handle_finished,
+};
+
 static void handle_global(void *data, struct wl_registry *registry,
 		uint32_t name, const char *interface, uint32_t version) {
 	struct swaybg_state *state = data;
@@ -369,6 +1708,7 @@ static void handle_global(void *data, struct wl_registry *registry,
 		output->state = state;
 		output->scale = 1;
 		output->wl_name = name;
+		governor_init(&output->governor);
 		output->wl_output =
 			wl_registry_bind(registry, name, &wl_output_interface, 4);
 		wl_output_add_listener(output->wl_output, &output_listener, output);
@@ -382,6 +1722,18 @@ static void handle_global(void *data, struct wl_registry *registry,
 	} else if (strcmp(interface, wp_fractional_scale_manager_v1_interface.name) == 0) {
 		state->fract_scale_manager = wl_registry_bind(registry, name,
 			&wp_fractional_scale_manager_v1_interface, 1);
+	} else if (strcmp(interface,
+			zwlr_foreign_toplevel_manager_v1_interface.name) == 0) {
+		// Version 2 is the first one with the fullscreen state
+		state->toplevel_manager = wl_registry_bind(registry, name,
+			&zwlr_foreign_toplevel_manager_v1_interface,
+			version < 3 ? version : 3);
+		zwlr_foreign_toplevel_manager_v1_add_listener(state->toplevel_manager,
+			&toplevel_manager_listener, state);
+	} else if (state->watch_power && strcmp(interface,
+			zwlr_output_power_manager_v1_interface.name) == 0) {
+		state->power_manager = wl_registry_bind(registry, name,
+			&zwlr_output_power_manager_v1_interface, 1);
 	}
 }
 
@@ -391,9 +1743,7 @@ static void handle_global_remove(void *data, struct wl_registry *registry,
 	struct swaybg_output *output, *tmp;
 	wl_list_for_each_safe(output, tmp, &state->outputs, link) {
 		if (output->wl_name == name) {
-			swaybg_log(LOG_DEBUG, "Destroying output %s (%s)",
-					output->name, output->identifier);
-			destroy_swaybg_output(output);
+			park_swaybg_output(output);
 			break;
 		}
 	}
@@ -410,9 +1760,59 @@ static bool store_swaybg_output_config(struct swaybg_state *state,
 	wl_list_for_each(oc, &state->configs, link) {
 		if (strcmp(config->output, oc->output) == 0) {
 			// Merge on top
+			if (config->image_path) {
+				free((char *)oc->image_path);
+				oc->image_path = config->image_path;
+				config->image_path = NULL;
+			}
+			if (config->mode != BACKGROUND_MODE_INVALID) {
+				oc->mode = config->mode;
+			}
 			if (config->color) {
 				oc->color = config->color;
 			}
+			if (config->mirror_group) {
+				free(oc->mirror_group);
+				oc->mirror_group = config->mirror_group;
+				config->mirror_group = NULL;
+			}
+			if (config->span) {
+				oc->span = true;
+			}
+			if (config->budget_ms) {
+				oc->budget_ms = config->budget_ms;
+			}
+			if (config->trail_length) {
+				oc->trail_length = config->trail_length;
+			}
+			if (config->birds) {
+				oc->birds = config->birds;
+			}
+			if (config->footprint_path) {
+				free(oc->footprint_path);
+				oc->footprint_path = config->footprint_path;
+				config->footprint_path = NULL;
+			}
+			if (config->record_path) {
+				free(oc->record_path);
+				oc->record_path = config->record_path;
+				config->record_path = NULL;
+			}
+			if (config->replay_path) {
+				free(oc->replay_path);
+				oc->replay_path = config->replay_path;
+				config->replay_path = NULL;
+			}
+			if (config->publish_key) {
+				free(oc->publish_key);
+				oc->publish_key = config->publish_key;
+				config->publish_key = NULL;
+			}
+			if (config->attach_key) {
+				free(oc->attach_key);
+				oc->attach_key = config->attach_key;
+				config->attach_key = NULL;
+			}
 			return false;
 		}
 	}
@@ -424,34 +1824,97 @@ static bool store_swaybg_output_config(struct swaybg_state *state,
 static void parse_command_line(int argc, char **argv,
 		struct swaybg_state *state) {
 	static struct option long_options[] = {
+		{"attach", required_argument, NULL, 'a'},
+		{"cpu-affinity", required_argument, NULL, 'A'},
+		{"budget", required_argument, NULL, 'b'},
+		{"background-priority", no_argument, NULL, 'B'},
 		{"color", required_argument, NULL, 'c'},
+		{"footprint", required_argument, NULL, 'f'},
+		{"mirror-group", required_argument, NULL, 'g'},
 		{"help", no_argument, NULL, 'h'},
+		{"image", required_argument, NULL, 'i'},
+		{"mode", required_argument, NULL, 'm'},
+		{"birds", required_argument, NULL, 'n'},
 		{"output", required_argument, NULL, 'o'},
+		{"replay", required_argument, NULL, 'p'},
+		{"publish", required_argument, NULL, 'P'},
+		{"cpu-quota", required_argument, NULL, 'Q'},
+		{"record", required_argument, NULL, 'r'},
+		{"span", no_argument, NULL, 's'},
+		{"trail", required_argument, NULL, 't'},
 		{"version", no_argument, NULL, 'v'},
+		{"watch-power", no_argument, NULL, 'W'},
 		{0, 0, 0, 0}
 	};
 
 	const char *usage =
 		"Usage: swaybg <options...>\n"
+		"       swaybg ctl <command> [<args>...]\n"
 		"\n"
+		"  -a, --attach <key>     Show the animation published under this key.\n"
+		"  -b, --budget <ms>      Lower the quality when frames take longer.\n"
 		"  -c, --color RRGGBB     Set the background color.\n"
+		"  -f, --footprint <path> Draw footprints of the shape in this file.\n"
+		"  -g, --mirror-group <name>\n"
+		"                         Share one animation and one buffer per frame\n"
+		"                         between all outputs of the same group.\n"
 		"  -h, --help             Show help message and quit.\n"
+		"  -i, --image <path>     Set the image to display under the traces.\n"
+		"  -m, --mode <mode>      Set the mode to use for the image.\n"
+		"  -n, --birds <count>    Number of birds walking the output.\n"
 		"  -o, --output <name>    Set the output to operate on or * for all.\n"
+		"  -p, --replay <path>    Replay a walk recorded with --record.\n"
+		"  -P, --publish <key>    Share the animation with --attach instances.\n"
+		"  -r, --record <path>    Record the walk to a file.\n"
+		"  -s, --span             Run one animation across all spanning outputs.\n"
+		"  -t, --trail <steps>    Keep footprints for about this many steps.\n"
 		"  -v, --version          Show the version number and quit.\n"
+		"\n"
+		"Options for the whole process:\n"
+		"  -A, --cpu-affinity <list>\n"
+		"                         Only run on these CPUs, e.g. 2-3,6.\n"
+		"  -B, --background-priority\n"
+		"                         Only run when nothing else wants the CPU.\n"
+		"  -Q, --cpu-quota <ms>   Pause animations once they used this much CPU\n"
+		"                         time within a minute.\n"
+		"  -W, --watch-power      Suspend outputs while they are powered off,\n"
+		"                         taking over their power control.\n"
 		"\n";
 
 	struct swaybg_output_config *config = calloc(1, sizeof(struct swaybg_output_config));
 	config->output = strdup("*");
+	config->mode = BACKGROUND_MODE_INVALID;
 	wl_list_init(&config->link); // init for safe removal
 
 	int c;
 	while (1) {
 		int option_index = 0;
-		c = getopt_long(argc, argv, "c:hi:m:o:v", long_options, &option_index);
+		c = getopt_long(argc, argv, "a:A:b:Bc:f:g:hi:m:n:o:p:P:Q:r:st:vW", long_options, &option_index);
 		if (c == -1) {
 			break;
 		}
 		switch (c) {
+		case 'a':  // attach
+			free(config->attach_key);
+			config->attach_key = strdup(optarg);
+			break;
+		case 'A':  // cpu-affinity
+			free(state->cpu_affinity);
+			state->cpu_affinity = strdup(optarg);
+			break;
+		case 'b': {  // budget
+			char *end;
+			long budget = strtol(optarg, &end, 10);
+			if (*end != '\0' || budget <= 0 || budget > 60000) {
+				swaybg_log(LOG_ERROR, "Invalid frame budget: %s", optarg);
+				continue;
+			}
+			config->budget_ms = budget;
+			break;
+		}
+		case 'B':  // background-priority
+			state->background_priority = true;
+			break;
 		case 'c':  // color
 			if (!parse_color(optarg, &config->color)) {
 				swaybg_log(LOG_ERROR, "%s is not a valid color for swaybg. "
@@ -459,6 +1922,34 @@ static void parse_command_line(int argc, char **argv,
 				continue;
 			}
 			break;
+		case 'f':  // footprint
+			free(config->footprint_path);
+			config->footprint_path = strdup(optarg);
+			break;
+		case 'g':  // mirror-group
+			free(config->mirror_group);
+			config->mirror_group = strdup(optarg);
+			break;
+		case 'i':  // image
+			free((char *)config->image_path);
+			config->image_path = strdup(optarg);
+			break;
+		case 'm':  // mode
+			config->mode = parse_background_mode(optarg);
+			if (config->mode == BACKGROUND_MODE_INVALID) {
+				swaybg_log(LOG_ERROR, "Invalid mode: %s", optarg);
+			}
+			break;
+		case 'n': {  // birds
+			char *end;
+			long birds = strtol(optarg, &end, 10);
+			if (*end != '\0' || birds <= 0 || birds > FLOCK_MAX_BIRDS) {
+				swaybg_log(LOG_ERROR, "Invalid number of birds: %s", optarg);
+				continue;
+			}
+			config->birds = birds;
+			break;
+		}
 		case 'o':  // output
 			if (config && !store_swaybg_output_config(state, config)) {
 				// Empty config or merged on top of an existing one
@@ -466,12 +1957,51 @@ static void parse_command_line(int argc, char **argv,
 			}
 			config = calloc(1, sizeof(struct swaybg_output_config));
 			config->output = strdup(optarg);
+			config->mode = BACKGROUND_MODE_INVALID;
 			wl_list_init(&config->link);  // init for safe removal
 			break;
+		case 'p':  // replay
+			free(config->replay_path);
+			config->replay_path = strdup(optarg);
+			break;
+		case 'P':  // publish
+			free(config->publish_key);
+			config->publish_key = strdup(optarg);
+			break;
+		case 'Q': {  // cpu-quota
+			char *end;
+			long quota = strtol(optarg, &end, 10);
+			if (*end != '\0' || quota <= 0 || quota > 60000) {
+				swaybg_log(LOG_ERROR, "Invalid CPU quota: %s", optarg);
+				continue;
+			}
+			cpu_quota_init(&state->cpu_quota, quota);
+			break;
+		}
+		case 'r':  // record
+			free(config->record_path);
+			config->record_path = strdup(optarg);
+			break;
+		case 's':  // span
+			config->span = true;
+			break;
+		case 't': {  // trail
+			char *end;
+			long length = strtol(optarg, &end, 10);
+			if (*end != '\0' || length <= 0 || length > TRAIL_MAX_LENGTH) {
+				swaybg_log(LOG_ERROR, "Invalid trail length: %s", optarg);
+				continue;
+			}
+			config->trail_length = length;
+			break;
+		}
 		case 'v':  // version
 			fprintf(stdout, "swaybg version " SWAYBG_VERSION "\n");
 			exit(EXIT_SUCCESS);
 			break;
+		case 'W':  // watch-power
+			state->watch_power = true;
+			break;
 		default:
 			fprintf(c == 'h' ? stdout : stderr, "%s", usage);
 			exit(c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
@@ -500,25 +2030,370 @@ static void parse_command_line(int argc, char **argv,
 	config = NULL;
 	struct swaybg_output_config *tmp = NULL;
 	wl_list_for_each_safe(config, tmp, &state->configs, link) {
-		if (!config->color) {
+		if (!config->image_path && !config->color && !config->mirror_group &&
+				!config->trail_length && !config->birds &&
+				!config->footprint_path &&
+				!config->record_path &&
+				!config->replay_path && !config->span &&
+				!config->budget_ms && !config->publish_key &&
+				!config->attach_key) {
 			destroy_swaybg_output_config(config);
+		} else if (config->mode == BACKGROUND_MODE_INVALID) {
+			config->mode = config->image_path
+				? BACKGROUND_MODE_STRETCH
+				: BACKGROUND_MODE_SOLID_COLOR;
+		}
+	}
+}
+
+static const char *anim_state_names[] = {
+	[ANIM_RUNNING] = "running",
+	[ANIM_PAUSED] = "paused",
+	[ANIM_FROZEN] = "frozen",
+};
+
+static void set_anim_state(struct swaybg_output *output,
+		enum anim_state anim_state) {
+	output->anim_state = anim_state;
+	// Paused outputs keep their frame, but frozen ones need a new one right
+	// away, which the main loop draws for dirty outputs even when idle
+	if (anim_state == ANIM_FROZEN && output->buffer_width > 0) {
+		output->dirty = true;
+	}
+}
+
+static bool output_matches(const struct swaybg_output *output,
+		const char *name) {
+	return (output->name && strcmp(output->name, name) == 0) ||
+		(output->identifier && strcmp(output->identifier, name) == 0);
+}
+
+// Apply the state to the outputs named by the arguments, or to all of them
+static void control_set_anim_state(struct swaybg_state *state,
+		int argc, char **argv, enum anim_state anim_state, FILE *reply) {
+	struct swaybg_output *output;
+	for (int i = 1; i < argc; i++) {
+		bool found = false;
+		wl_list_for_each(output, &state->outputs, link) {
+			found |= output_matches(output, argv[i]);
 		}
+		if (!found) {
+			fprintf(reply, "error: unknown output %s\n", argv[i]);
+			return;
+		}
+	}
+	wl_list_for_each(output, &state->outputs, link) {
+		bool selected = argc == 1;
+		for (int i = 1; i < argc && !selected; i++) {
+			selected = output_matches(output, argv[i]);
+		}
+		if (selected) {
+			set_anim_state(output, anim_state);
+		}
+	}
+	fprintf(reply, "ok\n");
+}
+
+static void control_rate(struct swaybg_state *state, int argc, char **argv,
+		FILE *reply) {
+	if (argc == 1) {
+		fprintf(reply, "%d\n", state->rate);
+		return;
+	}
+	char *end;
+	long rate = strtol(argv[1], &end, 10);
+	if (argc > 2 || *end != '\0' || rate <= 0 || rate > MAX_RATE) {
+		fprintf(reply, "error: rate must be between 1 and %d steps "
+			"per minute\n", MAX_RATE);
+		return;
+	}
+	state->rate = rate;
+	fprintf(reply, "ok\n");
+}
+
+static void control_seek(struct swaybg_state *state, int argc, char **argv,
+		FILE *reply) {
+	char *end;
+	long step = argc > 1 ? strtol(argv[1], &end, 10) : -1;
+	if (argc < 2 || *end != '\0' || step < 0 || step > INT_MAX) {
+		fprintf(reply, "error: expected a step number\n");
+		return;
+	}
+	struct swaybg_output *output;
+	for (int i = 2; i < argc; i++) {
+		bool found = false;
+		wl_list_for_each(output, &state->outputs, link) {
+			found |= output_matches(output, argv[i]) &&
+				output->config && output->config->replay;
+		}
+		if (!found) {
+			fprintf(reply, "error: %s is not replaying a walk\n", argv[i]);
+			return;
+		}
+	}
+	wl_list_for_each(output, &state->outputs, link) {
+		bool selected = argc == 2;
+		for (int i = 2; i < argc && !selected; i++) {
+			selected = output_matches(output, argv[i]);
+		}
+		if (!selected || !output->config || !output->config->replay ||
+				!output->actx) {
+			continue;
+		}
+		replay_seek(output->config->replay, &output->replay_cursor,
+			output->actx, step, output->buffer_width * output->buffer_div,
+			output->buffer_height * output->buffer_div);
+		output->dirty = true;
+	}
+	fprintf(reply, "ok\n");
+}
+
+static void control_stats(struct swaybg_state *state, FILE *reply) {
+	fprintf(reply, "# rate %d\n", state->rate);
+	const struct cpu_quota *quota = &state->cpu_quota;
+	if (quota->quota_ns) {
+		fprintf(reply, "# cpu_quota_ms %.0f used_ms %.0f%s\n",
+			quota->quota_ns / 1e6, cpu_quota_used_ns(quota) / 1e6,
+			quota->exhausted ? " exhausted" : "");
+	}
+	fprintf(reply, "# output\tstate\tbuffer\tframes\tdrawn\tskipped\t"
+		"draw_avg_us\tdraw_max_us\tquality\tcoalesced\tsteps\n");
+	struct swaybg_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		const struct swaybg_output_stats *stats = &output->stats;
+		fprintf(reply, "%s\t%s\t%ux%u\t%llu\t%llu\t%llu\t%.1f\t%.1f\t%s\t%llu\t"
+			"%llu\n",
+			output->name ? output->name : "?",
+			output->powered_off ? "off" :
+			output->covered && output->anim_state == ANIM_RUNNING ?
+				"covered" : anim_state_names[output->anim_state],
+			output->buffer_width, output->buffer_height,
+			(unsigned long long)stats->frames,
+			(unsigned long long)stats->drawn,
+			(unsigned long long)stats->skipped,
+			stats->drawn ? stats->draw_ns / 1000.0 / stats->drawn : 0.0,
+			stats->draw_max_ns / 1000.0,
+			governor_get_quality(&output->governor)->name,
+			(unsigned long long)stats->coalesced,
+			(unsigned long long)stats->steps);
+	}
+}
+
+// Buffer of the frame the output shows, or NULL
+static struct pool_buffer *get_shown_buffer(struct swaybg_output *output) {
+	struct swaybg_output *owner = output->mirrored ? output->mirrored : output;
+	if (!owner->shown || !owner->shown->buffer) {
+		return NULL;
+	}
+	return owner->shown;
+}
+
+// Hand out the buffer of the current frame itself, read-only
+static void control_frame(struct swaybg_state *state, int argc, char **argv,
+		FILE *reply) {
+	if (argc != 2) {
+		fprintf(reply, "error: expected an output\n");
+		return;
+	}
+	struct swaybg_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		if (!output_matches(output, argv[1])) {
+			continue;
+		}
+		struct pool_buffer *buffer = get_shown_buffer(output);
+		if (!buffer) {
+			fprintf(reply, "error: output %s has no frame yet\n", argv[1]);
+			return;
+		}
+		int fd = export_buffer(buffer);
+		if (fd < 0) {
+			fprintf(reply, "error: cannot export the frame: %s\n",
+				strerror(errno));
+			return;
+		}
+		fprintf(reply, "%u %u %u xrgb8888 %llu\n",
+			buffer->width, buffer->height, buffer->width * 4,
+			(unsigned long long)output->stats.frames);
+		control_reply_fd(&state->control, fd);
+		return;
+	}
+	fprintf(reply, "error: unknown output %s\n", argv[1]);
+}
+
+static void control_watch_frames(struct swaybg_state *state, int argc,
+		char **argv, FILE *reply) {
+	fprintf(reply, "ok\n");
+	control_watch(&state->control);
+}
+
+static bool match_output_filter(void *data, const char *filter) {
+	return output_matches(data, filter);
+}
+
+// Tell the clients watching the output about its new frame
+static void notify_frame(struct swaybg_state *state,
+		struct swaybg_output *output) {
+	char line[128];
+	snprintf(line, sizeof(line), "frame %s %llu\n",
+		output->name ? output->name : "?",
+		(unsigned long long)output->stats.frames);
+	control_notify(&state->control, match_output_filter, output, line);
+}
+
+static void handle_control_command(void *data, int argc, char **argv,
+		FILE *reply) {
+	struct swaybg_state *state = data;
+	if (strcmp(argv[0], "pause") == 0) {
+		control_set_anim_state(state, argc, argv, ANIM_PAUSED, reply);
+	} else if (strcmp(argv[0], "resume") == 0) {
+		control_set_anim_state(state, argc, argv, ANIM_RUNNING, reply);
+	} else if (strcmp(argv[0], "freeze") == 0) {
+		control_set_anim_state(state, argc, argv, ANIM_FROZEN, reply);
+	} else if (strcmp(argv[0], "rate") == 0) {
+		control_rate(state, argc, argv, reply);
+	} else if (strcmp(argv[0], "seek") == 0) {
+		control_seek(state, argc, argv, reply);
+	} else if (strcmp(argv[0], "stats") == 0) {
+		control_stats(state, reply);
+	} else if (strcmp(argv[0], "frame") == 0) {
+		control_frame(state, argc, argv, reply);
+	} else if (strcmp(argv[0], "watch") == 0) {
+		control_watch_frames(state, argc, argv, reply);
+	} else {
+		fprintf(reply, "error: unknown command %s\n", argv[0]);
+	}
+}
+
+static bool is_output_animated(const struct swaybg_output *output) {
+	return output->anim_state == ANIM_RUNNING && !is_output_suspended(output);
+}
+
+// Fit the shared animation to the layout of the spanning outputs, and
+// advance it if any of them is animated
+static void step_span(struct swaybg_state *state) {
+	struct swaybg_span *span = &state->span;
+	int32_t x0 = INT32_MAX, y0 = INT32_MAX, x1 = INT32_MIN, y1 = INT32_MIN;
+	bool animated = false;
+	struct swaybg_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		if (!output->config || !output->config->span || output->width == 0) {
+			continue;
+		}
+		x0 = output->x < x0 ? output->x : x0;
+		y0 = output->y < y0 ? output->y : y0;
+		x1 = output->x + (int32_t)output->width > x1 ?
+			output->x + (int32_t)output->width : x1;
+		y1 = output->y + (int32_t)output->height > y1 ?
+			output->y + (int32_t)output->height : y1;
+		animated |= is_output_animated(output);
+	}
+	if (x0 >= x1 || y0 >= y1) {
+		return;
 	}
+	if (span->actx && (x0 != span->x || y0 != span->y)) {
+		// Keep the traces where they are in the layout
+		anim_translate(span->actx, span->x - x0, span->y - y0);
+	}
+	if (x1 - x0 != span->width || y1 - y0 != span->height) {
+		swaybg_log(LOG_DEBUG, "Spanning %dx%d at %d,%d",
+			x1 - x0, y1 - y0, x0, y0);
+	}
+	*span = (struct swaybg_span){
+		.actx = span->actx,
+		.x = x0,
+		.y = y0,
+		.width = x1 - x0,
+		.height = y1 - y0,
+	};
+	if (!animated) {
+		return;
+	}
+	if (!span->actx) {
+		span->actx = anim_create(&anim_default_config,
+			span->width, span->height);
+	}
+	if (span->actx) {
+		span->actx = anim_step(span->actx, span->width, span->height);
+	}
+}
+
+// Whether any output needs the animation timer
+static bool is_animating(struct swaybg_state *state) {
+	struct swaybg_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		if (is_output_animated(output)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Whether the output has to be drawn before the next tick: as soon as it got
+// configured, once its size settled, when it is stopped or out of CPU quota
+// and changed, or when it shows nothing yet
+static bool needs_immediate_frame(const struct swaybg_output *output) {
+	if (!output->dirty) {
+		return false;
+	}
+	if (output->needs_ack) {
+		// While the size settles, the viewport scales the current buffers
+		return !is_settling(output) || output->viewport;
+	}
+	if (is_settling(output)) {
+		return false;
+	}
+	return !is_output_animated(output) || output->state->cpu_quota.exhausted ||
+		output->buffer_width == 0 || output->pending_width != 0;
+}
+
+static bool has_immediate_frame(struct swaybg_state *state) {
+	struct swaybg_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		if (needs_immediate_frame(output)) {
+			return true;
+		}
+	}
+	return false;
 }
 
 int main(int argc, char **argv) {
+	if (argc > 1 && strcmp(argv[1], "ctl") == 0) {
+		return control_client_main(argc - 1, argv + 1);
+	}
+
+	startup_init();
 	swaybg_log_init(LOG_DEBUG);
 
-	struct swaybg_state state = {0};
+	struct swaybg_state state = { .rate = FPM };
 	wl_list_init(&state.configs);
 	wl_list_init(&state.outputs);
+	wl_list_init(&state.parked);
+	wl_list_init(&state.images);
+	wl_list_init(&state.toplevels);
 
 	parse_command_line(argc, argv, &state);
 
+	// Before any worker thread gets spawned, they inherit the settings
+	if (state.cpu_affinity && !priority_set_affinity(state.cpu_affinity)) {
+		return EXIT_FAILURE;
+	}
+	if (state.background_priority) {
+		priority_set_background();
+	}
+
 	// Identify distinct image paths which will need to be loaded
+	struct swaybg_image *image;
 	struct swaybg_output_config *config;
-#if 0
 	wl_list_for_each(config, &state.configs, link) {
+		if (!config->image_path) {
+			continue;
+		}
+		wl_list_for_each(image, &state.images, link) {
+			if (strcmp(image->path, config->image_path) == 0) {
+				config->image = image;
+				break;
+			}
+		}
 		if (config->image) {
 			continue;
 		}
@@ -527,7 +2402,31 @@ int main(int argc, char **argv) {
 		wl_list_insert(&state.images, &image->link);
 		config->image = image;
 	}
-#endif
+
+	// Flatten footprints once, outputs fall back to the built-in one
+	wl_list_for_each(config, &state.configs, link) {
+		if (config->footprint_path) {
+			config->glyph = glyph_load(config->footprint_path);
+		}
+		if (config->span && config->birds > 1) {
+			swaybg_log(LOG_ERROR, "Only one bird walks spanning outputs, "
+				"ignoring --birds %d", config->birds);
+			config->birds = 1;
+		}
+	}
+
+	// Map recorded walks, outputs fall back to simulating one on failure
+	wl_list_for_each(config, &state.configs, link) {
+		if (config->replay_path) {
+			config->replay = replay_open(config->replay_path);
+		}
+		if (config->replay && config->record_path) {
+			swaybg_log(LOG_ERROR, "Not recording to %s while replaying %s",
+				config->record_path, config->replay_path);
+			free(config->record_path);
+			config->record_path = NULL;
+		}
+	}
 
 	state.display = wl_display_connect(NULL);
 	if (!state.display) {
@@ -543,17 +2442,19 @@ int main(int argc, char **argv) {
 		swaybg_log(LOG_ERROR, "wl_display_roundtrip failed");
 		return 1;
 	}
+	startup_mark(STARTUP_REGISTRY);
 	if (state.compositor == NULL || state.shm == NULL ||
 			state.layer_shell == NULL) {
 		swaybg_log(LOG_ERROR, "Missing a required Wayland interface");
 		return 1;
 	}
 
+	control_init(&state.control, handle_control_command, &state);
+
 	// Track time
-#define FPM 180
 	struct timespec last;
 	clock_gettime(CLOCK_MONOTONIC, &last);
-	int tout = 60000 / FPM;
+	int tout = 60000 / state.rate;
 
 	while (true) {
 		bool still_ok = true;
@@ -569,10 +2470,30 @@ int main(int argc, char **argv) {
 
 		wl_display_flush(state.display);
 
-		struct pollfd fds[] = {
+		struct pollfd fds[1 + CONTROL_MAX_FDS] = {
 			{ .fd = wl_display_get_fd(state.display), .events = POLLIN },
 		};
-		int ret = poll(fds, (sizeof fds) / sizeof (*fds), tout);
+		int nfds = 1 + control_get_pollfds(&state.control, &fds[1]);
+		// Without anything to animate, sleep until an event comes in
+		bool animating = is_animating(&state);
+		int timeout = animating ? tout : -1;
+		if (animating && cpu_quota_exhausted(&state.cpu_quota)) {
+			// Wait for the next minute of CPU time
+			timeout = cpu_quota_timeout(&state.cpu_quota);
+		}
+		int settle_ms = get_settle_timeout(&state);
+		if (settle_ms >= 0 && (timeout < 0 || settle_ms < timeout)) {
+			timeout = settle_ms;
+		}
+		int trim_ms = trim_parked_outputs(&state);
+		if (trim_ms >= 0 && (timeout < 0 || trim_ms < timeout)) {
+			timeout = trim_ms;
+		}
+		int unload_ms = unload_images(&state);
+		if (unload_ms >= 0 && (timeout < 0 || unload_ms < timeout)) {
+			timeout = unload_ms;
+		}
+		int ret = poll(fds, nfds, timeout);
 
 		if (ret < 0)
 			wl_display_cancel_read(state.display);
@@ -582,44 +2503,86 @@ int main(int argc, char **argv) {
 		if (wl_display_dispatch_pending(state.display) < 0)
 			break;
 
+		if (ret > 0)
+			control_dispatch(&state.control, &fds[1], nfds - 1);
+
 		// Re-poll if too early
 		struct timespec now;
 		clock_gettime(CLOCK_MONOTONIC, &now);
 
-		uint64_t dif_ms = (now.tv_sec - last.tv_sec) * 1000 + now.tv_nsec / 1000000 - last.tv_nsec / 1000000;
-		tout = (dif_ms * FPM > 60000) ? 0 : (60000 / FPM - dif_ms);
+		bool tick = false;
+		if (is_animating(&state) && !cpu_quota_exhausted(&state.cpu_quota)) {
+			uint64_t dif_ms = (now.tv_sec - last.tv_sec) * 1000 + now.tv_nsec / 1000000 - last.tv_nsec / 1000000;
+			tout = (dif_ms * state.rate > 60000) ? 0 : (60000 / state.rate - dif_ms);
+			tick = tout <= 0;
+		}
 
-		if (tout > 0)
+		if (!tick && !has_immediate_frame(&state))
 			continue;
 
-		last = now;
+		if (tick)
+			last = now;
 
-		// Send acks
+		// Render animations on ticks, and configured or changed outputs as
+		// soon as possible. Pending configures are acked in any case.
+		if (tick) {
+			step_span(&state);
+		}
 		struct swaybg_output *output;
 		wl_list_for_each(output, &state.outputs, link) {
+			bool running = is_output_animated(output);
+			bool immediate = needs_immediate_frame(output);
 			if (output->needs_ack) {
 				output->needs_ack = false;
 				zwlr_layer_surface_v1_ack_configure(
 						output->layer_surface,
 						output->configure_serial);
 			}
+			if ((tick && running) || immediate) {
+				uint64_t frames = output->stats.frames;
+				render_frame(output, tick && running);
+				if (output->stats.frames != frames) {
+					notify_frame(&state, output);
+				}
+			}
 		}
+		release_frame_buffers(&state);
+	}
 
-		// Render animations
-		wl_list_for_each(output, &state.outputs, link) {
-			render_frame(output);
-		}
+	control_finish(&state.control);
+	if (state.span.actx) {
+		anim_done(state.span.actx);
+	}
+
+	struct swaybg_toplevel *toplevel, *tmp_toplevel;
+	wl_list_for_each_safe(toplevel, tmp_toplevel, &state.toplevels, link) {
+		destroy_swaybg_toplevel(toplevel);
+	}
+	if (state.toplevel_manager) {
+		zwlr_foreign_toplevel_manager_v1_destroy(state.toplevel_manager);
 	}
 
 	struct swaybg_output *output, *tmp_output;
 	wl_list_for_each_safe(output, tmp_output, &state.outputs, link) {
 		destroy_swaybg_output(output);
 	}
+	wl_list_for_each_safe(output, tmp_output, &state.parked, link) {
+		destroy_swaybg_output(output);
+	}
+	if (state.power_manager) {
+		zwlr_output_power_manager_v1_destroy(state.power_manager);
+	}
 
 	struct swaybg_output_config *tmp_config = NULL;
 	wl_list_for_each_safe(config, tmp_config, &state.configs, link) {
 		destroy_swaybg_output_config(config);
 	}
 
+	struct swaybg_image *tmp_image;
+	wl_list_for_each_safe(image, tmp_image, &state.images, link) {
+		destroy_swaybg_image(image);
+	}
+	free(state.cpu_affinity);
+
 	return 0;
 }
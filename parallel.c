@@ -0,0 +1,74 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "log.h"
+#include "parallel.h"
+
+#define MAX_THREADS 8
+
+struct parallel_job {
+	pthread_t thread;
+	parallel_func func;
+	void *data;
+	int start, end;
+};
+
+static void *run_job(void *data) {
+	struct parallel_job *job = data;
+	job->func(job->data, job->start, job->end);
+	return NULL;
+}
+
+static int thread_count = 0;
+
+void parallel_set_max_threads(int count) {
+	thread_count = count < 1 ? 1 : count > MAX_THREADS ? MAX_THREADS : count;
+}
+
+static int get_thread_count(void) {
+	if (thread_count == 0) {
+		long n = sysconf(_SC_NPROCESSORS_ONLN);
+		thread_count = n < 1 ? 1 : n > MAX_THREADS ? MAX_THREADS : n;
+	}
+	return thread_count;
+}
+
+void parallel_for(int count, int min_chunk, parallel_func func, void *data) {
+	int threads = get_thread_count();
+	if (min_chunk < 1) {
+		min_chunk = 1;
+	}
+	if (threads > count / min_chunk) {
+		threads = count / min_chunk;
+	}
+	if (threads <= 1) {
+		func(data, 0, count);
+		return;
+	}
+
+	struct parallel_job jobs[MAX_THREADS];
+	int spawned = 0;
+	for (int i = 0; i < threads; i++) {
+		jobs[i] = (struct parallel_job){
+			.func = func,
+			.data = data,
+			.start = (long long)count * i / threads,
+			.end = (long long)count * (i + 1) / threads,
+		};
+	}
+	// The calling thread takes the first chunk itself
+	for (int i = 1; i < threads; i++) {
+		if (pthread_create(&jobs[i].thread, NULL, run_job, &jobs[i]) != 0) {
+			swaybg_log(LOG_DEBUG, "Failed to spawn worker thread");
+			break;
+		}
+		spawned = i;
+	}
+	for (int i = spawned + 1; i < threads; i++) {
+		run_job(&jobs[i]);
+	}
+	run_job(&jobs[0]);
+	for (int i = 1; i <= spawned; i++) {
+		pthread_join(jobs[i].thread, NULL);
+	}
+}
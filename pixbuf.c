@@ -0,0 +1,62 @@
+#if HAVE_GDK_PIXBUF
+#include <dlfcn.h>
+#include <stdbool.h>
+#include "log.h"
+#include "pixbuf.h"
+
+#define GDK_PIXBUF_SONAME "libgdk_pixbuf-2.0.so.0"
+
+static struct pixbuf_funcs funcs;
+
+// GLib and GObject come along as dependencies of gdk-pixbuf, dlsym() on its
+// handle finds their symbols too
+static bool load_funcs(void *handle) {
+	struct {
+		void **func;
+		const char *name;
+	} symbols[] = {
+		{ (void **)&funcs.new_from_file, "gdk_pixbuf_new_from_file" },
+		{ (void **)&funcs.apply_embedded_orientation,
+			"gdk_pixbuf_apply_embedded_orientation" },
+		{ (void **)&funcs.get_n_channels, "gdk_pixbuf_get_n_channels" },
+		{ (void **)&funcs.get_width, "gdk_pixbuf_get_width" },
+		{ (void **)&funcs.get_height, "gdk_pixbuf_get_height" },
+		{ (void **)&funcs.get_rowstride, "gdk_pixbuf_get_rowstride" },
+		{ (void **)&funcs.read_pixels, "gdk_pixbuf_read_pixels" },
+		{ (void **)&funcs.object_unref, "g_object_unref" },
+		{ (void **)&funcs.error_free, "g_error_free" },
+	};
+	for (size_t i = 0; i < sizeof(symbols) / sizeof(symbols[0]); i++) {
+		*symbols[i].func = dlsym(handle, symbols[i].name);
+		if (!*symbols[i].func) {
+			swaybg_log(LOG_ERROR, "Missing %s in " GDK_PIXBUF_SONAME,
+				symbols[i].name);
+			return false;
+		}
+	}
+	return true;
+}
+
+const struct pixbuf_funcs *pixbuf_get(void) {
+	static bool loaded = false, available = false;
+	if (loaded) {
+		return available ? &funcs : NULL;
+	}
+	loaded = true;
+
+	// Never unloaded: GObject does not support it
+	void *handle = dlopen(GDK_PIXBUF_SONAME, RTLD_NOW | RTLD_LOCAL);
+	if (!handle) {
+		swaybg_log(LOG_ERROR, "Failed to load gdk-pixbuf, only PNG images "
+			"can be read: %s", dlerror());
+		return NULL;
+	}
+	available = load_funcs(handle);
+	if (!available) {
+		dlclose(handle);
+		return NULL;
+	}
+	swaybg_log(LOG_DEBUG, "Loaded " GDK_PIXBUF_SONAME);
+	return &funcs;
+}
+#endif // HAVE_GDK_PIXBUF
@@ -0,0 +1,249 @@
+#include <stdint.h>
+#include "pixconv.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#else
+#define HAVE_X86_SIMD 0
+#endif
+#if defined(__aarch64__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HAVE_NEON 1
+#else
+#define HAVE_NEON 0
+#endif
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define PIXCONV_BIG_ENDIAN 1
+#else
+#define PIXCONV_BIG_ENDIAN 0
+#endif
+
+/* premul-color = alpha/255 * color/255 * 255 = (alpha*color)/255
+ * (z/255) = z/256 * 256/255     = z/256 (1 + 1/255)
+ *         = z/256 + (z/256)/255 = (z + z/255)/256
+ *         # recurse once
+ *         = (z + (z + z/255)/256)/256
+ *         = (z + z/256 + z/256/255) / 256
+ *         # only use 16bit uint operations, loose some precision,
+ *         # result is floored.
+ *       ->  (z + z>>8)>>8
+ *         # add 0x80/255 = 0.5 to convert floor to round
+ *       =>  (z+0x80 + (z+0x80)>>8 ) >> 8
+ * ------
+ * tested as equal to lround(z/255.0) for uint z in [0..0xfe02]
+ *
+ * z never exceeds 0xfe81 + 0xfe, so the SIMD variants compute the same
+ * thing in 16-bit lanes.
+ */
+static inline uint32_t premul_alpha(uint32_t c, uint32_t a) {
+	uint32_t z = c * a + 0x80;
+	return (z + (z >> 8)) >> 8;
+}
+
+static void rgb_to_xrgb_scalar(uint32_t *dst, const uint8_t *src, int width) {
+	for (int x = 0; x < width; x++, src += 3) {
+		dst[x] = (uint32_t)src[0] << 16 | (uint32_t)src[1] << 8 | src[2];
+	}
+}
+
+static void rgba_premul_scalar(uint32_t *dst, const uint8_t *src, int width) {
+	for (int x = 0; x < width; x++, src += 4) {
+		uint32_t a = src[3];
+		dst[x] = a << 24 |
+			premul_alpha(src[0], a) << 16 |
+			premul_alpha(src[1], a) << 8 |
+			premul_alpha(src[2], a);
+	}
+}
+
+static const struct pixconv_funcs scalar_funcs = {
+	.name = "scalar",
+	.rgb_to_xrgb = rgb_to_xrgb_scalar,
+	.rgba_premul = rgba_premul_scalar,
+};
+
+#if HAVE_X86_SIMD && !PIXCONV_BIG_ENDIAN
+
+__attribute__((target("sse2")))
+static void rgb_to_xrgb_sse2(uint32_t *dst, const uint8_t *src, int width) {
+	const __m128i lo = _mm_set1_epi32(0x000000ff);
+	const __m128i mid = _mm_set1_epi32(0x0000ff00);
+	int x = 0;
+	// Each iteration loads 16 bytes but only consumes 12 of them
+	for (; x + 6 <= width; x += 4, src += 12) {
+		__m128i v = _mm_loadu_si128((const __m128i *)src);
+		// Gather bytes 3i..3i+2 into lane i as R | G << 8 | B << 16
+		__m128i p01 = _mm_unpacklo_epi32(v, _mm_srli_si128(v, 3));
+		__m128i p23 = _mm_unpacklo_epi32(_mm_srli_si128(v, 6),
+			_mm_srli_si128(v, 9));
+		__m128i p = _mm_unpacklo_epi64(p01, p23);
+		// Swap R and B, clear the X byte
+		__m128i r = _mm_slli_epi32(_mm_and_si128(p, lo), 16);
+		__m128i g = _mm_and_si128(p, mid);
+		__m128i b = _mm_and_si128(_mm_srli_epi32(p, 16), lo);
+		_mm_storeu_si128((__m128i *)(dst + x),
+			_mm_or_si128(_mm_or_si128(r, g), b));
+	}
+	rgb_to_xrgb_scalar(dst + x, src, width - x);
+}
+
+__attribute__((target("sse2")))
+static inline __m128i premul_sse2(__m128i px) {
+	const __m128i alpha_mask = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+	const __m128i round = _mm_set1_epi16(0x80);
+	// RGBA -> BGRA and broadcast alpha, for two pixels in 16-bit lanes
+	__m128i bgra = _mm_shufflehi_epi16(
+		_mm_shufflelo_epi16(px, _MM_SHUFFLE(3, 0, 1, 2)),
+		_MM_SHUFFLE(3, 0, 1, 2));
+	__m128i a = _mm_shufflehi_epi16(
+		_mm_shufflelo_epi16(px, _MM_SHUFFLE(3, 3, 3, 3)),
+		_MM_SHUFFLE(3, 3, 3, 3));
+	__m128i z = _mm_add_epi16(_mm_mullo_epi16(bgra, a), round);
+	z = _mm_srli_epi16(_mm_add_epi16(z, _mm_srli_epi16(z, 8)), 8);
+	return _mm_or_si128(_mm_andnot_si128(alpha_mask, z),
+		_mm_and_si128(alpha_mask, px));
+}
+
+__attribute__((target("sse2")))
+static void rgba_premul_sse2(uint32_t *dst, const uint8_t *src, int width) {
+	const __m128i zero = _mm_setzero_si128();
+	int x = 0;
+	for (; x + 4 <= width; x += 4, src += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)src);
+		__m128i lo = premul_sse2(_mm_unpacklo_epi8(v, zero));
+		__m128i hi = premul_sse2(_mm_unpackhi_epi8(v, zero));
+		_mm_storeu_si128((__m128i *)(dst + x), _mm_packus_epi16(lo, hi));
+	}
+	rgba_premul_scalar(dst + x, src, width - x);
+}
+
+static const struct pixconv_funcs sse2_funcs = {
+	.name = "sse2",
+	.rgb_to_xrgb = rgb_to_xrgb_sse2,
+	.rgba_premul = rgba_premul_sse2,
+};
+
+__attribute__((target("avx2")))
+static void rgb_to_xrgb_avx2(uint32_t *dst, const uint8_t *src, int width) {
+	const __m256i shuffle = _mm256_setr_epi8(
+		2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1,
+		2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+	int x = 0;
+	// Loads reach up to byte 28 of the 24 consumed per iteration
+	for (; x + 10 <= width; x += 8, src += 24) {
+		__m256i v = _mm256_inserti128_si256(
+			_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)src)),
+			_mm_loadu_si128((const __m128i *)(src + 12)), 1);
+		_mm256_storeu_si256((__m256i *)(dst + x),
+			_mm256_shuffle_epi8(v, shuffle));
+	}
+	rgb_to_xrgb_scalar(dst + x, src, width - x);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i premul_avx2(__m256i px) {
+	const __m256i alpha_mask = _mm256_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0,
+		-1, 0, 0, 0, -1, 0, 0, 0);
+	const __m256i round = _mm256_set1_epi16(0x80);
+	__m256i bgra = _mm256_shufflehi_epi16(
+		_mm256_shufflelo_epi16(px, _MM_SHUFFLE(3, 0, 1, 2)),
+		_MM_SHUFFLE(3, 0, 1, 2));
+	__m256i a = _mm256_shufflehi_epi16(
+		_mm256_shufflelo_epi16(px, _MM_SHUFFLE(3, 3, 3, 3)),
+		_MM_SHUFFLE(3, 3, 3, 3));
+	__m256i z = _mm256_add_epi16(_mm256_mullo_epi16(bgra, a), round);
+	z = _mm256_srli_epi16(_mm256_add_epi16(z, _mm256_srli_epi16(z, 8)), 8);
+	return _mm256_or_si256(_mm256_andnot_si256(alpha_mask, z),
+		_mm256_and_si256(alpha_mask, px));
+}
+
+__attribute__((target("avx2")))
+static void rgba_premul_avx2(uint32_t *dst, const uint8_t *src, int width) {
+	const __m256i zero = _mm256_setzero_si256();
+	int x = 0;
+	for (; x + 8 <= width; x += 8, src += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)src);
+		// Unpacking and packing both work per 128-bit lane, so the
+		// pixel order is preserved
+		__m256i lo = premul_avx2(_mm256_unpacklo_epi8(v, zero));
+		__m256i hi = premul_avx2(_mm256_unpackhi_epi8(v, zero));
+		_mm256_storeu_si256((__m256i *)(dst + x),
+			_mm256_packus_epi16(lo, hi));
+	}
+	rgba_premul_sse2(dst + x, src, width - x);
+}
+
+static const struct pixconv_funcs avx2_funcs = {
+	.name = "avx2",
+	.rgb_to_xrgb = rgb_to_xrgb_avx2,
+	.rgba_premul = rgba_premul_avx2,
+};
+
+#endif // HAVE_X86_SIMD && !PIXCONV_BIG_ENDIAN
+
+#if HAVE_NEON && !PIXCONV_BIG_ENDIAN
+
+static void rgb_to_xrgb_neon(uint32_t *dst, const uint8_t *src, int width) {
+	int x = 0;
+	for (; x + 16 <= width; x += 16, src += 48) {
+		uint8x16x3_t rgb = vld3q_u8(src);
+		uint8x16x4_t bgrx = {{ rgb.val[2], rgb.val[1], rgb.val[0],
+			vdupq_n_u8(0) }};
+		vst4q_u8((uint8_t *)(dst + x), bgrx);
+	}
+	rgb_to_xrgb_scalar(dst + x, src, width - x);
+}
+
+static inline uint8x8_t premul_neon(uint8x8_t c, uint8x8_t a) {
+	uint16x8_t z = vaddq_u16(vmull_u8(c, a), vdupq_n_u16(0x80));
+	return vshrn_n_u16(vaddq_u16(z, vshrq_n_u16(z, 8)), 8);
+}
+
+static inline uint8x16_t premul_neon_q(uint8x16_t c, uint8x16_t a) {
+	return vcombine_u8(premul_neon(vget_low_u8(c), vget_low_u8(a)),
+		premul_neon(vget_high_u8(c), vget_high_u8(a)));
+}
+
+static void rgba_premul_neon(uint32_t *dst, const uint8_t *src, int width) {
+	int x = 0;
+	for (; x + 16 <= width; x += 16, src += 64) {
+		uint8x16x4_t rgba = vld4q_u8(src);
+		uint8x16_t a = rgba.val[3];
+		uint8x16x4_t bgra = {{
+			premul_neon_q(rgba.val[2], a),
+			premul_neon_q(rgba.val[1], a),
+			premul_neon_q(rgba.val[0], a),
+			a,
+		}};
+		vst4q_u8((uint8_t *)(dst + x), bgra);
+	}
+	rgba_premul_scalar(dst + x, src, width - x);
+}
+
+static const struct pixconv_funcs neon_funcs = {
+	.name = "neon",
+	.rgb_to_xrgb = rgb_to_xrgb_neon,
+	.rgba_premul = rgba_premul_neon,
+};
+
+#endif // HAVE_NEON && !PIXCONV_BIG_ENDIAN
+
+const struct pixconv_funcs *pixconv_get_scalar(void) {
+	return &scalar_funcs;
+}
+
+const struct pixconv_funcs *pixconv_get(void) {
+#if HAVE_X86_SIMD && !PIXCONV_BIG_ENDIAN
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		return &avx2_funcs;
+	}
+	if (__builtin_cpu_supports("sse2")) {
+		return &sse2_funcs;
+	}
+#elif HAVE_NEON && !PIXCONV_BIG_ENDIAN
+	return &neon_funcs;
+#endif
+	return &scalar_funcs;
+}
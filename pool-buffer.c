@@ -1,3 +1,6 @@
+#if HAVE_MEMFD_CREATE
+#define _GNU_SOURCE  // memfd_create and file seals
+#endif
 #include <assert.h>
 #include <cairo.h>
 #include <errno.h>
@@ -9,9 +12,16 @@
 #include <time.h>
 #include <unistd.h>
 #include <wayland-client.h>
+#include "log.h"
 #include "pool-buffer.h"
 
 static int anonymous_shm_open(void) {
+#if HAVE_MEMFD_CREATE
+	int memfd = memfd_create("swaybg", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (memfd >= 0) {
+		return memfd;
+	}
+#endif
 	int retries = 100;
 
 	do {
@@ -36,6 +46,15 @@ static int anonymous_shm_open(void) {
 	return -1;
 }
 
+static void buffer_release(void *data, struct wl_buffer *wl_buffer) {
+	struct pool_buffer *buffer = data;
+	buffer->busy = false;
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+	.release = buffer_release
+};
+
 bool create_buffer(struct pool_buffer *buf, struct wl_shm *shm,
 		int32_t width, int32_t height, uint32_t format) {
 	uint32_t stride = width * 4;
@@ -48,15 +67,23 @@ bool create_buffer(struct pool_buffer *buf, struct wl_shm *shm,
 		close(fd);
 		return false;
 	}
+#if HAVE_MEMFD_CREATE
+	// Frames are handed out to other processes, which must not be able to
+	// resize the buffer under us
+	fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+#endif
 
 	void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
 	struct wl_shm_pool *pool = wl_shm_create_pool(shm, fd, size);
 	buf->buffer = wl_shm_pool_create_buffer(pool, 0,
 			width, height, stride, format);
+	wl_buffer_add_listener(buf->buffer, &buffer_listener, buf);
 	wl_shm_pool_destroy(pool);
-	close(fd);
 
+	buf->fd = fd;
 	buf->size = size;
+	buf->width = width;
+	buf->height = height;
 	buf->data = data;
 	buf->surface = cairo_image_surface_create_for_data(data,
 			CAIRO_FORMAT_RGB24, width, height, stride);
@@ -67,6 +94,7 @@ bool create_buffer(struct pool_buffer *buf, struct wl_shm *shm,
 void destroy_buffer(struct pool_buffer *buffer) {
 	if (buffer->buffer) {
 		wl_buffer_destroy(buffer->buffer);
+		close(buffer->fd);
 	}
 	if (buffer->cairo) {
 		cairo_destroy(buffer->cairo);
@@ -77,4 +105,55 @@ void destroy_buffer(struct pool_buffer *buffer) {
 	if (buffer->data) {
 		munmap(buffer->data, buffer->size);
 	}
+	memset(buffer, 0, sizeof(struct pool_buffer));
+}
+
+int export_buffer(const struct pool_buffer *buffer) {
+	// A new open file description, unlike dup(), so that readers do not
+	// get write access by mistake. They can still reopen it for writing.
+	char path[32];
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", buffer->fd);
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd >= 0 || (errno != ENOENT && errno != ENOTDIR)) {
+		return fd;
+	}
+	// Without /proc, as usual on FreeBSD
+	static bool logged = false;
+	if (!logged) {
+		swaybg_log(LOG_DEBUG, "/proc is not available, exporting buffers "
+			"with write access");
+		logged = true;
+	}
+	return fcntl(buffer->fd, F_DUPFD_CLOEXEC, 0);
+}
+
+struct pool_buffer *get_next_buffer(struct wl_shm *shm,
+		struct pool_buffer pool[static 2], const struct pool_buffer *shown,
+		uint32_t width, uint32_t height, uint32_t format) {
+	struct pool_buffer *buffer = NULL;
+
+	for (size_t i = 0; i < 2; ++i) {
+		// Compositors which copy the buffer release it right away, but it
+		// may have been exported to be read until the next frame
+		if (pool[i].busy || (&pool[i] == shown && shown->buffer)) {
+			continue;
+		}
+		buffer = &pool[i];
+	}
+
+	if (!buffer) {
+		return NULL;
+	}
+
+	if (buffer->width != width || buffer->height != height) {
+		destroy_buffer(buffer);
+	}
+
+	if (!buffer->buffer) {
+		if (!create_buffer(buffer, shm, width, height, format)) {
+			return NULL;
+		}
+	}
+	buffer->busy = true;
+	return buffer;
 }
@@ -0,0 +1,128 @@
+#if HAVE_SCHED_IDLE || HAVE_SCHED_SETAFFINITY
+#define _GNU_SOURCE  // SCHED_IDLE and CPU sets
+#endif
+#include <sched.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <time.h>
+#include "log.h"
+#include "parallel.h"
+#include "priority.h"
+
+#define QUOTA_WINDOW_NS 60000000000ull
+
+bool priority_set_background(void) {
+#if HAVE_SCHED_IDLE
+	struct sched_param param = { .sched_priority = 0 };
+	if (sched_setscheduler(0, SCHED_IDLE, &param) == 0) {
+		swaybg_log(LOG_DEBUG, "Running with the idle scheduling policy");
+		return true;
+	}
+	swaybg_log_errno(LOG_ERROR, "Failed to set the idle scheduling policy");
+#endif
+	if (setpriority(PRIO_PROCESS, 0, 19) != 0) {
+		swaybg_log_errno(LOG_ERROR, "Failed to lower the priority");
+		return false;
+	}
+	return true;
+}
+
+int priority_set_affinity(const char *cpus) {
+#if HAVE_SCHED_SETAFFINITY
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	const char *p = cpus;
+	while (*p) {
+		char *end;
+		long first = strtol(p, &end, 10), last = first;
+		if (end == p) {
+			goto invalid;
+		}
+		if (*end == '-') {
+			p = end + 1;
+			last = strtol(p, &end, 10);
+			if (end == p) {
+				goto invalid;
+			}
+		}
+		if (first < 0 || last < first || last >= CPU_SETSIZE) {
+			goto invalid;
+		}
+		for (long cpu = first; cpu <= last; cpu++) {
+			CPU_SET(cpu, &set);
+		}
+		if (*end == ',') {
+			end++;
+		} else if (*end != '\0') {
+			goto invalid;
+		}
+		p = end;
+	}
+	int count = CPU_COUNT(&set);
+	if (count == 0) {
+		goto invalid;
+	}
+	if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+		swaybg_log_errno(LOG_ERROR, "Failed to run on CPUs %s", cpus);
+		return 0;
+	}
+	// No point in more workers than CPUs to run them
+	parallel_set_max_threads(count);
+	return count;
+
+invalid:
+	swaybg_log(LOG_ERROR, "Invalid CPU list: %s", cpus);
+	return 0;
+#else
+	swaybg_log(LOG_ERROR, "CPU affinity is not supported on this system");
+	return 0;
+#endif
+}
+
+static uint64_t get_clock_ns(clockid_t clock) {
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void cpu_quota_init(struct cpu_quota *quota, int ms_per_minute) {
+	*quota = (struct cpu_quota){
+		.quota_ns = (uint64_t)ms_per_minute * 1000000,
+		.window_start = get_clock_ns(CLOCK_MONOTONIC),
+		.cpu_start = get_clock_ns(CLOCK_PROCESS_CPUTIME_ID),
+	};
+}
+
+bool cpu_quota_exhausted(struct cpu_quota *quota) {
+	if (quota->quota_ns == 0) {
+		return false;
+	}
+	uint64_t now = get_clock_ns(CLOCK_MONOTONIC);
+	if (now - quota->window_start >= QUOTA_WINDOW_NS) {
+		if (quota->exhausted) {
+			swaybg_log(LOG_INFO, "CPU quota renewed, resuming animations");
+		}
+		quota->window_start = now;
+		quota->cpu_start = get_clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+		quota->exhausted = false;
+	} else if (!quota->exhausted &&
+			cpu_quota_used_ns(quota) >= quota->quota_ns) {
+		swaybg_log(LOG_INFO, "CPU quota of %.0f ms used up, pausing "
+			"animations for %.1f s", quota->quota_ns / 1e6,
+			(QUOTA_WINDOW_NS - (now - quota->window_start)) / 1e9);
+		quota->exhausted = true;
+	}
+	return quota->exhausted;
+}
+
+int cpu_quota_timeout(const struct cpu_quota *quota) {
+	uint64_t elapsed = get_clock_ns(CLOCK_MONOTONIC) - quota->window_start;
+	if (elapsed >= QUOTA_WINDOW_NS) {
+		return 0;
+	}
+	return (QUOTA_WINDOW_NS - elapsed + 999999) / 1000000;
+}
+
+uint64_t cpu_quota_used_ns(const struct cpu_quota *quota) {
+	return get_clock_ns(CLOCK_PROCESS_CPUTIME_ID) - quota->cpu_start;
+}
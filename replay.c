@@ -0,0 +1,325 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "log.h"
+#include "replay.h"
+
+#define TWO_PI 6.28318530717958647692
+// Angles are stored in 1/ANGLE_UNITS of a full turn
+#define ANGLE_UNITS 65536
+
+static uint32_t quantize_angle(float angle) {
+	return (uint32_t)lrint(angle * (ANGLE_UNITS / TWO_PI)) & (ANGLE_UNITS - 1);
+}
+
+static uint32_t zigzag(int32_t v) {
+	return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static int32_t unzigzag(uint32_t v) {
+	return (int32_t)((v >> 1) ^ -(v & 1));
+}
+
+static void put_varint(FILE *f, uint32_t v) {
+	while (v >= 0x80) {
+		putc((v & 0x7f) | 0x80, f);
+		v >>= 7;
+	}
+	putc(v, f);
+}
+
+static bool get_varint(const uint8_t *data, size_t size, size_t *offset,
+		uint32_t *value) {
+	uint32_t v = 0;
+	for (int shift = 0; shift < 35 && *offset < size; shift += 7) {
+		uint8_t b = data[(*offset)++];
+		v |= (uint32_t)(b & 0x7f) << shift;
+		if (!(b & 0x80)) {
+			*value = v;
+			return true;
+		}
+	}
+	return false;
+}
+
+struct recorder *recorder_create(const char *path,
+		const struct anim_config *cf, int width, int height) {
+	struct recorder *rec = calloc(1, sizeof(struct recorder));
+	if (!rec) {
+		return NULL;
+	}
+	rec->file = fopen(path, "we");
+	if (!rec->file) {
+		swaybg_log_errno(LOG_ERROR, "Failed to create recording %s", path);
+		free(rec);
+		return NULL;
+	}
+	struct replay_header header = {
+		.version = REPLAY_VERSION,
+		.width = width,
+		.height = height,
+		.total_traces = cf->total_traces,
+		.min_velocity = cf->min_velocity,
+		.max_velocity = cf->max_velocity,
+		.min_accel = cf->min_accel,
+		.max_accel = cf->max_accel,
+		.line_width = cf->line_width,
+		.trace_len = cf->trace_len,
+		.decay_limit = cf->decay_limit,
+	};
+	memcpy(header.magic, REPLAY_MAGIC, sizeof(header.magic));
+	if (fwrite(&header, sizeof(header), 1, rec->file) != 1 ||
+			fflush(rec->file) != 0) {
+		swaybg_log_errno(LOG_ERROR, "Failed to write recording %s", path);
+		recorder_destroy(rec);
+		return NULL;
+	}
+	swaybg_log(LOG_DEBUG, "Recording the walk at %dx%d to %s",
+		width, height, path);
+	return rec;
+}
+
+bool recorder_step(struct recorder *rec, const struct anim_context *actx) {
+	if (actx->nxt_pos < rec->nxt_pos) {
+		// The bird got stuck and was replaced by a fresh one
+		put_varint(rec->file, 1);
+		rec->nxt_pos = 0;
+	}
+	// Traces older than the history are gone, e.g. after a fast forward
+	int from = rec->nxt_pos;
+	if (from < actx->nxt_pos - actx->cf.total_traces) {
+		from = actx->nxt_pos - actx->cf.total_traces;
+	}
+	for (int i = from; i < actx->nxt_pos; i++) {
+		const struct trace *trace = &actx->traces[i % actx->cf.total_traces];
+		uint32_t angle = quantize_angle(trace->angle);
+		int32_t da = (angle - rec->angle) & (ANGLE_UNITS - 1);
+		if (da >= ANGLE_UNITS / 2) {
+			da -= ANGLE_UNITS;
+		}
+		// Every context starts with the left foot
+		put_varint(rec->file, zigzag(da) << 2 | (uint32_t)(i & 1) << 1);
+		put_varint(rec->file, zigzag(trace->x - rec->x));
+		put_varint(rec->file, zigzag(trace->y - rec->y));
+		rec->x = trace->x;
+		rec->y = trace->y;
+		rec->angle = angle;
+	}
+	rec->nxt_pos = actx->nxt_pos;
+	// Keep the file usable if we get killed
+	return fflush(rec->file) == 0 && !ferror(rec->file);
+}
+
+void recorder_destroy(struct recorder *rec) {
+	if (!rec) {
+		return;
+	}
+	fclose(rec->file);
+	free(rec);
+}
+
+// Advance the cursor by one step, or return false at the end of the data
+static bool decode_step(const uint8_t *data, size_t size,
+		struct replay_cursor *cursor, bool *clear, enum anim_foot *foot) {
+	size_t offset = cursor->offset;
+	uint32_t tag, dx = 0, dy = 0;
+	if (!get_varint(data, size, &offset, &tag)) {
+		return false;
+	}
+	*clear = tag & 1;
+	if (*clear) {
+		cursor->nxt_pos = 0;
+	} else {
+		if (!get_varint(data, size, &offset, &dx) ||
+				!get_varint(data, size, &offset, &dy)) {
+			return false;
+		}
+		cursor->angle = (cursor->angle + unzigzag(tag >> 2)) &
+			(ANGLE_UNITS - 1);
+		cursor->x += unzigzag(dx);
+		cursor->y += unzigzag(dy);
+		*foot = (tag & 2) ? BIRD_RIGHT : BIRD_LEFT;
+		cursor->nxt_pos++;
+	}
+	cursor->offset = offset;
+	cursor->step++;
+	return true;
+}
+
+static void apply_step(const struct replay *replay,
+		const struct replay_cursor *cursor, bool clear, enum anim_foot foot,
+		struct anim_context *actx, int width, int height) {
+	if (clear) {
+		actx->nxt_pos = 0;
+		actx->nxt_foot = BIRD_LEFT;
+		return;
+	}
+	int x = (int64_t)cursor->x * width / replay->width;
+	int y = (int64_t)cursor->y * height / replay->height;
+	actx->traces[actx->nxt_pos % actx->cf.total_traces] = (struct trace) {
+		.x = x,
+		.y = y,
+		.angle = cursor->angle * (TWO_PI / ANGLE_UNITS),
+	};
+	actx->nxt_pos++;
+	actx->cur_x = actx->nxt_x = x;
+	actx->cur_y = actx->nxt_y = y;
+	actx->nxt_foot = foot == BIRD_LEFT ? BIRD_RIGHT : BIRD_LEFT;
+}
+
+static bool check_header(const struct replay_header *header) {
+	return memcmp(header->magic, REPLAY_MAGIC, sizeof(header->magic)) == 0 &&
+		header->version == REPLAY_VERSION &&
+		header->width > 0 && header->height > 0 &&
+		header->total_traces > 0 && header->total_traces <= 65536 &&
+		header->line_width > 0 && header->trace_len > 0 &&
+		header->decay_limit >= 0 && header->decay_limit < 31;
+}
+
+struct replay *replay_open(const char *path) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		swaybg_log_errno(LOG_ERROR, "Failed to open recording %s", path);
+		return NULL;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct replay_header)) {
+		swaybg_log(LOG_ERROR, "%s is not a swaybg recording", path);
+		close(fd);
+		return NULL;
+	}
+	size_t map_size = st.st_size;
+	const uint8_t *data = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		swaybg_log_errno(LOG_ERROR, "Failed to map recording %s", path);
+		return NULL;
+	}
+
+	struct replay_header header;
+	memcpy(&header, data, sizeof(header));
+	if (!check_header(&header)) {
+		swaybg_log(LOG_ERROR, "%s is not a swaybg recording", path);
+		munmap((void *)data, map_size);
+		return NULL;
+	}
+	// Steps are read sequentially, seeking aside
+	posix_madvise((void *)data, map_size, POSIX_MADV_SEQUENTIAL);
+
+	struct replay *replay = calloc(1, sizeof(struct replay));
+	if (!replay) {
+		munmap((void *)data, map_size);
+		return NULL;
+	}
+	*replay = (struct replay){
+		.data = data,
+		.map_size = map_size,
+		.width = header.width,
+		.height = header.height,
+		.cf = {
+			.total_traces = header.total_traces,
+			.min_velocity = header.min_velocity,
+			.max_velocity = header.max_velocity,
+			.min_accel = header.min_accel,
+			.max_accel = header.max_accel,
+			.line_width = header.line_width,
+			.trace_len = header.trace_len,
+			.decay_limit = header.decay_limit,
+		},
+	};
+
+	// Count the steps and remember where to start seeking from
+	struct replay_cursor cursor = { .offset = sizeof(header) };
+	int capacity = 0;
+	bool clear;
+	enum anim_foot foot;
+	do {
+		if (cursor.step % REPLAY_INDEX_INTERVAL != 0) {
+			continue;
+		}
+		if (replay->n_index == capacity) {
+			capacity = capacity ? capacity * 2 : 16;
+			struct replay_cursor *index = realloc(replay->index,
+				capacity * sizeof(*index));
+			if (!index) {
+				replay_close(replay);
+				return NULL;
+			}
+			replay->index = index;
+		}
+		replay->index[replay->n_index++] = cursor;
+	} while (cursor.step < INT_MAX &&
+		decode_step(data, map_size, &cursor, &clear, &foot));
+
+	// Ignore a step cut short when the recording was interrupted
+	replay->size = cursor.offset;
+	replay->steps = cursor.step;
+	if (replay->steps == 0) {
+		swaybg_log(LOG_ERROR, "Recording %s contains no steps", path);
+		replay_close(replay);
+		return NULL;
+	}
+	swaybg_log(LOG_DEBUG, "Loaded recording %s: %d steps at %dx%d",
+		path, replay->steps, replay->width, replay->height);
+	return replay;
+}
+
+void replay_close(struct replay *replay) {
+	if (!replay) {
+		return;
+	}
+	munmap((void *)replay->data, replay->map_size);
+	free(replay->index);
+	free(replay);
+}
+
+struct anim_context *replay_create_context(const struct replay *replay) {
+	return anim_alloc(&replay->cf);
+}
+
+void replay_step(const struct replay *replay, struct replay_cursor *cursor,
+		struct anim_context *actx, int width, int height) {
+	bool clear;
+	enum anim_foot foot;
+	if (cursor->offset == 0 || !decode_step(replay->data, replay->size,
+			cursor, &clear, &foot)) {
+		// Start over from a clean slate
+		*cursor = replay->index[0];
+		actx->nxt_pos = 0;
+		actx->nxt_foot = BIRD_LEFT;
+		if (!decode_step(replay->data, replay->size, cursor,
+				&clear, &foot)) {
+			return;
+		}
+	}
+	apply_step(replay, cursor, clear, foot, actx, width, height);
+}
+
+void replay_seek(const struct replay *replay, struct replay_cursor *cursor,
+		struct anim_context *actx, int step, int width, int height) {
+	step %= replay->steps;
+	if (step < 0) {
+		step += replay->steps;
+	}
+	// Only the last steps before the target leave visible traces, but the
+	// position in the ring of traces is the one of a sequential walk
+	int from = step - replay->cf.total_traces;
+	if (from < 0) {
+		from = 0;
+	}
+	*cursor = replay->index[from / REPLAY_INDEX_INTERVAL];
+	actx->nxt_pos = cursor->nxt_pos;
+	actx->nxt_foot = BIRD_LEFT;
+	bool clear;
+	enum anim_foot foot;
+	while (cursor->step < step && decode_step(replay->data, replay->size,
+			cursor, &clear, &foot)) {
+		apply_step(replay, cursor, clear, foot, actx, width, height);
+	}
+}
@@ -0,0 +1,97 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "log.h"
+#include "startup.h"
+
+static const char *event_names[] = {
+	[STARTUP_EXEC] = "exec",
+	[STARTUP_MAIN] = "main",
+	[STARTUP_REGISTRY] = "registry",
+	[STARTUP_CONFIGURE] = "configure",
+	[STARTUP_COMMIT] = "commit",
+};
+
+// CLOCK_MONOTONIC times, 0 until the event happened
+static uint64_t events[STARTUP_EVENT_COUNT];
+
+static uint64_t get_clock_ns(clockid_t clock) {
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Age of the process in nanoseconds from its start time in /proc, in clock
+// ticks since boot, or 0 if unknown. This covers the dynamic linking before
+// main(), which depends on the libraries we link.
+static uint64_t get_process_age_ns(void) {
+#ifdef CLOCK_BOOTTIME
+	FILE *f = fopen("/proc/self/stat", "r");
+	if (!f) {
+		return 0;
+	}
+	char buf[1024];
+	size_t len = fread(buf, 1, sizeof(buf) - 1, f);
+	fclose(f);
+	buf[len] = '\0';
+	// The command name may contain spaces and parentheses, the fields
+	// after it do not
+	char *p = strrchr(buf, ')');
+	unsigned long long start_ticks;
+	if (!p || sscanf(p + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+			"%*u %*u %*d %*d %*d %*d %*d %*d %llu", &start_ticks) != 1) {
+		return 0;
+	}
+	long ticks_per_s = sysconf(_SC_CLK_TCK);
+	if (ticks_per_s <= 0) {
+		return 0;
+	}
+	uint64_t start_ns = start_ticks * 1000000000 / ticks_per_s;
+	uint64_t now_ns = get_clock_ns(CLOCK_BOOTTIME);
+	return now_ns > start_ns ? now_ns - start_ns : 0;
+#else
+	return 0;
+#endif
+}
+
+void startup_init(void) {
+	uint64_t now = get_clock_ns(CLOCK_MONOTONIC);
+	events[STARTUP_MAIN] = now;
+	uint64_t age = get_process_age_ns();
+	if (age > 0 && age < now) {
+		events[STARTUP_EXEC] = now - age;
+	}
+}
+
+static void log_timeline(void) {
+	enum startup_event origin = events[STARTUP_EXEC] ?
+		STARTUP_EXEC : STARTUP_MAIN;
+	char line[256];
+	size_t len = 0;
+	for (int i = origin + 1; i < STARTUP_EVENT_COUNT; i++) {
+		if (!events[i]) {
+			continue;
+		}
+		int n = snprintf(line + len, sizeof(line) - len, "%s%s +%.1f ms",
+			len > 0 ? ", " : "", event_names[i],
+			(events[i] - events[origin]) / 1e6);
+		if (n < 0 || (size_t)n >= sizeof(line) - len) {
+			break;
+		}
+		len += n;
+	}
+	swaybg_log(LOG_INFO, "Startup after %s: %s", event_names[origin], line);
+}
+
+void startup_mark(enum startup_event event) {
+	if (events[event]) {
+		return;
+	}
+	events[event] = get_clock_ns(CLOCK_MONOTONIC);
+	if (event == STARTUP_COMMIT) {
+		log_timeline();
+	}
+}
@@ -0,0 +1,273 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "trail.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#else
+#define HAVE_X86_SIMD 0
+#endif
+#if defined(__aarch64__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HAVE_NEON 1
+#else
+#define HAVE_NEON 0
+#endif
+
+// An 8-bit mask cannot hold a smooth exponential over more fades than this:
+// with more, consecutive fades would mostly just subtract one
+#define TRAIL_MAX_FADES 64
+
+static void fade_scalar(uint8_t *row, int n, uint8_t factor) {
+	for (int x = 0; x < n; x++) {
+		row[x] = (row[x] * factor) >> 8;
+	}
+}
+
+static const struct trail_fade_funcs scalar_funcs = {
+	.name = "scalar",
+	.fade = fade_scalar,
+};
+
+#if HAVE_X86_SIMD
+
+__attribute__((target("sse2")))
+static void fade_sse2(uint8_t *row, int n, uint8_t factor) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i f = _mm_set1_epi16(factor);
+	int x = 0;
+	for (; x + 16 <= n; x += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(row + x));
+		__m128i lo = _mm_srli_epi16(_mm_mullo_epi16(
+			_mm_unpacklo_epi8(v, zero), f), 8);
+		__m128i hi = _mm_srli_epi16(_mm_mullo_epi16(
+			_mm_unpackhi_epi8(v, zero), f), 8);
+		_mm_storeu_si128((__m128i *)(row + x), _mm_packus_epi16(lo, hi));
+	}
+	fade_scalar(row + x, n - x, factor);
+}
+
+static const struct trail_fade_funcs sse2_funcs = {
+	.name = "sse2",
+	.fade = fade_sse2,
+};
+
+__attribute__((target("avx2")))
+static void fade_avx2(uint8_t *row, int n, uint8_t factor) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i f = _mm256_set1_epi16(factor);
+	int x = 0;
+	for (; x + 32 <= n; x += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(row + x));
+		// Unpacking and packing both work per 128-bit lane, so the byte
+		// order is preserved
+		__m256i lo = _mm256_srli_epi16(_mm256_mullo_epi16(
+			_mm256_unpacklo_epi8(v, zero), f), 8);
+		__m256i hi = _mm256_srli_epi16(_mm256_mullo_epi16(
+			_mm256_unpackhi_epi8(v, zero), f), 8);
+		_mm256_storeu_si256((__m256i *)(row + x),
+			_mm256_packus_epi16(lo, hi));
+	}
+	fade_sse2(row + x, n - x, factor);
+}
+
+static const struct trail_fade_funcs avx2_funcs = {
+	.name = "avx2",
+	.fade = fade_avx2,
+};
+
+#endif // HAVE_X86_SIMD
+
+#if HAVE_NEON
+
+static void fade_neon(uint8_t *row, int n, uint8_t factor) {
+	const uint8x8_t f = vdup_n_u8(factor);
+	int x = 0;
+	for (; x + 16 <= n; x += 16) {
+		uint8x16_t v = vld1q_u8(row + x);
+		vst1q_u8(row + x, vcombine_u8(
+			vshrn_n_u16(vmull_u8(vget_low_u8(v), f), 8),
+			vshrn_n_u16(vmull_u8(vget_high_u8(v), f), 8)));
+	}
+	fade_scalar(row + x, n - x, factor);
+}
+
+static const struct trail_fade_funcs neon_funcs = {
+	.name = "neon",
+	.fade = fade_neon,
+};
+
+#endif // HAVE_NEON
+
+const struct trail_fade_funcs *trail_fade_get_scalar(void) {
+	return &scalar_funcs;
+}
+
+const struct trail_fade_funcs *trail_fade_get(void) {
+#if HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		return &avx2_funcs;
+	}
+	if (__builtin_cpu_supports("sse2")) {
+		return &sse2_funcs;
+	}
+#elif HAVE_NEON
+	return &neon_funcs;
+#endif
+	return &scalar_funcs;
+}
+
+struct trail *trail_create(int width, int height, int div, int length) {
+	struct trail *trail = calloc(1, sizeof(struct trail));
+	if (!trail) {
+		return NULL;
+	}
+	trail->mask = cairo_image_surface_create(CAIRO_FORMAT_A8, width, height);
+	if (cairo_surface_status(trail->mask) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(trail->mask);
+		free(trail);
+		return NULL;
+	}
+	trail->cairo = cairo_create(trail->mask);
+	cairo_scale(trail->cairo, 1.0 / div, 1.0 / div);
+	trail->width = width;
+	trail->height = height;
+	trail->div = div;
+
+	// Spread at most TRAIL_MAX_FADES fades over the trail, each bringing
+	// the footprint closer to 1/255 of its opacity after `length` steps
+	int fades = length < TRAIL_MAX_FADES ? length : TRAIL_MAX_FADES;
+	if (fades < 1) {
+		fades = 1;
+	}
+	trail->fade_interval = (length + fades - 1) / fades;
+	if (trail->fade_interval < 1) {
+		trail->fade_interval = 1;
+	}
+	fades = length / trail->fade_interval;
+	if (fades < 1) {
+		fades = 1;
+	}
+	long factor = lround(256 * pow(255, -1.0 / fades));
+	trail->fade_factor = factor > 255 ? 255 : factor;
+	return trail;
+}
+
+static void fade_mask(struct trail *trail) {
+	static const struct trail_fade_funcs *funcs = NULL;
+	if (!funcs) {
+		funcs = trail_fade_get();
+	}
+
+	const struct damage_rect *r = &trail->extent;
+	cairo_surface_flush(trail->mask);
+	uint8_t *data = cairo_image_surface_get_data(trail->mask);
+	int stride = cairo_image_surface_get_stride(trail->mask);
+	for (int y = r->y; y < r->y + r->height; y++) {
+		funcs->fade(data + (size_t)y * stride + r->x, r->width,
+			trail->fade_factor);
+	}
+	cairo_surface_mark_dirty_rectangle(trail->mask,
+		r->x, r->y, r->width, r->height);
+}
+
+static void extend_extent(struct damage_rect *extent,
+		const struct damage_rect *rect) {
+	if (extent->width == 0) {
+		*extent = *rect;
+		return;
+	}
+	int x0 = rect->x < extent->x ? rect->x : extent->x;
+	int y0 = rect->y < extent->y ? rect->y : extent->y;
+	int x1 = rect->x + rect->width > extent->x + extent->width ?
+		rect->x + rect->width : extent->x + extent->width;
+	int y1 = rect->y + rect->height > extent->y + extent->height ?
+		rect->y + rect->height : extent->y + extent->height;
+	*extent = (struct damage_rect){ x0, y0, x1 - x0, y1 - y0 };
+}
+
+void trail_scale_from(struct trail *trail, const struct trail *old) {
+	trail->steps = old->steps;
+	const struct damage_rect *r = &old->extent;
+	if (r->width == 0) {
+		return;
+	}
+	double sx = (double)trail->width / old->width;
+	double sy = (double)trail->height / old->height;
+	cairo_t *cairo = cairo_create(trail->mask);
+	cairo_scale(cairo, sx, sy);
+	cairo_set_source_surface(cairo, old->mask, 0, 0);
+	cairo_pattern_set_filter(cairo_get_source(cairo), CAIRO_FILTER_BILINEAR);
+	cairo_set_operator(cairo, CAIRO_OPERATOR_SOURCE);
+	cairo_paint(cairo);
+	cairo_destroy(cairo);
+
+	// A pixel more for the filter
+	int x0 = floor(r->x * sx) - 1, y0 = floor(r->y * sy) - 1;
+	int x1 = ceil((r->x + r->width) * sx) + 1;
+	int y1 = ceil((r->y + r->height) * sy) + 1;
+	struct damage_rect extent = { x0, y0, x1 - x0, y1 - y0 };
+	if (damage_clip_rect(&extent, trail->width, trail->height)) {
+		trail->extent = extent;
+	}
+}
+
+void trail_step(struct trail *trail, const struct anim_context *actx,
+		struct damage *damage) {
+	if (++trail->steps % trail->fade_interval == 0 &&
+			trail->extent.width > 0) {
+		fade_mask(trail);
+		damage_add_rect(damage, trail->extent, trail->width, trail->height);
+	}
+	trail_stamp(trail, actx, damage);
+}
+
+void trail_stamp(struct trail *trail, const struct anim_context *actx,
+		struct damage *damage) {
+	if (!actx || actx->nxt_pos == 0) {
+		return;
+	}
+
+	const struct trace *trace =
+		&actx->traces[(actx->nxt_pos - 1) % actx->cf.total_traces];
+	struct damage_rect rect = anim_trace_bounds(actx, trace);
+	if (trail->div > 1) {
+		int x1 = rect.x + rect.width, y1 = rect.y + rect.height;
+		rect.x = floor((double)rect.x / trail->div);
+		rect.y = floor((double)rect.y / trail->div);
+		rect.width = ceil((double)x1 / trail->div) - rect.x;
+		rect.height = ceil((double)y1 / trail->div) - rect.y;
+	}
+	if (!damage_clip_rect(&rect, trail->width, trail->height)) {
+		return;
+	}
+	cairo_set_line_width(trail->cairo, actx->cf.line_width);
+	anim_draw_trace(trail->cairo, actx, trace, 1);
+	extend_extent(&trail->extent, &rect);
+	damage_add_rect(damage, rect, trail->width, trail->height);
+}
+
+void trail_draw(struct trail *trail, cairo_t *cr, const struct damage *damage) {
+	cairo_save(cr);
+	if (!damage->full) {
+		for (int i = 0; i < damage->n_rects; i++) {
+			const struct damage_rect *r = &damage->rects[i];
+			cairo_rectangle(cr, r->x, r->y, r->width, r->height);
+		}
+		cairo_clip(cr);
+	}
+	anim_set_trace_source(cr, 1);
+	cairo_mask_surface(cr, trail->mask, 0, 0);
+	cairo_restore(cr);
+}
+
+void trail_destroy(struct trail *trail) {
+	if (!trail) {
+		return;
+	}
+	cairo_destroy(trail->cairo);
+	cairo_surface_destroy(trail->mask);
+	free(trail);
+}